@@ -1,6 +1,8 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+struct iovec;
+
 enum DomainType
 {
     Unspecified,
@@ -14,6 +16,44 @@ enum ConnectionType
     Datagram // UDP
 };
 
+enum SocketOptionName
+{
+    TCPCongestion       = 1, // Stream only, value is a CongestionControlType
+    SocketReceiveBuffer = 2, // Bytes; Stream before listen(), Datagram and Localhost at any time
+    TCPQuickAck         = 3, // Stream only, nonzero disables delayed ACKs
+    TCPNoDelay          = 4, // Stream only, nonzero disables Nagle
+    TCPCork             = 5, // Stream only, nonzero holds partial segments
+    SocketKeepAlive     = 6, // Stream only, nonzero probes idle connections
+    TCPKeepIdle         = 7, // Stream only, seconds idle before the first probe
+    TCPKeepInterval     = 8, // Stream only, seconds between probes
+    TCPKeepCount        = 9, // Stream only, unanswered probes before a reset
+    SocketReceiveDrops  = 10, // Datagram only, read-only, dropped on a full receive buffer
+    SocketReusePort     = 11, // Nonzero before bind() shares the port with others that set it
+    SocketMemory        = 12  // Read-only, bytes of kernel memory charged to the socket
+};
+
+enum CongestionControlType
+{
+    CongestionNewReno,
+    CongestionCubic
+};
+
+// send() and recv() flags
+enum SocketMessageFlags
+{
+    MessageDontWait = 0x40 // MSG_DONTWAIT, return FWOULDBLOCK instead of sleeping
+};
+
+// One datagram of sendmmsg() and recvmmsg()
+struct DatagramMessage
+{
+    unsigned int Address;
+    unsigned short Port;
+    void* Buffer;
+    int Size;   // Bytes to send, or room in Buffer
+    int Length; // Bytes sent or received
+};
+
 int socket(int Domain, int Type, int Protocol);
 int bind(int SocketFD, unsigned int Address, int Port);
 int listen(int SocketFD, int Backlog);
@@ -22,5 +62,30 @@ int socksend(int SocketFD, const void* Source, int Size);
 int sockrecv(int SocketFD, void* Destination, int Size);
 int socksendto(int SocketFD, unsigned int Address, int Port, const void* Source, int Size);
 int sockrecvfrom(int SocketFD, unsigned int* DestiAddress, unsigned short* DestiPort, void* Destination, int Size);
+int setsockopt(int SocketFD, int Option, int Value);
+// Value of SocketReceiveBuffer, SocketReceiveDrops or SocketMemory, negative
+// on failure.
+int getsockopt(int SocketFD, int Option);
+int connect(int SocketFD, unsigned int Address, int Port);
+int send(int SocketFD, const void* Source, int Size, int Flags);
+int recv(int SocketFD, void* Destination, int Size, int Flags);
+// Datagram sockets only, up to 64 messages a call. Return the number of
+// messages sent or received.
+int sendmmsg(int SocketFD, struct DatagramMessage* Messages, int Count);
+int recvmmsg(int SocketFD, struct DatagramMessage* Messages, int Count, int Flags);
+// Stream sockets only, like send() and recv() over up to IOV_MAX buffers,
+// see unix/sys/uio.h.
+int sendmsg(int SocketFD, const struct iovec* Vectors, int Count, int Flags);
+int recvmsg(int SocketFD, const struct iovec* Vectors, int Count, int Flags);
+// Count bytes of file InFD to stream socket SocketFD without a copy through
+// user space. Starts at *Offset and advances it, or at the file offset if
+// Offset is null.
+int sendfile(int SocketFD, int InFD, int* Offset, int Count);
+// Localhost domain sockets, named by a socket node at Path instead of an
+// address and port. bindlocal() creates the node, which must not exist.
+// A Datagram socket sends with send() once connectlocal() named the
+// receiver, sendto() and recvfrom() do not apply.
+int bindlocal(int SocketFD, const char* Path);
+int connectlocal(int SocketFD, const char* Path);
 
 #endif // SOCKET_H
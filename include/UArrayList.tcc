@@ -91,9 +91,11 @@ public:
     {
         if (CurrentSize > NewSize)
         {
+            // Rebuilt in place, elements need not be assignable.
             for (size_type i = NewSize; i < CurrentSize; ++i)
             {
-                Elems[i] = value_type();
+                Elems[i].~value_type();
+                new (&Elems[i]) value_type();
             }
         }
         CurrentSize = NewSize;
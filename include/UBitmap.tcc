@@ -0,0 +1,57 @@
+// Fixed-size bitmap
+
+#ifndef UBITMAP_TCC
+#define UBITMAP_TCC
+
+#include "UDef.hh"
+
+// Free/used map over a fixed range, searched a 64-bit word at a time.
+template<size_t Bits>
+class Bitmap
+{
+    static const size_t WordBits = 64;
+    static const size_t Words = (Bits + WordBits - 1) / WordBits;
+
+    QWORD Map[Words] = {};
+
+public:
+    using size_type = DWORD;
+
+    [[__nodiscard__]] static constexpr size_type size() {return Bits;}
+
+    BOOL Test(size_type Bit)const
+    {
+        return Bit < Bits && (Map[Bit / WordBits] >> (Bit % WordBits)) & 1;
+    }
+
+    void Set(size_type Bit)
+    {
+        if (Bit < Bits) {Map[Bit / WordBits] |= QWORD(1) << (Bit % WordBits);}
+    }
+
+    void Reset(size_type Bit)
+    {
+        if (Bit < Bits) {Map[Bit / WordBits] &= ~(QWORD(1) << (Bit % WordBits));}
+    }
+
+    // First clear bit at or after From, size() if there is none.
+    size_type FindClear(size_type From = 0)const
+    {
+        if (From >= Bits) {return Bits;}
+        size_type Index = From / WordBits;
+        // Bits below From count as set.
+        QWORD Free = ~Map[Index] & (~QWORD(0) << (From % WordBits));
+        while (1)
+        {
+            if (Free)
+            {
+                size_type Bit = Index * WordBits + __builtin_ctzll(Free);
+                return Bit < Bits ? Bit : Bits;
+            }
+            if (++Index >= Words) {return Bits;}
+            Free = ~Map[Index];
+        }
+    }
+};
+
+#endif // UBITMAP_TCC
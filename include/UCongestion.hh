@@ -0,0 +1,80 @@
+#pragma once
+
+#ifndef UCONGESTION_H
+#define UCONGESTION_H
+
+#include "UDef.hh"
+
+#ifdef __cplusplus
+
+// Per-connection state shared by TCB and the algorithm. TCB owns slow start,
+// fast retransmit and fast recovery (RFC 5681, RFC 6582); the algorithm
+// only decides how cwnd grows in congestion avoidance and how far it is cut
+// back after a loss.
+struct CongestionState
+{
+    DWORD Window;             // cwnd (bytes)
+    DWORD SlowStartThreshold; // ssthresh (bytes)
+    DWORD MaxSegmentSize;     // SMSS
+    DWORD FlightSize;         // Bytes outstanding when the callback runs
+    DWORD SmoothedRTT;        // Milliseconds, 0 if no sample yet
+    DWORD BytesAcked;         // Appropriate byte counting (RFC 3465)
+
+    struct CubicVariables     // RFC 9438
+    {
+        DWORD EpochStart;     // Milliseconds, 0 if no epoch is running
+        DWORD WindowMax;      // W_max (bytes)
+        DWORD RenoWindow;     // W_est (bytes)
+        DWORD Origin;         // Milliseconds, K
+        QWORD Remainder;      // Fractional growth carried to the next ACK
+    }Cubic;
+};
+
+class CongestionControl
+{
+public:
+    virtual LPCSTR Name()const = 0;
+    virtual void Init(CongestionState& State);
+    // New data acknowledged while cwnd >= ssthresh.
+    virtual void CongestionAvoidance(CongestionState& State, DWORD Acked) = 0;
+    // ssthresh to use after a loss (duplicate ACKs or RTO).
+    virtual DWORD SlowStartThreshold(CongestionState& State) = 0;
+
+    // Type is a CongestionControlType, nullptr if unknown.
+    static CongestionControl* Find(int Type);
+};
+
+class NewRenoCongestionControl final : public CongestionControl
+{
+public:
+    static NewRenoCongestionControl Instance;
+
+    LPCSTR Name()const override {return "newreno";}
+    void CongestionAvoidance(CongestionState& State, DWORD Acked)override;
+    DWORD SlowStartThreshold(CongestionState& State)override;
+};
+
+class CubicCongestionControl final : public CongestionControl
+{
+public:
+    static CubicCongestionControl Instance;
+
+    // C = 0.4, beta = 0.7, alpha = 3 * (1 - beta) / (1 + beta)
+    static const auto ScaleC     = 400;
+    static const auto ScaleBeta  = 700;
+    static const auto ScaleAlpha = 529;
+    static const auto Scale      = 1000;
+
+    LPCSTR Name()const override {return "cubic";}
+    void CongestionAvoidance(CongestionState& State, DWORD Acked)override;
+    DWORD SlowStartThreshold(CongestionState& State)override;
+
+private:
+    static QWORD CubeRoot(QWORD Value);
+    static DWORD Now();
+    static long long WindowAt(const CongestionState& State, long long Time);
+};
+
+#endif
+
+#endif // UCONGESTION_H
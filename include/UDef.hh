@@ -69,6 +69,9 @@ typedef const char*         LPCSTR;
 using size_t = decltype(sizeof(0));
 using ptrdiff_t = decltype(static_cast<int*>(nullptr) - static_cast<int*>(nullptr));
 
+// Placement new, there is no <new>.
+inline void* operator new(size_t, void* Where) noexcept {return Where;}
+
 #define _ADD_KERN_PRINT_FUNC void cprintf(char*, ...);
 #define _ADD_KALLOC          char* kalloc(void);
 #define _ADD_KFREE           void kfree(char*);
@@ -114,11 +117,13 @@ _ADD_RELEASE
 extern struct spinlock tickslock;
 extern uint ticks;
 
+static const QWORD _TICKS_PER_SECOND = 100;
+
 inline time_t time(time_t* Time)
 {
     time_t Temp;
     acquire(&tickslock);
-    Temp = ticks / 100;
+    Temp = ticks / _TICKS_PER_SECOND;
     release(&tickslock);
     if (Time) {*Time = Temp;}
     return Temp;
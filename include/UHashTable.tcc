@@ -0,0 +1,170 @@
+// Intrusive hash table
+
+#ifndef UHASHTABLE_TCC
+#define UHASHTABLE_TCC
+
+#include "UDef.hh"
+
+// struct spinlock must already be defined, spinlock.h has no include guard.
+_EXTERN_C
+_ADD_INITLOCK
+_ADD_ACQUIRE
+_ADD_RELEASE
+_END_EXTERN_C
+
+// Bob Jenkins' final mix (lookup3), enough to spread address/port tuples.
+inline DWORD HashMix(DWORD A, DWORD B, DWORD C)
+{
+    auto Rotate = [](DWORD X, int K) {return (X << K) | (X >> (32 - K));};
+    C ^= B; C -= Rotate(B, 14);
+    A ^= C; A -= Rotate(C, 11);
+    B ^= A; B -= Rotate(A, 25);
+    C ^= B; C -= Rotate(B, 16);
+    A ^= C; A -= Rotate(C, 4);
+    B ^= A; B -= Rotate(A, 14);
+    C ^= B; C -= Rotate(B, 24);
+    return C;
+}
+
+// Chained hash table over items owned by somebody else. Each item carries
+// its own link (Tp::HashNext), so nothing is allocated here, and every
+// bucket has its own lock. The table only protects its chains: Find()
+// leaves keeping the item alive to the caller, FindHeld() and
+// InsertUnique() take a reference (Tp::Hold()) before the bucket unlocks.
+template<typename Tp, size_t BucketCount>
+class HashTable
+{
+    static_assert(BucketCount && !(BucketCount & (BucketCount - 1)),
+        "Bucket count must be a power of 2");
+
+    struct Bucket
+    {
+        spinlock Lock;
+        Tp* First;
+    };
+
+    Bucket Buckets[BucketCount];
+
+    Bucket& At(DWORD Hash) {return Buckets[Hash & (BucketCount - 1)];}
+
+public:
+    void Init(LPSTR Name)
+    {
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            initlock(&Buckets[i].Lock, Name);
+            Buckets[i].First = nullptr;
+        }
+    }
+
+    void Insert(DWORD Hash, Tp* Item)
+    {
+        Bucket& Chain = At(Hash);
+        acquire(&Chain.Lock);
+        Item->HashNext = Chain.First;
+        Chain.First = Item;
+        release(&Chain.Lock);
+    }
+
+    // Hash must be the one Item was inserted with.
+    BOOL Erase(DWORD Hash, Tp* Item)
+    {
+        Bucket& Chain = At(Hash);
+        acquire(&Chain.Lock);
+        for (Tp** Link = &Chain.First; *Link; Link = &(*Link)->HashNext)
+        {
+            if (*Link == Item)
+            {
+                *Link = Item->HashNext;
+                Item->HashNext = nullptr;
+                release(&Chain.Lock);
+                return 1;
+            }
+        }
+        release(&Chain.Lock);
+        return 0;
+    }
+
+    // First item in Hash's chain that satisfies Match, nullptr if none.
+    template<typename Predicate>
+    Tp* Find(DWORD Hash, Predicate Match)
+    {
+        Bucket& Chain = At(Hash);
+        acquire(&Chain.Lock);
+        Tp* Item = Chain.First;
+        while (Item && !Match(*Item)) {Item = Item->HashNext;}
+        release(&Chain.Lock);
+        return Item;
+    }
+
+    template<typename Predicate>
+    Tp* FindHeld(DWORD Hash, Predicate Match)
+    {
+        Bucket& Chain = At(Hash);
+        acquire(&Chain.Lock);
+        Tp* Item = Chain.First;
+        while (Item && !Match(*Item)) {Item = Item->HashNext;}
+        if (Item) {Item->Hold();}
+        release(&Chain.Lock);
+        return Item;
+    }
+
+    // One of the items satisfying Match, chosen by Key: every match is
+    // scored by HashMix() of Key and its address and the highest one wins.
+    // The same key gets the same item as long as that item still matches,
+    // and a single walk of the chain is enough. nullptr if none matches.
+    template<typename Predicate>
+    Tp* Select(DWORD Hash, Predicate Match, DWORD Key) {return Pick<0>(Hash, Match, Key);}
+
+    template<typename Predicate>
+    Tp* SelectHeld(DWORD Hash, Predicate Match, DWORD Key) {return Pick<1>(Hash, Match, Key);}
+
+private:
+    template<BOOL Held, typename Predicate>
+    Tp* Pick(DWORD Hash, Predicate Match, DWORD Key)
+    {
+        Bucket& Chain = At(Hash);
+        acquire(&Chain.Lock);
+        Tp* Best = nullptr;
+        DWORD BestScore = 0;
+        for (Tp* Item = Chain.First; Item; Item = Item->HashNext)
+        {
+            if (!Match(*Item)) {continue;}
+            uintp Address = uintp(Item);
+            DWORD Score = HashMix(Key, DWORD(Address), DWORD(Address >> 32));
+            if (!Best || Score > BestScore)
+            {
+                Best = Item;
+                BestScore = Score;
+            }
+        }
+        if constexpr (Held) {if (Best) {Best->Hold();}}
+        release(&Chain.Lock);
+        return Best;
+    }
+
+public:
+    // Insert Item unless an item satisfying Match is already there, that one
+    // is returned held instead. nullptr means Item went in.
+    template<typename Predicate>
+    Tp* InsertUnique(DWORD Hash, Tp* Item, Predicate Match)
+    {
+        Bucket& Chain = At(Hash);
+        acquire(&Chain.Lock);
+        for (Tp* Existing = Chain.First; Existing; Existing = Existing->HashNext)
+        {
+            if (Match(*Existing))
+            {
+                Existing->Hold();
+                release(&Chain.Lock);
+                return Existing;
+            }
+        }
+        Item->HashNext = Chain.First;
+        Chain.First = Item;
+        release(&Chain.Lock);
+        return nullptr;
+    }
+};
+
+#endif // UHASHTABLE_TCC
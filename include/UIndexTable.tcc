@@ -0,0 +1,105 @@
+// Growable index table
+
+#ifndef UINDEXTABLE_TCC
+#define UINDEXTABLE_TCC
+
+#include "UDef.hh"
+
+_EXTERN_C
+#include "kernel/string.h"
+_ADD_KALLOC
+_ADD_KFREE
+_END_EXTERN_C
+
+// Maps small integer handles (socket descriptors) to objects owned
+// elsewhere. Slots live in pages of pointers hung off a one-page directory,
+// and a page is only allocated once a handle in it is needed. Insert()
+// hands out the lowest free handle, like file descriptors.
+template<typename Tp, size_t PageSize = 4096>
+class IndexTable
+{
+public:
+    using size_type = DWORD;
+
+    static const size_type SlotsPerPage = PageSize / sizeof(Tp*);
+    static const size_type MaxPages     = PageSize / sizeof(Tp**);
+    static const size_type MaxSlots     = SlotsPerPage * MaxPages;
+
+private:
+    Tp*** Pages = nullptr;
+    size_type PageCount = 0; // Directory entries in use, pages may be null
+    size_type Count = 0;
+    size_type FreeHint = 0;  // No free slot below this
+    size_type Limit = MaxSlots;
+
+public:
+    BOOL Init(size_type NewLimit)
+    {
+        if (!Pages)
+        {
+            Pages = (Tp***)kalloc();
+            if (!Pages) {return 0;}
+            memset(Pages, 0, PageSize);
+        }
+        SetLimit(NewLimit);
+        return 1;
+    }
+
+    [[__nodiscard__]] size_type size()const {return Count;}
+    // Every valid handle is below bound().
+    [[__nodiscard__]] size_type bound()const {return PageCount * SlotsPerPage;}
+    [[__nodiscard__]] size_type limit()const {return Limit;}
+
+    // Existing entries above a lowered limit stay valid.
+    void SetLimit(size_type NewLimit)
+    {
+        Limit = NewLimit < MaxSlots ? NewLimit : MaxSlots;
+    }
+
+    Tp* operator[](int Index)const
+    {
+        if (Index < 0 || size_type(Index) >= bound()) {return nullptr;}
+        Tp** Page = Pages[Index / SlotsPerPage];
+        return Page ? Page[Index % SlotsPerPage] : nullptr;
+    }
+
+    // Handle of Item, -1 if the limit is reached or memory ran out.
+    int Insert(Tp* Item)
+    {
+        if (!Pages || Count >= Limit) {return -1;}
+        for (size_type Index = FreeHint; Index < MaxSlots; ++Index)
+        {
+            size_type PageIndex = Index / SlotsPerPage;
+            if (PageIndex >= PageCount) {PageCount = PageIndex + 1;}
+            if (!Pages[PageIndex])
+            {
+                Pages[PageIndex] = (Tp**)kalloc();
+                if (!Pages[PageIndex]) {return -1;}
+                memset(Pages[PageIndex], 0, PageSize);
+            }
+            Tp*& Slot = Pages[PageIndex][Index % SlotsPerPage];
+            if (!Slot)
+            {
+                Slot = Item;
+                ++Count;
+                FreeHint = Index + 1;
+                return Index;
+            }
+        }
+        return -1;
+    }
+
+    Tp* Erase(int Index)
+    {
+        if (Index < 0 || size_type(Index) >= bound()) {return nullptr;}
+        Tp** Page = Pages[Index / SlotsPerPage];
+        if (!Page || !Page[Index % SlotsPerPage]) {return nullptr;}
+        Tp* Item = Page[Index % SlotsPerPage];
+        Page[Index % SlotsPerPage] = nullptr;
+        --Count;
+        if (size_type(Index) < FreeHint) {FreeHint = Index;}
+        return Item;
+    }
+};
+
+#endif // UINDEXTABLE_TCC
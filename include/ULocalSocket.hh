@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef ULOCALSOCKET_H
+#define ULOCALSOCKET_H
+
+#include "UDef.hh"
+#include "UHashTable.tcc"
+#include "UObjectPool.tcc"
+#include "UIndexTable.tcc"
+
+#ifdef __cplusplus
+
+// struct spinlock and struct pollqueue must already be defined, see
+// UHashTable.tcc.
+
+struct inode;
+struct iovec;
+
+// Up to a page of data on its way to a reader. The writer copies into it
+// and links it onto the receiving socket's queue, the reader copies out of
+// it and frees it: no headers, no checksums, no copy in between.
+struct LocalBuffer
+{
+    static const int Capacity = 4096 - sizeof(LocalBuffer*) - 2 * sizeof(int);
+
+    LocalBuffer* Next;
+    int Size;   // Bytes in Data
+    int Offset; // Bytes a stream reader took already
+    BYTE Data[Capacity];
+};
+
+// Localhost domain socket, named by a socket node in the file system
+// (T_DEV, major LOCALSOCK) instead of an address and port. A stream
+// socket connects to the one listening on a node and gets a socket of
+// its own on the other side, queued for Accept(). A datagram socket
+// receives on the node it is bound to and sends to the one it connected
+// to. Everything is guarded by the one LocalLock, which is also taken to
+// sleep: readers sleep on their socket, writers on the Charged of the
+// socket they write to.
+class LocalSocket
+{
+public:
+    template<typename Tp, size_t BucketCount>
+    friend class HashTable;
+
+    static const auto BufferCharge          = 4096;      // Per LocalBuffer queued
+    static const auto DefReceiveBufferSize  = 64 * 4096;
+    static const auto MinReceiveBufferSize  = 4096;
+    static const auto MaxReceiveBufferSize  = 512 * 4096;
+    static const auto MaxBacklog            = 128;
+    static const auto MaxDatagramSize       = LocalBuffer::Capacity;
+    static const auto DefLocalLimit         = 1024;
+    static const auto NodeBuckets           = 64;
+
+    enum StateType
+    {
+        Idle,       // Open, maybe bound
+        Listening,  // Stream, connections wait in Pending
+        Connected,  // Stream, Peer is the other end while it is open
+    };
+
+private:
+    static spinlock LocalLock;
+    static IndexTable<LocalSocket> LocalTable;
+    static ObjectPool<LocalSocket> LocalPool;
+    static HashTable<LocalSocket, NodeBuckets> NodeTable;
+
+    int Index = -1; // Socket descriptor, slot in LocalTable
+    int Type = 0;   // ConnectionType
+    StateType State = Idle;
+
+    inode* Node = nullptr;     // Bound to, holds a reference
+    inode* PeerNode = nullptr; // Datagram, sends go to the socket bound here
+    LocalSocket* Peer = nullptr;
+
+    // Receive queue. Charged counts BufferCharge per buffer, a writer
+    // waits while it is at ReceiveLimit().
+    LocalBuffer* First = nullptr;
+    LocalBuffer* Last = nullptr;
+    DWORD Charged = 0;
+    DWORD ReceiveBufferSize = DefReceiveBufferSize;
+
+    // Listener: accepted ends of new connections, oldest first.
+    LocalSocket* PendingFirst = nullptr;
+    LocalSocket* PendingLast = nullptr;
+    LocalSocket* PendingNext = nullptr;
+    int PendingCount = 0;
+    int Backlog = 0;
+
+    LocalSocket* HashNext = nullptr;
+    BOOL Hashed = 0;
+
+    pollqueue PollQueue; // poll() and epoll waiters
+
+    static LocalSocket* Allocate(int Type);
+    void Release();
+
+    static DWORD NodeHash(const inode* Node);
+    void Hash(inode* NewNode);
+    void Unhash();
+    static LocalSocket* Lookup(const inode* Node, int Type);
+
+    DWORD ReceiveLimit()const;
+    BOOL HasRoom(int Size)const;
+    void Notify();
+    void Disconnect();
+
+    int TransmitStream(const iovec* Vectors, int Count, int Total, BOOL NonBlocking);
+    int TransmitDatagram(const iovec* Vectors, int Count, int Total, BOOL NonBlocking);
+
+public:
+    LocalSocket();
+    ~LocalSocket() {}
+
+    static void Register();
+
+    // Return a socket descriptor or a negative value, like the calls of
+    // TCB and UDPController. Bind() and Connect() take over the reference
+    // to Node.
+    static int Open(int Type);
+    static int Close(int Index);
+    static BOOL IsBound(int Index);
+    static int Bind(int Index, inode* Node);
+    static int Listen(int Index, int Backlog);
+    static int Connect(int Index, inode* Node, BOOL NonBlocking);
+    static int Accept(int Index, BOOL NonBlocking);
+    static int TransmitVector(int Index, const iovec* Vectors, int Count, BOOL NonBlocking);
+    static int ReceiveVector(int Index, const iovec* Vectors, int Count, BOOL NonBlocking);
+    static int Transmit(int Index, LPCVOID Source, int Size, BOOL NonBlocking);
+    static int Receive(int Index, LPVOID Destination, int Size, BOOL NonBlocking);
+    static int Poll(int Index);
+    static pollqueue* GetPollQueue(int Index);
+    static int SetReceiveBufferSize(int Index, int Size);
+    static int GetReceiveBufferSize(int Index);
+    static int GetMemory(int Index);
+};
+
+#endif // __cplusplus
+
+#endif // ULOCALSOCKET_H
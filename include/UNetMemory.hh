@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef UNETMEMORY_H
+#define UNETMEMORY_H
+
+#include "UDef.hh"
+
+#ifdef __cplusplus
+
+// Kernel memory held by the network stack, charged in bytes to whoever
+// holds it. Everything the stack allocates is a kalloc() page, so charges
+// come in pages. Over the soft limit new socket buffers start small and
+// receive queues take less before they drop; over the hard limit charges
+// fail and whatever needed the memory is refused or dropped, instead of
+// running kalloc() dry. The counters are atomic, no lock is taken.
+class NetMemory
+{
+public:
+    static const auto PageCharge    = 4096;
+    static const auto DefSoftLimit  = 32 * 1024 * 1024; // See NetTunable()
+    static const auto DefHardLimit  = 64 * 1024 * 1024; // See NetTunable()
+
+    enum OwnerType
+    {
+        OwnerTCP,    // TCB buffers and templates, segments waiting to go out
+        OwnerUDP,    // Controller templates and queues, queued datagrams
+        OwnerLocal,  // Localhost domain socket buffers
+        OwnerFrames, // Adapter receive buffers, frames waiting for ARP, ICMP replies
+        OwnerCount
+    };
+
+    enum PressureType
+    {
+        PressureNone, // Below the soft limit
+        PressureSoft, // New buffers get their minimum size, queues drop early
+        PressureHard  // Charges fail
+    };
+
+private:
+    static QWORD Charged[OwnerCount];
+    static QWORD Total;
+    static QWORD SoftLimit;
+    static QWORD HardLimit;
+    static QWORD Failures; // Charges refused at the hard limit
+
+public:
+    // Charge Bytes to Owner, 0 and a counted failure if that would take the
+    // total over the hard limit.
+    static BOOL Charge(int Owner, QWORD Bytes);
+    // For memory already allocated that has to be kept, never fails.
+    static void ForceCharge(int Owner, QWORD Bytes);
+    static void Uncharge(int Owner, QWORD Bytes);
+
+    static int Pressure();
+    static BOOL UnderPressure() {return Pressure() != PressureNone;}
+
+    static QWORD Usage(int Owner);
+    static QWORD GetTotal();
+    static QWORD GetFailures();
+    static void SetFailures(QWORD Value);
+    static QWORD GetSoftLimit();
+    static QWORD GetHardLimit();
+    static void SetSoftLimit(QWORD Limit);
+    static void SetHardLimit(QWORD Limit);
+};
+
+#endif // __cplusplus
+
+#endif // UNETMEMORY_H
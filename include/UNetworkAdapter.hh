@@ -18,6 +18,7 @@ _EXTERN_C
 #define Intel8254xInterruptCode 11
 
 void Intel8254xInterrupt();
+void LoopbackInterrupt();
 
 int NetworkAdapterSetup(struct pci_func* PCIFunction);
 
@@ -28,6 +29,7 @@ _END_EXTERN_C
 #ifdef __cplusplus
 
 class EthernetFrame;
+struct spinlock;
 
 __interface NetworkAdapter
 {
@@ -41,6 +43,9 @@ __interface NetworkAdapter
     virtual BOOL HasInterrupt() = 0;
     virtual void ClearInterrupt() = 0;
     virtual int Transmit(EthernetFrame& Frame) = 0;
+    // Frames ready to go, see IPv4::PrepareTransmit(). Returns once all
+    // of them are sent.
+    virtual int TransmitBatch(EthernetFrame** Frames, int Count) = 0;
     virtual int Receive(EthernetFrame* FrameBuffer) = 0;
 };
 
@@ -275,6 +280,7 @@ public:
     BOOL HasInterrupt()override;
     void ClearInterrupt()override;
     int Transmit(EthernetFrame& Frame)override;
+    int TransmitBatch(EthernetFrame** Frames, int Count)override;
     int Receive(EthernetFrame* FrameBuffer)override;
 
     // NetworkAdapterBase abstract class
@@ -306,6 +312,58 @@ public:
     static NetworkAdapter* Start(PCIFuncCPointer PCIFunction);
 };
 
+// Software adapter for 127.0.0.0/8. Transmit() queues a copy of the frame
+// and LoopbackInterrupt() hands it back to FrameBufferHandler() on the way
+// out of a system call or on the next tick, where the sender's locks are
+// no longer held. There is nothing to resolve and nothing to corrupt, so
+// ARP is skipped and IP, TCP and UDP checksums are neither computed nor
+// verified for frames on it, see IsLoopback().
+class LoopbackNetworkAdapter final : public NetworkAdapter
+{
+public:
+    static const DWORD Vendor = 0x0000;
+    static const DWORD Device = 0x0000;
+
+    static const int QueueSize = 64;     // Frames waiting for delivery
+    static const int DeliveryBatch = 16; // Frames per Receive()
+
+    static LoopbackNetworkAdapter* Instance;
+
+private:
+    static spinlock Lock; // Guards the queue and Delivering
+
+    BYTE MACAddress[6] = {0};
+    EthernetFrame* Queue[QueueSize];
+    int Head = 0;
+    int Count = 0;
+    BOOL Delivering = 0; // One CPU at a time, so frames stay in order
+
+public:
+    // NetworkAdapter interface
+    DWORD VendorID()const override {return Vendor;}
+    DWORD DeviceID()const override {return Device;}
+    const BYTE* GetMACAddress()const override {return MACAddress;}
+    int Open()override {return 0;}
+    int Close()override {return 0;}
+    BOOL HasInterrupt()override {return Count != 0;}
+    void ClearInterrupt()override {}
+    int Transmit(EthernetFrame& Frame)override;
+    int TransmitBatch(EthernetFrame** Frames, int Count)override;
+    int Receive(EthernetFrame* FrameBuffer)override;
+
+    // Delivery runs Receive() until it returns 0, which ends it, or stops
+    // early with EndDelivery(). Returns 0 if another CPU is delivering.
+    BOOL BeginDelivery();
+    void EndDelivery();
+
+    // Static member functions
+    static BOOL IsLoopback(const NetworkAdapter* Adapter)
+    {
+        return Adapter && Adapter == Instance;
+    }
+    static NetworkAdapter* Start();
+};
+
 /*class RealtekRTL8139NetworkAdapter final : public NetworkAdapter
 {
     SINGLE_INSTANCE(RealtekRTL8139NetworkAdapter)
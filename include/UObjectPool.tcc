@@ -0,0 +1,157 @@
+// Fixed-size object pool
+
+#ifndef UOBJECTPOOL_TCC
+#define UOBJECTPOOL_TCC
+
+#include "UDef.hh"
+
+// struct spinlock must already be defined, spinlock.h has no include guard.
+_EXTERN_C
+_ADD_KALLOC
+_ADD_KFREE
+_ADD_INITLOCK
+_ADD_ACQUIRE
+_ADD_RELEASE
+_END_EXTERN_C
+
+// Slab allocator for one object type. operator new hands every object a
+// whole page, so small blocks are carved out of shared pages instead. Each
+// page starts with a header and is returned to kalloc() once its last
+// object is freed, so memory follows the number of live objects.
+template<typename Tp, size_t PageSize = 4096>
+class ObjectPool
+{
+    struct FreeSlot
+    {
+        FreeSlot* Next;
+    };
+
+    struct PageHeader
+    {
+        PageHeader* Prev;  // Links pages that still have free slots
+        PageHeader* Next;
+        FreeSlot* Free;
+        DWORD Used;
+    };
+
+    static constexpr size_t AlignUp(size_t Size, size_t Align)
+    {
+        return (Size + Align - 1) / Align * Align;
+    }
+
+    static const size_t Alignment = alignof(Tp) > alignof(FreeSlot) ?
+        alignof(Tp) : alignof(FreeSlot);
+    static const size_t ObjectSize = AlignUp(
+        sizeof(Tp) > sizeof(FreeSlot) ? sizeof(Tp) : sizeof(FreeSlot), Alignment);
+    static const size_t FirstObject = AlignUp(sizeof(PageHeader), Alignment);
+
+public:
+    using size_type = DWORD;
+
+    static const size_type ObjectsPerPage = (PageSize - FirstObject) / ObjectSize;
+    static_assert(ObjectsPerPage > 0, "Object does not fit in a page");
+
+private:
+    spinlock Lock;
+    PageHeader* Partial = nullptr;
+    size_type Pages = 0;
+    size_type Objects = 0;
+
+    static PageHeader* PageOf(const void* Item)
+    {
+        return (PageHeader*)(QWORD(Item) & ~QWORD(PageSize - 1));
+    }
+
+    void Link(PageHeader* Page)
+    {
+        Page->Prev = nullptr;
+        Page->Next = Partial;
+        if (Partial) {Partial->Prev = Page;}
+        Partial = Page;
+    }
+
+    void Unlink(PageHeader* Page)
+    {
+        if (Page->Prev) {Page->Prev->Next = Page->Next;}
+        else {Partial = Page->Next;}
+        if (Page->Next) {Page->Next->Prev = Page->Prev;}
+        Page->Prev = Page->Next = nullptr;
+    }
+
+    PageHeader* Grow()
+    {
+        PageHeader* Page = (PageHeader*)kalloc();
+        if (!Page) {return nullptr;}
+        Page->Free = nullptr;
+        Page->Used = 0;
+        for (size_type i = ObjectsPerPage; i > 0; --i)
+        {
+            FreeSlot* Slot = (FreeSlot*)((BYTE*)Page + FirstObject + (i - 1) * ObjectSize);
+            Slot->Next = Page->Free;
+            Page->Free = Slot;
+        }
+        Link(Page);
+        ++Pages;
+        return Page;
+    }
+
+    LPVOID Allocate()
+    {
+        acquire(&Lock);
+        PageHeader* Page = Partial ? Partial : Grow();
+        if (!Page)
+        {
+            release(&Lock);
+            return nullptr;
+        }
+        FreeSlot* Slot = Page->Free;
+        Page->Free = Slot->Next;
+        ++Page->Used;
+        if (!Page->Free) {Unlink(Page);}
+        ++Objects;
+        release(&Lock);
+        return Slot;
+    }
+
+    void Deallocate(LPVOID Item)
+    {
+        acquire(&Lock);
+        PageHeader* Page = PageOf(Item);
+        if (!Page->Free) {Link(Page);}
+        FreeSlot* Slot = (FreeSlot*)Item;
+        Slot->Next = Page->Free;
+        Page->Free = Slot;
+        --Page->Used;
+        --Objects;
+        if (!Page->Used)
+        {
+            Unlink(Page);
+            kfree((char*)Page);
+            --Pages;
+        }
+        release(&Lock);
+    }
+
+public:
+    void Init(LPSTR Name) {initlock(&Lock, Name);}
+
+    [[__nodiscard__]] size_type size()const {return Objects;}
+    [[__nodiscard__]] size_type pages()const {return Pages;}
+
+    // Default-constructed object, nullptr if out of memory.
+    Tp* New()
+    {
+        LPVOID Storage = Allocate();
+        if (!Storage) {return nullptr;}
+        return new (Storage) Tp();
+    }
+
+    void Delete(Tp* Item)
+    {
+        if (!Item) {return;}
+        Item->~Tp();
+        Deallocate(Item);
+    }
+};
+
+#endif // UOBJECTPOOL_TCC
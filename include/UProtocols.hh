@@ -10,6 +10,7 @@
 
 _EXTERN_C
 #include "spinlock.h"
+#include "timerwheel.h"
 _END_EXTERN_C
 
 // ---------- Layer-2 protocols ---------- //
@@ -35,6 +36,11 @@ public:
     static const auto TargetHardwareAddr = HeaderSize + 10; // 10 - 15
     static const auto TargetProtocolAddr = HeaderSize + 16; // 16 - 19
 
+    // IPv4 frames waiting for their next hop to resolve, see Defer()
+    static const auto ResolveQueueSize   = 16;
+    static const auto ResolveInterval    = _TICKS_PER_SECOND; // Between requests
+    static const auto ResolveRetries     = 3;
+
     static time_t ARPTimestamp;
     static spinlock ARPLock;
 
@@ -68,6 +74,19 @@ public:
 
     static ArrayList<ARPTableItem, ARPTableSize> ARPTable;
 
+    struct PendingFrame
+    {
+        class IPv4* Frame;
+        NetworkAdapter* Device;
+        DWORD Address;  // Next hop
+        WORD ResizeTo;
+        DWORD Requests; // Sent for Address so far
+        enum : BYTE {Waiting, Ask, Send, Drop} Action; // See OnResolveTimer()
+    };
+    static PendingFrame ResolveQueue[ResolveQueueSize];
+    static int ResolveQueueCount;
+    static struct timer ResolveTimer;
+
     enum Operations {Request = 1, Reply = 2};
 
     ARP() : Mybase() {SetEtherType(EtherType);}
@@ -109,7 +128,7 @@ public:
     // arping tester
     struct Tester
     {
-        static const auto MaxDelay = 30000000;
+        static const auto WaitTime = _TICKS_PER_SECOND; // For replies to a request
 
         static BOOL ARPingIsTesting;
         static BOOL ARPingIsReceived;
@@ -119,6 +138,7 @@ public:
             Passed = 0,
             IPNotFound = 1,
             Timeout = 2,
+            NoMemory = 3,
         };
 
         static int ARPing(DWORD TargetIPAddress);
@@ -127,8 +147,17 @@ public:
     // Main function
     void Print(const char* Title)const;
     static BYTE* RequestFrom(NetworkAdapter& Device, DWORD IP);
+    static void SendRequest(NetworkAdapter& Device, DWORD IP);
+    static BOOL Defer(NetworkAdapter& Device, const class IPv4& Frame, WORD ResizeTo);
     static void Register();
     static void Main(NetworkAdapter* Device, const EthernetFrame& Frame);
+
+    // Resolution queue, one entry at a time so nothing large is on the stack
+    static BOOL TakePending(DWORD IP, PendingFrame& Taken);
+    static BOOL TakeMarked(PendingFrame& Taken);
+    static void FreePending(class IPv4* Frame); // Deleted and uncharged
+    static void Resolved(DWORD IP);
+    static void OnResolveTimer(LPVOID);
 };
 
 // ---------- Layer-3 protocols ---------- //
@@ -146,6 +175,7 @@ public:
     static const auto CurrentNetwork                  = 0x00000000; // 0.0.0.0
     static const auto Localhost                       = 0x0000007F; // 127.0.0.0 (LE)
     static const auto LocalhostMask                   = 0x000000FF; // 255.0.0.0 (LE)
+    static const auto LocalhostAddress                = 0x0100007F; // 127.0.0.1 (LE)
     static const auto Broadcast                       = 0xFFFFFFFF; // 255.255.255.255
 
     static const auto HeaderSizeMin                   = 20;
@@ -319,7 +349,7 @@ private:
     WORD VerifyChecksum(BOOL ComputeOnly = 0) const;
 
 public:
-    BOOL IsValid()const;
+    BOOL IsValid(BOOL Trusted = 0)const; // Trusted skips the checksum
     int DataSize()const{return GetTotalLength() - GetInternetHeaderLength() * sizeof(DWORD);}
     void Resize(WORD NewSize);
 
@@ -363,6 +393,7 @@ public:
     static DWORD GetBroadcastAddress(DWORD Addr, DWORD Mask);
 
     // Main functions
+    int PrepareTransmit(NetworkAdapter& Device, WORD ResizeTo = 0);
     int ToDevice(NetworkAdapter& Device, WORD ResizeTo = 0);
     void Print(const char* Title)const;
     static void Register();
@@ -592,7 +623,8 @@ namespace ICMPControllers
         static WORD CurrentID;
         static WORD CurrentSN;
         static BOOL IsReceived;
-        static const auto MaxDelay = 300000000;
+        static spinlock Lock; // Guards IsReceived
+        static const auto Timeout = 2 * _TICKS_PER_SECOND;
 
         PingEcho() : Mybase() {SetCode(0);}
         PingEcho(const Mybase& Frame) : Mybase(Frame) {}
@@ -829,6 +861,25 @@ int INet_RTAddStatic();
 int INet_RTPrint();
 int INet_RTDelete();
 int INet_Ping();
+int INet_NetTunable();
+
+// Same as inet.h
+enum NetTunableName
+{
+    TunableTCPMaxConnections = 0,
+    TunableUDPMaxSockets     = 1,
+    TunableTCPMaxTimeWait    = 2,
+    TunableUDPReceiveBuffer  = 3,
+    TunableUDPReceiveDrops   = 4,
+    TunableMemorySoftLimit   = 5,
+    TunableMemoryHardLimit   = 6,
+    TunableMemoryTCP         = 7,
+    TunableMemoryUDP         = 8,
+    TunableMemoryLocal       = 9,
+    TunableMemoryFrames      = 10,
+    TunableMemoryFailures    = 11,
+    TunableMemoryPressure    = 12,
+};
 
 void RegisterProtocols();
 
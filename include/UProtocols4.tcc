@@ -4,6 +4,14 @@
 #include "UProtocols.hh"
 #include "URandom.tcc"
 #include "UQueue.tcc"
+#include "URingBuffer.tcc"
+#include "UCongestion.hh"
+#include "UNetMemory.hh"
+#include "UHashTable.tcc"
+#include "UObjectPool.tcc"
+#include "UIndexTable.tcc"
+#include "UBitmap.tcc"
+#include "USocket.hh"
 
 _EXTERN_C
 #include "kernel/string.h"
@@ -15,6 +23,9 @@ _ADD_ACQUIRE
 _ADD_RELEASE
 void wakeup(void*);
 void sleep(void*, struct spinlock*);
+#include "file.h"
+#include "eventpoll.h"
+#include "fcntl.h"
 _END_EXTERN_C
 
 template<typename Signature = IPv4> requires IPProtocols<Signature>
@@ -24,7 +35,10 @@ public:
     using Mybase = Signature;
 
     static const auto ProtocolNumber        = 6;
-    static const auto TCBTableSize          = 16;
+    static const auto DefTCBLimit           = 4096; // See NetTunable()
+    static const auto ConnectionBuckets     = 64;
+    static const auto ListenBuckets         = 16;
+    static const auto DefTimeWaitLimit      = 4096; // See NetTunable()
     static const auto SourcePortMin         = 49152;
     static const auto SourcePortMax         = 65535;
 
@@ -54,6 +68,17 @@ public:
         CWR = 0b10000000, // Congestion window reduced
     };
 
+    enum TCPOptionKinds : BYTE
+    {
+        OptEnd           = 0, // End of option list
+        OptNOP           = 1, // No-Operation
+        OptMSS           = 2, // Maximum segment size             (RFC 9293)
+        OptWindowScale   = 3, // Window scale                     (RFC 7323)
+        OptSACKPermitted = 4, // SACK permitted                   (RFC 2018)
+        OptSACK          = 5, // Selective acknowledgement        (RFC 2018)
+        OptTimestamps    = 8, // Timestamps                       (RFC 7323)
+    };
+
     static spinlock TCPLock;
 
     __TCPBase() : Mybase()
@@ -188,6 +213,7 @@ spinlock __TCPBase<Signature>::TCPLock;
 
 template<BYTE Version> class TCP;
 template<BYTE Version> class TCB;
+template<BYTE Version> class TimeWaitBlock;
 template<BYTE Version>
 using TCPController = TCB<Version>;
 template<BYTE Version>
@@ -201,11 +227,26 @@ public:
 
     template<BYTE Version>
     friend class TCB;
+    template<BYTE Version>
+    friend class TimeWaitBlock;
 
     TCP() : __TCPBase<IPv4>() {}
     TCP(const Mybase& Frame) : __TCPBase(Frame) {}
 
-    static ArrayList<class TCB<4>, TCBTableSize> TCBTable;
+    // Live blocks by socket descriptor
+    static IndexTable<class TCB<4>> TCBTable;
+    static ObjectPool<class TCB<4>> TCBPool;
+    // Demultiplexing, see TCB<4>::Lookup()
+    static HashTable<class TCB<4>, ConnectionBuckets> ConnectionTable;
+    static HashTable<class TCB<4>, ListenBuckets> ListenTable;
+    // Ports Connect() picked, bit i is SourcePortMin + i
+    static Bitmap<SourcePortMax - SourcePortMin + 1> SourcePorts;
+    static DWORD SourcePortHint;
+    // Connections in TIME-WAIT, see TimeWaitBlock<4>
+    static spinlock TimeWaitLock;
+    static HashTable<class TimeWaitBlock<4>, ConnectionBuckets> TimeWaitTable;
+    static ObjectPool<class TimeWaitBlock<4>> TimeWaitPool;
+    static DWORD TimeWaitLimit;
 
     // Getters and Setters
 protected:
@@ -272,7 +313,7 @@ public:
             Mybase::Resize(TCPLength);
         }
 
-        SetChecksum(VerifyChecksum(1));
+        if (!LoopbackNetworkAdapter::IsLoopback(&Device)) {SetChecksum(VerifyChecksum(1));}
         /*if (VerifyChecksum())
         {
             cprintf((LPSTR)"[TCP] WARNING: Verifying transmission checksum error (0x%x)\n",
@@ -294,6 +335,94 @@ class TCP<6> : public __TCPBase<IPv6>
     // TODO...
 };
 
+// Sorted, non-overlapping set of sequence ranges [Start, End), used for the
+// out-of-order queue and the SACK scoreboard.
+template<size_t MaxRanges>
+class SequenceRangeSet
+{
+public:
+    struct Range
+    {
+        DWORD Start;
+        DWORD End;
+    };
+
+private:
+    Range Ranges[MaxRanges];
+    size_t Count = 0;
+
+    static BOOL Less(DWORD A, DWORD B) {return int(A - B) < 0;}
+
+    void Erase(size_t First, size_t Last)
+    {
+        for (size_t i = Last; i < Count; ++i) {Ranges[First + i - Last] = Ranges[i];}
+        Count -= Last - First;
+    }
+
+public:
+    [[__nodiscard__]] size_t size()const {return Count;}
+    [[__nodiscard__]] BOOL empty()const {return !Count;}
+    const Range& operator[](size_t n)const {return Ranges[n];}
+    const Range& back()const {return Ranges[Count - 1];}
+    void clear() {Count = 0;}
+
+    // Merge [Start, End) into the set, returns 0 if there was no room.
+    BOOL Insert(DWORD Start, DWORD End)
+    {
+        if (!Less(Start, End)) {return 1;}
+        size_t First = 0;
+        while (First < Count && Less(Ranges[First].End, Start)) {++First;}
+        size_t Last = First;
+        while (Last < Count && !Less(End, Ranges[Last].Start))
+        {
+            if (Less(Ranges[Last].Start, Start)) {Start = Ranges[Last].Start;}
+            if (Less(End, Ranges[Last].End)) {End = Ranges[Last].End;}
+            ++Last;
+        }
+        if (First == Last)
+        {
+            if (Count == MaxRanges) {return 0;}
+            for (size_t i = Count; i > First; --i) {Ranges[i] = Ranges[i - 1];}
+            ++Count;
+        }
+        else {Erase(First + 1, Last);}
+        Ranges[First] = {Start, End};
+        return 1;
+    }
+
+    // Forget everything below Sequence.
+    void TrimBelow(DWORD Sequence)
+    {
+        size_t First = 0;
+        while (First < Count && !Less(Sequence, Ranges[First].End)) {++First;}
+        Erase(0, First);
+        if (Count && Less(Ranges[0].Start, Sequence)) {Ranges[0].Start = Sequence;}
+    }
+
+    // Range holding Sequence, nullptr if none.
+    const Range* Find(DWORD Sequence)const
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (!Less(Sequence, Ranges[i].Start) && Less(Sequence, Ranges[i].End))
+            {
+                return &Ranges[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // First range starting after Sequence, nullptr if none.
+    const Range* FindAfter(DWORD Sequence)const
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (Less(Sequence, Ranges[i].Start)) {return &Ranges[i];}
+        }
+        return nullptr;
+    }
+};
+
 /*
     TCP Connection State Diagram
     Reference: RFC 9293 3.3.2 fig.5
@@ -351,10 +480,59 @@ public:
     using FrameType = TCP<Version>;
     using IPType    = FrameType::Mybase;
 
-    static const auto DefWindowSize         = 2000;
+    static const auto DefMaxSegmentSize     = 536;  // RFC 9293 3.7.1, used if no MSS option
+    static const auto MaxSegmentSize        = 1460; // Advertised in SYN options
+    static const auto InitialWindowSegments = 10;   // RFC 6928
+    static const auto SendBufferSize        = 16 * 4096;
+    static const auto DefReceiveBufferSize  = 32 * 4096;
+    static const auto MinReceiveBufferSize  = 4096;
+    static const auto MaxReceiveBufferSize  = 128 * 4096;
+    static const auto QueueCharge           = 2 * NetMemory::PageCharge; // Copy and queue entry, see Queue()
+    static const auto MaxWindowScale        = 14;   // RFC 7323 2.3
+    static const auto MaxSackBlocks         = 4;    // RFC 2018 3, 40 option bytes
+    static const auto TimestampOptionSize   = 12;   // NOP NOP TS, RFC 7323 appendix A
+    static const auto MaxOutOfOrderRanges   = 8;
+    static const auto DuplicateAckThreshold = 3;    // RFC 5681 3.2
+
+    // Retransmission timer (RFC 6298), in ticks
+    static const auto InitialRetransmitTimeout = _TICKS_PER_SECOND;
+    static const auto MinRetransmitTimeout     = _TICKS_PER_SECOND / 5;
+    static const auto MaxRetransmitTimeout     = 60 * _TICKS_PER_SECOND;
+    static const auto MaxRetransmits           = 12;
+    static const auto DelayedAckTimeout        = _TICKS_PER_SECOND * 40 / 1000;
+    static const auto QuickAckSegments         = 8; // ACKed at once after start or loss
+    static const auto CorkTimeout              = _TICKS_PER_SECOND / 5;
+    static const auto FinWait2Timeout          = 60 * _TICKS_PER_SECOND;
+    static const auto RecentTimestampLifetime  = 24 * 24 * 3600 * _TICKS_PER_SECOND; // RFC 7323 5.5
+
+    // Keepalive (RFC 1122 4.2.3.6), see OnIdleTimer()
+    static const auto DefKeepAliveIdle     = 7200 * _TICKS_PER_SECOND;
+    static const auto DefKeepAliveInterval = 75 * _TICKS_PER_SECOND;
+    static const auto DefKeepAliveCount    = 9;
+    static const auto MaxKeepAliveTime     = 32767; // Seconds, idle or interval
+    static const auto MaxKeepAliveCount    = 127;
+
+    // Passive open, see ListenInput()
+    static const auto MaxBacklog        = 128; // SOMAXCONN
+    static const auto MinHalfOpen       = 16;  // SYN-RECEIVED entries per listener
+    static const auto MaxSynRetransmits = 5;
+    static const auto CookiePeriod      = 64 * _TICKS_PER_SECOND;
+
+    // Per-connection switches, see SetOptionFlag()
+    enum TCBOptionFlags : DWORD
+    {
+        OptionQuickAck = 0b00000001, // Never delay ACKs
+        OptionNoDelay  = 0b00000010, // Disable Nagle's algorithm
+        OptionCork     = 0b00000100, // Only send full segments until uncorked
+        OptionKeepAlive = 0b00001000, // Probe the peer once the connection idles
+        OptionReusePort = 0b00010000, // Share the bound port, see Bind()
+    };
 
     //template<BYTE Version>
     friend class TCP<Version>;
+    friend class TimeWaitBlock<Version>;
+    template<typename Tp, size_t BucketCount>
+    friend class HashTable;
 
     enum TCBStates
     {
@@ -372,19 +550,83 @@ public:
     };
 
 private:
-    TCB* ParentBody = nullptr;
+    // Half-open connection of a listener. The TCB is only allocated once
+    // the handshake completes, so a SYN flood costs one of these at most.
+    struct SynRequest
+    {
+        SynRequest* Next;
+        NetworkAdapter* Device;
+        DWORD LocalAddress;
+        DWORD RemoteAddress;
+        WORD  RemotePort;
+        WORD  Window;         // From the SYN, never scaled
+        WORD  MaxSegmentSize; // Peer's
+        BOOL  WindowScaling;
+        BYTE  SendWindowScale;
+        BYTE  ReceiveWindowScale;
+        BOOL  SackPermitted;
+        BOOL  Timestamps;
+        DWORD RecentTimestamp; // Peer's TSval from the SYN
+        DWORD TimestampOffset;
+        DWORD InitialSendSequenceNumber;
+        DWORD InitialReceiveSequenceNumber;
+        DWORD SentAt;
+        DWORD Deadline;
+        DWORD Retransmits;
+    };
+
+    struct SegmentOptions
+    {
+        WORD MaxSegmentSize = 0;
+        BOOL HasWindowScale = 0;
+        BYTE WindowScale = 0;
+        BOOL SackPermitted = 0;
+        int  SackBlockCount = 0;
+        struct {DWORD Start, End;} SackBlocks[MaxSackBlocks];
+        BOOL  HasTimestamp = 0;
+        DWORD TimestampValue = 0; // TSval
+        DWORD TimestampEcho = 0;  // TSecr
+    };
+
+    static ObjectPool<SynRequest> RequestPool;
+    // SipHash key behind sequence numbers, SYN cookies and timestamp
+    // offsets, see SecretHash().
+    static QWORD Secret[2];
+    // MSS values a SYN cookie can carry, 3 bits of index.
+    static constexpr WORD CookieSegmentSizes[] = {536, 1200, 1360, 1400, 1440, 1460};
+
+    // Guards everything in the block, which is also the sleep channel.
+    // Lock order: TCB, then its listener, then TCPLock or a hash bucket.
+    spinlock Lock;
+    int  References = 0;       // One while listed, plus one per user
+    TCB* ParentBody = nullptr; // Listener (held), until the block is accepted
+    int  Index = -1;           // Socket descriptor, slot in TCBTable
     BOOL Started = 0;
     TCBStates State = CLOSED;
     NetworkAdapter* Iface = nullptr;
     FrameType* Frame = nullptr;
-    BYTE* Window = nullptr;
+
+    // Demultiplexing keys, cached so lookups never have to decode Frame.
+    enum HashedTables : BYTE
+    {
+        NotHashed,
+        HashedBound,
+        HashedConnection,
+    };
+    DWORD LocalAddress = 0; // 0 accepts segments for any local address
+    WORD  LocalPort = 0;
+    DWORD RemoteAddress = 0;
+    WORD  RemotePort = 0;
+    TCB*  HashNext = nullptr;
+    BYTE  Hashed = NotHashed;
+    BOOL  EphemeralPort = 0; // LocalPort came from AllocatePort()
 
     // RFC 9293 3.3.1
     struct SendSequenceVariables
     {
         DWORD Unacknowledged;
         DWORD Next;
-        WORD  Window;
+        DWORD Window; // Already scaled
         WORD  UrgentPointer;
         DWORD SequenceNumber; // Used for last window update
         DWORD AcknowledgmentNumber; // Used for last window update
@@ -394,7 +636,7 @@ private:
     struct ReceiveSequenceVariables
     {
         DWORD Next;
-        WORD  Window;
+        DWORD Window; // Last advertised, in bytes
         WORD  UrgentPointer;
     }ReceiveSequence;
     DWORD InitialReceiveSequenceNumber;
@@ -408,8 +650,111 @@ private:
         WORD  UrgentPointer;
     }CurrentSegment;// __declspec(deprecated);
 
-    //LinkedQueue<TCP<Version>> TransmitQueue;
-    LinkedQueue<TCB<Version>*> ReceiveQueue;
+    // Segments built under Lock, Flush() hands them to the device once it
+    // is dropped since ToDevice() may wait for ARP and the NIC.
+    struct PendingFrame
+    {
+        FrameType* Frame;
+        NetworkAdapter* Device;
+        BOOL HeaderOnly;
+    };
+    LinkedQueue<PendingFrame> TransmitQueue;
+    BOOL Transmitting = 0;
+    BOOL Filling = 0; // TransmitFill() writes reserved send buffer space unlocked
+    LinkedQueue<TCB<Version>*> ReceiveQueue; // Accept queue of a listener
+    DWORD Backlog = 0;
+    SynRequest* HalfOpen = nullptr;
+    DWORD HalfOpenCount = 0;
+    DWORD LastCookie = 0;  // When a SYN was last answered with a cookie
+    BOOL  CookiesSent = 0;
+
+    // Bytes from SND.UNA onwards: [0, SND.NXT - SND.UNA) is in flight,
+    // the rest is waiting for window.
+    RingBuffer<> SendBuffer;
+    WORD  SendMaxSegmentSize = DefMaxSegmentSize;
+    // In-order bytes from RCV.NXT backwards that the user has not read yet.
+    RingBuffer<> ReceiveBuffer;
+    DWORD ReceiveBufferSize = DefReceiveBufferSize;
+    DWORD Charged = 0; // Bytes charged to NetMemory::OwnerTCP, rings and queued segments
+
+    // RFC 7323 window scaling, only used if both SYNs carried the option.
+    BOOL  WindowScaling = 0;
+    BYTE  SendWindowScale = 0;
+    BYTE  ReceiveWindowScale = 0;
+
+    // Data past RCV.NXT already placed in ReceiveBuffer, reported as SACK
+    // blocks with the most recently changed range first.
+    SequenceRangeSet<MaxOutOfOrderRanges> OutOfOrder;
+    DWORD LastOutOfOrder = 0;
+
+    // RFC 2018 SACK, both SYNs must carry SACK-permitted.
+    BOOL  SackPermitted = 0;
+    SequenceRangeSet<MaxOutOfOrderRanges> Sacked; // Scoreboard above SND.UNA
+    DWORD RetransmitHigh = 0; // HighRxt in RFC 6675
+    DWORD SendHighest = 0; // Highest sequence sent so far (snd_max)
+
+    // RFC 7323 timestamps, both SYNs must carry the option. TSval is ticks
+    // plus a per address pair offset, so it counts in 10 ms steps.
+    BOOL  Timestamps = 0;
+    DWORD TimestampOffset = 0;
+    DWORD RecentTimestamp = 0;     // TS.Recent
+    DWORD RecentTimestampTime = 0; // When TS.Recent was taken, in ticks
+    DWORD LastAcknowledgeSent = 0; // Last.ACK.sent
+    SegmentOptions Received;       // Options of the segment being processed
+
+    CongestionControl* Congestion = &NewRenoCongestionControl::Instance;
+    CongestionState CongestionVariables = {};
+    DWORD DuplicateAcks = 0;
+    DWORD RecoveryPoint = 0; // "recover" in RFC 6582
+    BOOL  FastRecovery = 0;
+
+    DWORD SmoothedRTT = 0;  // Scaled by 8
+    DWORD RTTVariation = 0; // Scaled by 4
+    DWORD RetransmitTimeout = InitialRetransmitTimeout;
+    DWORD RetransmitDeadline = 0;
+    DWORD Retransmits = 0;
+    BOOL  RetransmitPending = 0;
+    BOOL  RTTTiming = 0;
+    DWORD RTTSequence = 0; // ACK at or beyond this ends the timed segment
+    DWORD RTTStart = 0;
+
+    // Delayed ACK (RFC 1122 4.2.3.2)
+    DWORD OptionFlags = 0;
+    BOOL  AckPending = 0;
+    DWORD AckDeadline = 0;
+    DWORD UnackedBytes = 0;
+    DWORD QuickAcks = QuickAckSegments;
+    WORD  ReceiveMaxSegmentSize = DefMaxSegmentSize; // Largest segment seen
+
+    BOOL  CorkPending = 0;
+    DWORD CorkDeadline = 0;
+
+    // Closed by the user with the peer still sending, the block finishes
+    // the close on its own and releases itself.
+    BOOL  Orphaned = 0;
+    DWORD FinWaitDeadline = 0;
+
+    // Keepalive, armed on IdleTimer together with the orphan timeout.
+    DWORD KeepAliveIdle = DefKeepAliveIdle;
+    DWORD KeepAliveInterval = DefKeepAliveInterval;
+    DWORD KeepAliveCount = DefKeepAliveCount;
+    DWORD KeepAliveProbes = 0; // Sent since the peer was last heard
+    DWORD LastReceived = 0;
+    int   Error = 0; // Reported once by Receive() or Transmit(), see Abort()
+
+    // Handshake started by a non-blocking Connect(), finished by the next
+    // call. The address it was bound to before, see Disconnect().
+    BOOL  Connecting = 0;
+    DWORD ConnectBoundAddress = 0;
+
+    // Kernel timers, changed under Lock, see StartTimer(). A listener
+    // resends its SYN-ACKs on RetransmitTimer.
+    timer RetransmitTimer;
+    timer AckTimer;
+    timer CorkTimer;
+    timer IdleTimer;
+
+    pollqueue PollQueue; // poll() and epoll waiters, see Notify()
 
 public:
     TCB() {Init();}
@@ -424,334 +769,1951 @@ public:
     void Init()
     {
         //Started = 1;
+        initlock(&Lock, (char*)"TCB");
+        pollqueueinit(&PollQueue);
+        timer_init(&RetransmitTimer, OnTimer<&TCB::OnRetransmitTimer>, this);
+        timer_init(&AckTimer, OnTimer<&TCB::OnAckTimer>, this);
+        timer_init(&CorkTimer, OnTimer<&TCB::OnCorkTimer>, this);
+        timer_init(&IdleTimer, OnTimer<&TCB::OnIdleTimer>, this);
         Frame = new FrameType();
-        Window = (BYTE*)kalloc();
+        // Under memory pressure a new block starts out small.
+        BOOL Pressure = NetMemory::UnderPressure();
+        if (Pressure) {ReceiveBufferSize = MinReceiveBufferSize;}
+        SendBuffer.Create(Pressure ? SendBufferSize / 4 : SendBufferSize);
+        ReceiveBuffer.Create(ReceiveBufferSize);
     }
 
     void Destory()
     {
+        while (!TransmitQueue.empty())
+        {
+            delete TransmitQueue.front().Frame;
+            TransmitQueue.pop();
+        }
         delete Frame;
-        kfree((char*)Window);
+        Frame = nullptr;
+        SendBuffer.Destory();
+        ReceiveBuffer.Destory();
+        NetMemory::Uncharge(NetMemory::OwnerTCP, Charged);
+        Charged = 0;
     }
 
-    // Getters and Setters
-    TCB* GetParentBody()const { return ParentBody; }
-    BOOL IsStarted()const {return Started;}
-    FrameType* GetFrame() {return Frame;}
-    const FrameType* GetFrame()const {return Frame;}
-    NetworkAdapter* GetDevice()const {return Iface;}
-    TCBStates GetState()const {return State;}
-
-    constexpr static const BYTE SYNOptions[] =
+    // Pages the block holds for as long as it lives: the header template
+    // and both rings with their page tables.
+    DWORD BufferCharge()const
     {
-        0x02, 0x04, 0x05, 0xB4, // MSS
-        //0x04, 0x02,             // SACK Perm.
-        //0x03, 0x03, 0x01        // Window scale
-    };
-    static const int SYNOptionsSize = 4;
+        DWORD Pages = Frame ? 1 : 0;
+        if (SendBuffer.valid()) {Pages += 1 + SendBuffer.capacity() / 4096;}
+        if (ReceiveBuffer.valid()) {Pages += 1 + ReceiveBuffer.capacity() / 4096;}
+        return Pages * NetMemory::PageCharge;
+    }
 
-protected:
-    void SetParentBody(TCB* NewParentBody) {ParentBody = NewParentBody;}
-    void Start() {Started = 1;}
-    void SetFrame(const FrameType* Frame)
+    // Recreate the empty receive buffer at Size, the charge follows. Under
+    // memory pressure it does not grow.
+    BOOL CreateReceiveBuffer(DWORD Size)
     {
-        this->Frame->Clear();
-        Frame->CopyTo(this->Frame);
+        if (NetMemory::UnderPressure() && Size > ReceiveBuffer.capacity()) {return 0;}
+        DWORD Before = BufferCharge();
+        ReceiveBufferSize = Size;
+        BOOL Created = ReceiveBuffer.Create(Size);
+        if (!ReceiveBuffer.valid())
+        {
+            ReceiveBufferSize = MinReceiveBufferSize;
+            ReceiveBuffer.Create(ReceiveBufferSize);
+        }
+        DWORD After = BufferCharge();
+        if (After > Before) {NetMemory::ForceCharge(NetMemory::OwnerTCP, After - Before);}
+        else {NetMemory::Uncharge(NetMemory::OwnerTCP, Before - After);}
+        Charged = Charged + After - Before;
+        return Created;
     }
-    void SetDevice(NetworkAdapter* NewDevice) {Iface = NewDevice;}
-    void SetState(TCBStates NewState)
+
+    void Hold() {__atomic_add_fetch(&References, 1, __ATOMIC_ACQ_REL);}
+
+    // The block is freed with its last reference, which can only go after
+    // Release() took it out of TCBTable and the hash tables.
+    void Put()
     {
-        State = NewState;
-        cprintf((LPSTR)"[TCB] Switched to new state: %d\n", State);
+        if (__atomic_sub_fetch(&References, 1, __ATOMIC_ACQ_REL)) {return;}
+        TCB* Parent = ParentBody;
+        FrameType::TCBPool.Delete(this);
+        if (Parent) {Parent->Put();}
     }
 
-public:
-    BOOL IsReadyForReception()
+    // Block behind a socket descriptor, held, nullptr if there is none.
+    static TCB* Get(int Index)
     {
-        return GetState() == ESTABLISHED || GetState() == FIN_WAIT_1 || GetState() == FIN_WAIT_2;
+        FrameType::AcquireLock();
+        TCB* App = FrameType::TCBTable[Index];
+        if (App) {App->Hold();}
+        FrameType::ReleaseLock();
+        return App;
     }
 
-    BOOL IsReadyForTranssmission()
+    // Send whatever the locked section queued.
+    void Unlock()
     {
-        return GetState() == ESTABLISHED || GetState() == CLOSE_WAIT;
+        release(&Lock);
+        Flush();
     }
 
-    void Fork(TCB* ParentBody, NetworkAdapter* Device, const TCP<4>* TCPFrame)
+    void Flush()
     {
-        this->Start();
-        this->SetState(ParentBody->GetState());
-        this->SetDevice(Device);
-        this->GetFrame()->SetSourcePort(ParentBody->GetFrame()->GetSourcePort());
-        this->GetFrame()->SetDestinationAddress(TCPFrame->GetSourceAddress());
-        this->GetFrame()->SetDestinationPort(TCPFrame->GetSourcePort());
-        this->ReceiveSequence.Window = DefWindowSize;
-        this->SetParentBody(ParentBody);
+        acquire(&Lock);
+        // Whoever is already sending drains the queue in order.
+        if (Transmitting)
+        {
+            release(&Lock);
+            return;
+        }
+        Transmitting = 1;
+        while (!TransmitQueue.empty())
+        {
+            PendingFrame Pending = TransmitQueue.front();
+            TransmitQueue.pop();
+            Charged -= QueueCharge;
+            release(&Lock);
+            Pending.Frame->ToDevice(*Pending.Device, Pending.HeaderOnly);
+            delete Pending.Frame;
+            NetMemory::Uncharge(NetMemory::OwnerTCP, QueueCharge);
+            acquire(&Lock);
+        }
+        Transmitting = 0;
+        release(&Lock);
     }
 
-    void Clear()
+    // Readiness changed: wake whoever sleeps on the block and its pollers.
+    void Notify()
     {
-        //TransmitQueue.__dist_clear();
-        *this = TCB();
-        Init();
+        wakeup(this);
+        pollnotify(&PollQueue);
     }
 
-    void ClearFrame()
+    // sleep() with Lock held, unless segments are still queued: those go out
+    // first and the caller rechecks its condition without sleeping, as the
+    // wakeup it waits for may be the answer to them.
+    void Wait()
     {
-        int IPHeaderSize = Frame->GetInternetHeaderLength() * sizeof(DWORD);
-        int TCPHeaderSize = Frame->GetDataOffset() * sizeof(DWORD);
-        if (Frame->DataSize())
+        if (TransmitQueue.empty())
         {
-            Frame->EraseData(IPHeaderSize + TCPHeaderSize, Frame->DataSize());
+            sleep(this, &Lock);
+            return;
         }
-        Frame->SetOptions(nullptr, 0);
+        Unlock();
+        acquire(&Lock);
     }
 
-    void UpdateRouteData()
-    {
-        typename decltype(IPType::RouteTable)::iterator Route;
-        Route = IPType::RouteTableMatch(Frame->GetDestinationAddress());
-        if (Route == IPType::RouteTable.end()) {return;}
-        Iface = (NetworkAdapter*)Route->Iface;
-    }
+    // Getters and Setters
+    TCB* GetParentBody()const { return ParentBody; }
+    BOOL IsStarted()const {return Started;}
+    FrameType* GetFrame() {return Frame;}
+    const FrameType* GetFrame()const {return Frame;}
+    NetworkAdapter* GetDevice()const {return Iface;}
+    TCBStates GetState()const {return State;}
 
-    int SendControl(DWORD Sequence, DWORD Acknowledge, BYTE Flags)
+    // Sequence space comparisons (RFC 9293 3.4), safe across wrap-around.
+    static BOOL SequenceLess(DWORD A, DWORD B) {return int(A - B) < 0;}
+    static BOOL SequenceLessEqual(DWORD A, DWORD B) {return int(A - B) <= 0;}
+
+    static DWORD GetDWORD(const BYTE* Src)
     {
-        cprintf((LPSTR)"[TCB] Sending control: SEQ - 0x%x, ACK - 0x%x, FLG - 0x%x\n",
-            Sequence, Acknowledge, Flags);
-        Frame->SetSequenceNumber(Sequence);
-        Frame->SetAcknowledgementNumber(Acknowledge);
-        Frame->SetFlags(Flags);
-        Frame->SetWindow(ReceiveSequence.Window);
-        if (Flags & FrameType::SYN) {Frame->SetOptions(SYNOptions, SYNOptionsSize);}
-        UpdateRouteData();
-        int ReturnValue = Iface ? Frame->ToDevice(*Iface, 1) : -1;
-        // if (ReturnValue > 0) {TransmitQueue.push(new FrameType(Frame));}
-        if (Flags & FrameType::SYN) {Frame->SetOptions(nullptr, 0);}
-        return ReturnValue;
+        return (DWORD(Src[0]) << 24) | (DWORD(Src[1]) << 16) | (DWORD(Src[2]) << 8) | Src[3];
     }
 
-    int SendData(LPCVOID Data, int Size)
+    static void SetDWORD(BYTE* Dst, DWORD Value)
     {
-        Frame->SetSequenceNumber(SendSequence.Next);
-        Frame->SetAcknowledgementNumber(ReceiveSequence.Next);
-        Frame->SetFlags(FrameType::ACK | FrameType::PSH);
-        Frame->SetData(Data, 0, Size);
-        UpdateRouteData();
-        Frame->ToDevice(*Iface, 0);
-        // if (ReturnValue > 0) {TransmitQueue.push(new FrameType(Frame));}
-        ClearFrame();
-        return Size;
+        Dst[0] = BYTE(Value >> 24);
+        Dst[1] = BYTE(Value >> 16);
+        Dst[2] = BYTE(Value >> 8);
+        Dst[3] = BYTE(Value);
     }
 
-    // Static functions
-    static int Open()
+    static void ParseOptions(const FrameType* TCPFrame, SegmentOptions& Result)
     {
-        cprintf((LPSTR)"[TCB] TCB Starting...\n");
-        FrameType::AcquireLock();
-        for (auto i = 0U; i < FrameType::TCBTable.size(); ++i)
+        BYTE Options[FrameType::HeaderSizeMax - FrameType::HeaderSizeMin];
+        int OptionSize = TCPFrame->GetDataOffset() * sizeof(DWORD) - FrameType::HeaderSizeMin;
+        if (OptionSize <= 0) {return;}
+        TCPFrame->GetOptions(Options);
+        for (int i = 0; i < OptionSize;)
         {
-            if (!FrameType::TCBTable[i].IsStarted())
+            BYTE Kind = Options[i];
+            if (Kind == FrameType::OptEnd) {break;}
+            if (Kind == FrameType::OptNOP) {++i; continue;}
+            if (i + 1 >= OptionSize) {break;}
+            BYTE Length = Options[i + 1];
+            if (Length < 2 || i + Length > OptionSize) {break;}
+            switch (Kind)
             {
-                FrameType::TCBTable[i].Start();
-                FrameType::ReleaseLock();
-                cprintf((LPSTR)"[TCB] TCB Started at %d\n", i);
-                return i;
+            case FrameType::OptMSS:
+                if (Length == 4)
+                {
+                    Result.MaxSegmentSize = (WORD(Options[i + 2]) << 8) | Options[i + 3];
+                }
+                break;
+            case FrameType::OptWindowScale:
+                if (Length == 3)
+                {
+                    Result.HasWindowScale = 1;
+                    Result.WindowScale = Options[i + 2] < MaxWindowScale ?
+                        Options[i + 2] : MaxWindowScale;
+                }
+                break;
+            case FrameType::OptSACKPermitted:
+                if (Length == 2) {Result.SackPermitted = 1;}
+                break;
+            case FrameType::OptSACK:
+                for (int Block = i + 2; Block + 8 <= i + Length &&
+                    Result.SackBlockCount < MaxSackBlocks; Block += 8)
+                {
+                    Result.SackBlocks[Result.SackBlockCount].Start = GetDWORD(Options + Block);
+                    Result.SackBlocks[Result.SackBlockCount].End = GetDWORD(Options + Block + 4);
+                    ++Result.SackBlockCount;
+                }
+                break;
+            case FrameType::OptTimestamps:
+                if (Length == 10)
+                {
+                    Result.HasTimestamp = 1;
+                    Result.TimestampValue = GetDWORD(Options + i + 2);
+                    Result.TimestampEcho = GetDWORD(Options + i + 6);
+                }
+                break;
+            default:
+                break;
             }
+            i += Length;
         }
-        FrameType::ReleaseLock();
-        return -1;
     }
 
-    static int Close(int Index)
+    // A SYN-ACK only offers an option if the peer's SYN did.
+    int BuildSynOptions(BYTE* Options, BYTE Flags)const
     {
-        if (Index > int(FrameType::TCBTable.size())) {return -1;}
-        cprintf((LPSTR)"[TCB] TCB %d - Stopping...\n", Index);
-        FrameType::AcquireLock();
-        auto CurrentApp = &(FrameType::TCBTable[Index]);
-        if (!CurrentApp->IsStarted())
-        {
-            FrameType::ReleaseLock();
-            return -2;
-        }
-
-        switch (CurrentApp->GetState())
-        {
-        case SYN_RECEIVED:
-        case ESTABLISHED:
-            CurrentApp->SendControl(
-                CurrentApp->SendSequence.Next,
-                CurrentApp->ReceiveSequence.Next,
-                FrameType::FIN | FrameType::ACK);
-            CurrentApp->SetState(FIN_WAIT_1);
-            ++CurrentApp->SendSequence.Next;
-            sleep(CurrentApp, &FrameType::TCPLock);
-            break;
-        case CLOSE_WAIT:
-            CurrentApp->SendControl(
-                CurrentApp->SendSequence.Next,
-                CurrentApp->ReceiveSequence.Next,
-                FrameType::FIN | FrameType::ACK);
-            CurrentApp->SetState(LAST_ACK);
-            ++CurrentApp->SendSequence.Next;
-            sleep(CurrentApp, &FrameType::TCPLock);
-            break;
-        default:
-            break;
-        }
-        CurrentApp->Clear();
-        cprintf((LPSTR)"[TCB] TCB %d - Stopped\n", Index);
-        FrameType::ReleaseLock();
-        return 0;
+        return BuildSynOptions(Options, Flags, SackPermitted, WindowScaling, ReceiveWindowScale,
+            Timestamps, TimestampNow(), RecentTimestamp);
     }
 
-    static int Bind(int Index, WORD Port)
+    static int BuildSynOptions(BYTE* Options, BYTE Flags,
+        BOOL SackPermitted, BOOL WindowScaling, BYTE ReceiveWindowScale,
+        BOOL Timestamps, DWORD TimestampValue, DWORD TimestampEcho)
     {
-        if (Index > int(FrameType::TCBTable.size())) {return -1;}
-        // Auto-detect
-        //if ((IP & IP::LocalhostMask) == IP::Localhost) {return 1;} // Not supported just now
-
-        cprintf((LPSTR)"[TCB] Binding TCB %d to port %d\n", Index, Port);
-        auto CurrentApp = &(FrameType::TCBTable[Index]);
-        FrameType::AcquireLock();
-        for (auto i = 0U; i < FrameType::TCBTable.size(); ++i)
+        int Size = 0;
+        Options[Size++] = FrameType::OptMSS;
+        Options[Size++] = 4;
+        Options[Size++] = BYTE(MaxSegmentSize >> 8);
+        Options[Size++] = BYTE(MaxSegmentSize & 0xFF);
+        if (!(Flags & FrameType::ACK) || SackPermitted)
         {
-            if (FrameType::TCBTable[i].GetFrame()->GetSourcePort() == Port)
-            {
-                FrameType::ReleaseLock();
-                return -2;
-            }
+            Options[Size++] = FrameType::OptNOP;
+            Options[Size++] = FrameType::OptNOP;
+            Options[Size++] = FrameType::OptSACKPermitted;
+            Options[Size++] = 2;
         }
-        if (!CurrentApp->IsStarted() || CurrentApp->GetState() != CLOSED)
+        if (!(Flags & FrameType::ACK) || WindowScaling)
         {
-            FrameType::ReleaseLock();
-            return -3;
+            Options[Size++] = FrameType::OptNOP;
+            Options[Size++] = FrameType::OptWindowScale;
+            Options[Size++] = 3;
+            Options[Size++] = ReceiveWindowScale;
         }
-        CurrentApp->GetFrame()->SetSourcePort(Port);
-        cprintf((LPSTR)"[TCB] TCB %d - Current port is %d\n", Index,
-            CurrentApp->GetFrame()->GetSourcePort());
-        FrameType::ReleaseLock();
-        return 0;
-    }
-
-    static int Listen(int Index, int Backlog)
-    {
-        if (Index > int(FrameType::TCBTable.size())) {return -1;}
-        FrameType::AcquireLock();
-
-        cprintf((LPSTR)"[TCB] TCB %d - Starting listen... (%d)\n", Index, Backlog);
-        auto CurrentApp = &(FrameType::TCBTable[Index]);
-        if (!CurrentApp->IsStarted() ||
-            CurrentApp->GetState() != CLOSED ||
-            !CurrentApp->GetFrame()->GetSourcePort())
+        if (!(Flags & FrameType::ACK) || Timestamps)
         {
-            FrameType::ReleaseLock();
-            return -3;
+            // TSecr is only meaningful with ACK set (RFC 7323 3.2).
+            Size += BuildTimestampOption(Options + Size, TimestampValue,
+                (Flags & FrameType::ACK) ? TimestampEcho : 0);
         }
-        CurrentApp->SetState(LISTEN);
-
-        FrameType::ReleaseLock();
-        return 0;
+        return Size;
     }
 
-    static int Connect(int Index, DWORD DestinationAddress, WORD DestinationPort)
+    static int BuildTimestampOption(BYTE* Options, DWORD TimestampValue, DWORD TimestampEcho)
     {
-        // TODO... Only for client
-        return 0;
+        Options[0] = FrameType::OptNOP;
+        Options[1] = FrameType::OptNOP;
+        Options[2] = FrameType::OptTimestamps;
+        Options[3] = 10;
+        SetDWORD(Options + 4, TimestampValue);
+        SetDWORD(Options + 8, TimestampEcho);
+        return TimestampOptionSize;
     }
 
-    static int Accept(int Index, DWORD* DestinationAddress, WORD* DestinationPort)
+    // Options of every segment after the SYNs. RFC 7323 3.2 wants the
+    // timestamp on all of them but RST, which leaves room for 3 SACK blocks.
+    int BuildSegmentOptions(BYTE* Options, BYTE Flags)const
     {
-        if (Index > int(FrameType::TCBTable.size())) {return -1;}
-        FrameType::AcquireLock();
-
-        cprintf((LPSTR)"[TCB] TCB %d - Waiting for accept...\n", Index);
-        auto CurrentApp = &(FrameType::TCBTable[Index]);
-        if (!CurrentApp->IsStarted() || CurrentApp->GetState() != LISTEN)
+        int Size = 0;
+        if (Timestamps && !(Flags & FrameType::RST))
         {
-            FrameType::ReleaseLock();
-            return -3;
+            Size += BuildTimestampOption(Options, TimestampNow(), RecentTimestamp);
         }
-
-        TCB<4>* CurrentLog;
-        while (1)
+        if (Flags & FrameType::ACK)
         {
-            if (!CurrentApp->ReceiveQueue.empty())
-            {
-                CurrentLog = CurrentApp->ReceiveQueue.front();
-                CurrentApp->ReceiveQueue.pop();
-                break;
-            }
-            else {sleep(CurrentApp, &FrameType::TCPLock);}
+            Size += BuildSackOptions(Options + Size, Size ? MaxSackBlocks - 1 : MaxSackBlocks);
         }
+        return Size;
+    }
 
-        if (DestinationAddress)
+    // SACK blocks for the out-of-order queue (RFC 2018 4).
+    int BuildSackOptions(BYTE* Options, int MaxBlocks)const
+    {
+        if (!SackPermitted || OutOfOrder.empty()) {return 0;}
+        int Blocks = OutOfOrder.size() < size_t(MaxBlocks) ? OutOfOrder.size() : MaxBlocks;
+        int Size = 0;
+        Options[Size++] = FrameType::OptNOP;
+        Options[Size++] = FrameType::OptNOP;
+        Options[Size++] = FrameType::OptSACK;
+        Options[Size++] = BYTE(2 + 8 * Blocks);
+        auto Latest = OutOfOrder.Find(LastOutOfOrder);
+        if (Latest)
         {
-            *DestinationAddress = CurrentLog->GetFrame()->GetDestinationAddress();
+            SetDWORD(Options + Size, Latest->Start);
+            SetDWORD(Options + Size + 4, Latest->End);
+            Size += 8;
+            --Blocks;
         }
-        if (DestinationPort)
+        for (size_t i = 0; i < OutOfOrder.size() && Blocks; ++i)
         {
-            *DestinationPort = CurrentLog->GetFrame()->GetDestinationPort();
+            if (&OutOfOrder[i] == Latest) {continue;}
+            SetDWORD(Options + Size, OutOfOrder[i].Start);
+            SetDWORD(Options + Size + 4, OutOfOrder[i].End);
+            Size += 8;
+            --Blocks;
         }
-        int IP1, IP2, Ip3, IP4;
-        IP::IPSplit(*DestinationAddress, IP1, IP2, Ip3, IP4);
-        cprintf((LPSTR)"[TCB] TCB %d - %d.%d.%d.%d:%d connected\n",
-            Index, IP1, IP2, Ip3, IP4, *DestinationPort);
-
-        FrameType::ReleaseLock();
-        return CurrentLog - FrameType::TCBTable.data();
+        return Size;
     }
 
-    static int Receive(int Index, LPVOID Destination, int Size)
+    // Free receive buffer space the peer may be offered. Under memory
+    // pressure the right edge stops running ahead of RCV.NXT by more than
+    // MinReceiveBufferSize, nothing already offered is taken back, so that
+    // ShrinkReceiveBuffer() can cut the buffer down once it drains.
+    DWORD OfferableWindow()const
     {
-        if (Index > int(FrameType::TCBTable.size())) {return -1;}
-        FrameType::AcquireLock();
-
-        auto CurrentApp = &(FrameType::TCBTable[Index]);
-        int TotalSize;
-        while (!(TotalSize = DefWindowSize - CurrentApp->ReceiveSequence.Window))
-        {
-            if (!CurrentApp->IsReadyForReception())
-            {
-                FrameType::ReleaseLock();
-                return 0;
-            }
-            sleep(CurrentApp, &FrameType::TCPLock);
-        }
-
-        int TrueDataSize = Size < TotalSize ? Size : TotalSize;
-        memcopy(Destination, CurrentApp->Window, TrueDataSize);
-        memcopy(CurrentApp->Window, CurrentApp->Window + TrueDataSize, TotalSize - TrueDataSize);
-        CurrentApp->ReceiveSequence.Window += TrueDataSize;
-
-        FrameType::ReleaseLock();
-        return TrueDataSize;
+        DWORD Available = ReceiveBuffer.available();
+        if (!NetMemory::UnderPressure()) {return Available;}
+        DWORD Offered = LastAcknowledgeSent + ReceiveSequence.Window - ReceiveSequence.Next;
+        DWORD Limit = Offered > MinReceiveBufferSize ? Offered : MinReceiveBufferSize;
+        return Available < Limit ? Available : Limit;
     }
 
-    static int Transmit(int Index, LPCVOID Data, int Size)
+    // Under memory pressure, give back the pages of a drained receive buffer
+    // the peer cannot fill beyond MinReceiveBufferSize anymore.
+    void ShrinkReceiveBuffer()
     {
-        if (Index > int(FrameType::TCBTable.size())) {return -1;}
-        FrameType::AcquireLock();
-
-        auto CurrentApp = &(FrameType::TCBTable[Index]);
-        if (!CurrentApp->IsStarted() || !CurrentApp->IsReadyForTranssmission())
-        {
-            FrameType::ReleaseLock();
-            return -3;
-        }
+        if (!NetMemory::UnderPressure() || !ReceiveBuffer.empty() || !OutOfOrder.empty()) {return;}
+        if (ReceiveBuffer.capacity() <= MinReceiveBufferSize) {return;}
+        DWORD Offered = LastAcknowledgeSent + ReceiveSequence.Window - ReceiveSequence.Next;
+        if (Offered > MinReceiveBufferSize) {return;}
+        CreateReceiveBuffer(MinReceiveBufferSize);
+    }
 
-        CurrentApp->SendData(Data, Size);
-        CurrentApp->SendSequence.Next += Size;
+    // Smallest shift that lets the whole receive buffer be advertised.
+    BYTE ComputeWindowScale()const
+    {
+        BYTE Shift = 0;
+        while (Shift < MaxWindowScale && (ReceiveBuffer.capacity() >> Shift) > 0xFFFF) {++Shift;}
+        return Shift;
+    }
 
-        FrameType::ReleaseLock();
-        return 0;
+    // Window field for an outgoing segment, also records RCV.WND. Windows in
+    // SYN segments are never scaled (RFC 7323 2.2).
+    WORD AdvertiseWindow(BYTE Flags)
+    {
+        DWORD Available = OfferableWindow();
+        BYTE Shift = (Flags & FrameType::SYN) ? 0 : ReceiveWindowScale;
+        DWORD Field = Available >> Shift;
+        if (Field > 0xFFFF) {Field = 0xFFFF;}
+        ReceiveSequence.Window = Field << Shift;
+        return WORD(Field);
     }
 
-    // Event functions
-    void DoClosed(const FrameType* TCPFrame)
+protected:
+    void SetParentBody(TCB* NewParentBody) {ParentBody = NewParentBody;}
+    void Start() {Started = 1;}
+    void SetFrame(const FrameType* Frame)
     {
-        cprintf((LPSTR)"[TCB] Current state: CLOSED\n");
-        if (TCPFrame->GetFlags() & FrameType::RST){return;}
-        DWORD Sequence, Acknowledge;
+        this->Frame->Clear();
+        Frame->CopyTo(this->Frame);
+    }
+    void SetDevice(NetworkAdapter* NewDevice) {Iface = NewDevice;}
+    void SetState(TCBStates NewState)
+    {
+        State = NewState;
+        cprintf((LPSTR)"[TCB] Switched to new state: %d\n", State);
+    }
+
+public:
+    BOOL IsReadyForReception()
+    {
+        return GetState() == ESTABLISHED || GetState() == FIN_WAIT_1 || GetState() == FIN_WAIT_2;
+    }
+
+    BOOL IsReadyForTranssmission()
+    {
+        return GetState() == ESTABLISHED || GetState() == CLOSE_WAIT;
+    }
+
+    BOOL IsOpening()
+    {
+        return GetState() == SYN_SENT || GetState() == SYN_RECEIVED;
+    }
+
+    // Caller holds Lock. 0 once data may be queued, otherwise what the
+    // send returns.
+    int AwaitTransmission(BOOL NonBlocking)
+    {
+        while ((IsOpening() || Filling) && !NonBlocking) {Wait();}
+        if (IsOpening() || Filling) {return FWOULDBLOCK;}
+        if (!IsReadyForTranssmission())
+        {
+            int ReturnValue = Error ? Error : -3;
+            Error = 0;
+            return ReturnValue;
+        }
+        return 0;
+    }
+
+    // Outcome of the handshake started by Connect(), the caller holds Lock.
+    // FINPROGRESS while it is still running and the caller cannot wait.
+    int FinishConnect(BOOL NonBlocking)
+    {
+        while (IsOpening())
+        {
+            if (NonBlocking) {return FINPROGRESS;}
+            Wait();
+        }
+        Connecting = 0;
+        if (GetState() == CLOSED)
+        {
+            // Back to an unconnected socket, connect() may be retried.
+            Disconnect(ConnectBoundAddress);
+            Error = 0;
+            return -6;
+        }
+        return 0;
+    }
+
+    // Connection for a completed handshake, the caller holds Lock.
+    void Establish(TCB* Listener, const SynRequest& Request)
+    {
+        this->Start();
+        this->SetState(ESTABLISHED);
+        this->SetDevice(Request.Device);
+        this->LocalAddress = Request.LocalAddress;
+        this->LocalPort = Listener->LocalPort;
+        this->RemoteAddress = Request.RemoteAddress;
+        this->RemotePort = Request.RemotePort;
+        this->GetFrame()->SetSourcePort(LocalPort);
+        this->GetFrame()->SetDestinationAddress(RemoteAddress);
+        this->GetFrame()->SetDestinationPort(RemotePort);
+        this->Congestion = Listener->Congestion;
+        this->OptionFlags = Listener->OptionFlags;
+        if (Listener->ReceiveBufferSize != this->ReceiveBufferSize)
+        {
+            this->CreateReceiveBuffer(Listener->ReceiveBufferSize);
+        }
+
+        InitialSendSequenceNumber = Request.InitialSendSequenceNumber;
+        InitialReceiveSequenceNumber = Request.InitialReceiveSequenceNumber;
+        SendSequence.Unacknowledged = InitialSendSequenceNumber + 1;
+        SendSequence.Next = SendSequence.Unacknowledged;
+        SendSequence.Window = Request.Window;
+        SendSequence.SequenceNumber = InitialReceiveSequenceNumber;
+        SendSequence.AcknowledgmentNumber = InitialSendSequenceNumber;
+        SendHighest = SendSequence.Next;
+        RecoveryPoint = InitialSendSequenceNumber;
+        ReceiveSequence.Next = InitialReceiveSequenceNumber + 1;
+        LastAcknowledgeSent = ReceiveSequence.Next;
+        SendMaxSegmentSize = Request.MaxSegmentSize;
+        Timestamps = Request.Timestamps;
+        TimestampOffset = Request.TimestampOffset;
+        RecentTimestamp = Request.RecentTimestamp;
+        RecentTimestampTime = ticks;
+        if (Timestamps) {SendMaxSegmentSize -= TimestampOptionSize;}
+        InitCongestion();
+        SackPermitted = Request.SackPermitted;
+        WindowScaling = Request.WindowScaling;
+        SendWindowScale = Request.SendWindowScale;
+        ReceiveWindowScale = Request.ReceiveWindowScale;
+        AdvertiseWindow(FrameType::SYN);
+        // Karn's rule, a retransmitted SYN-ACK gives no sample.
+        if (!Request.Retransmits)
+        {
+            RTTTiming = 1;
+            RTTSequence = SendSequence.Next;
+            RTTStart = Request.SentAt;
+            SampleRoundTrip(SendSequence.Next);
+        }
+
+        LastReceived = ticks;
+        ArmIdleTimer();
+
+        Listener->Hold();
+        this->SetParentBody(Listener);
+    }
+
+    // Send the SYN of an active open, the caller holds Lock. A socket that
+    // was not bound gets the route's source address and an ephemeral port.
+    int OpenConnection(DWORD Address, WORD Port)
+    {
+        if (State != CLOSED) {return -3;}
+        ReplyTo(Address, Port);
+        UpdateRouteData();
+        if (!Iface) {return -5;}
+        auto Source = IPType::IPFind(Iface);
+        if (Source == IPType::AdapterIPAddressTable.end()) {return -5;}
+
+        DWORD BoundAddress = LocalAddress;
+        Unhash();
+        if (!LocalPort)
+        {
+            FrameType::AcquireLock();
+            LocalPort = AllocatePort();
+            FrameType::ReleaseLock();
+            if (!LocalPort) {return -2;}
+            EphemeralPort = 1;
+        }
+        if (!LocalAddress) {LocalAddress = Source->IPAddress;}
+        RemoteAddress = Address;
+        RemotePort = Port;
+        Frame->SetSourcePort(LocalPort);
+        TCB* Existing = nullptr;
+        if (TimeWaitBlock<Version>::Exists(LocalAddress, LocalPort, RemoteAddress, RemotePort) ||
+            (Existing = HashConnection()))
+        {
+            if (Existing) {Existing->Put();}
+            Disconnect(BoundAddress);
+            return -2;
+        }
+
+        InitialSendSequenceNumber = GenerateSequenceNumber(LocalAddress, LocalPort,
+            RemoteAddress, RemotePort);
+        SendSequence.Unacknowledged = InitialSendSequenceNumber;
+        SendSequence.Next = InitialSendSequenceNumber + 1;
+        SendHighest = SendSequence.Next;
+        RecoveryPoint = InitialSendSequenceNumber;
+        // Offered in the SYN, dropped again if the SYN-ACK does not agree.
+        ReceiveWindowScale = ComputeWindowScale();
+        TimestampOffset = TimestampOffsetFor(LocalAddress, RemoteAddress);
+        Retransmits = 0;
+        RetransmitTimeout = InitialRetransmitTimeout;
+        Start();
+        SetState(SYN_SENT);
+        SendControl(InitialSendSequenceNumber, 0, FrameType::SYN);
+        StartRTTTiming(SendSequence.Next);
+        ArmRetransmitTimer();
+        return 0;
+    }
+
+    // Undo OpenConnection() once the handshake failed.
+    void Disconnect(DWORD BoundAddress)
+    {
+        Unhash();
+        if (EphemeralPort)
+        {
+            FrameType::AcquireLock();
+            FreePort(LocalPort);
+            FrameType::ReleaseLock();
+            EphemeralPort = 0;
+            LocalPort = 0;
+            Frame->SetSourcePort(0);
+        }
+        LocalAddress = BoundAddress;
+        RemoteAddress = 0;
+        RemotePort = 0;
+        RetransmitPending = 0;
+        RTTTiming = 0;
+        if (LocalPort)
+        {
+            FrameType::AcquireLock();
+            HashBound();
+            FrameType::ReleaseLock();
+        }
+    }
+
+    static DWORD ConnectionHash(DWORD LocalAddress, WORD LocalPort,
+        DWORD RemoteAddress, WORD RemotePort)
+    {
+        return HashMix(LocalAddress, RemoteAddress, (DWORD(LocalPort) << 16) | RemotePort);
+    }
+
+    // Wildcard and address-bound sockets on a port share one chain.
+    static DWORD ListenHash(WORD LocalPort) {return HashMix(0, 0, LocalPort);}
+
+    // Bound sockets stay in ListenTable so Bind() can find conflicts there,
+    // only the ones in LISTEN take new connections.
+    void HashBound()
+    {
+        Unhash();
+        FrameType::ListenTable.Insert(ListenHash(LocalPort), this);
+        Hashed = HashedBound;
+    }
+
+    // nullptr once hashed, or the block that already owns the 4-tuple (held).
+    TCB* HashConnection()
+    {
+        Unhash();
+        TCB* Existing = FrameType::ConnectionTable.InsertUnique(
+            ConnectionHash(LocalAddress, LocalPort, RemoteAddress, RemotePort), this,
+            [&](const TCB& App)
+            {
+                return App.LocalPort == LocalPort && App.RemotePort == RemotePort &&
+                    App.RemoteAddress == RemoteAddress && App.LocalAddress == LocalAddress;
+            });
+        if (!Existing) {Hashed = HashedConnection;}
+        return Existing;
+    }
+
+    void Unhash()
+    {
+        switch (Hashed)
+        {
+        case HashedBound:
+            FrameType::ListenTable.Erase(ListenHash(LocalPort), this);
+            break;
+        case HashedConnection:
+            FrameType::ConnectionTable.Erase(
+                ConnectionHash(LocalAddress, LocalPort, RemoteAddress, RemotePort), this);
+            break;
+        default:
+            break;
+        }
+        Hashed = NotHashed;
+    }
+
+    // Connection a segment belongs to, held. The keys of a hashed block
+    // never change, so they are compared without its lock.
+    static TCB* Lookup(NetworkAdapter* Device, DWORD LocalAddress, WORD LocalPort,
+        DWORD RemoteAddress, WORD RemotePort)
+    {
+        return FrameType::ConnectionTable.FindHeld(
+            ConnectionHash(LocalAddress, LocalPort, RemoteAddress, RemotePort),
+            [&](const TCB& App)
+            {
+                return App.LocalPort == LocalPort && App.RemotePort == RemotePort &&
+                    App.RemoteAddress == RemoteAddress && App.LocalAddress == LocalAddress &&
+                    (!App.Iface || App.Iface == Device);
+            });
+    }
+
+    // Listener for a new connection, held. One bound to LocalAddress is
+    // preferred over a wildcard one. Among listeners sharing the port the
+    // connection's 4-tuple picks one, so its handshake segments all go to
+    // the same listener. State is read unlocked, ListenInput() checks it
+    // again under the listener's lock.
+    static TCB* LookupListener(DWORD LocalAddress, WORD LocalPort,
+        DWORD RemoteAddress, WORD RemotePort)
+    {
+        DWORD Hash = ListenHash(LocalPort);
+        DWORD Key = ConnectionHash(LocalAddress, LocalPort, RemoteAddress, RemotePort);
+        TCB* App = FrameType::ListenTable.SelectHeld(Hash, [&](const TCB& Listener)
+        {
+            return Listener.State == LISTEN && Listener.LocalPort == LocalPort &&
+                Listener.LocalAddress == LocalAddress;
+        }, Key);
+        if (App) {return App;}
+        return FrameType::ListenTable.SelectHeld(Hash, [&](const TCB& Listener)
+        {
+            return Listener.State == LISTEN && Listener.LocalPort == LocalPort &&
+                !Listener.LocalAddress;
+        }, Key);
+    }
+
+    // Unused port from the ephemeral range (RFC 6335), 0 if there is none.
+    // The search resumes after the last port handed out, so a port is not
+    // reused right after its connection closed. The caller holds TCPLock.
+    static WORD AllocatePort()
+    {
+        auto& Ports = FrameType::SourcePorts;
+        DWORD Bit = FrameType::SourcePortHint;
+        for (DWORD Tried = 0; Tried < Ports.size(); ++Tried, ++Bit)
+        {
+            Bit = Ports.FindClear(Bit);
+            if (Bit >= Ports.size()) {Bit = Ports.FindClear(0);}
+            if (Bit >= Ports.size()) {return 0;}
+            WORD Port = WORD(FrameType::SourcePortMin + Bit);
+            // Explicitly bound sockets own their port.
+            if (FrameType::ListenTable.Find(ListenHash(Port),
+                [&](const TCB& App) {return App.LocalPort == Port;}))
+            {
+                continue;
+            }
+            Ports.Set(Bit);
+            FrameType::SourcePortHint = Bit + 1;
+            return Port;
+        }
+        return 0;
+    }
+
+    static void FreePort(WORD Port)
+    {
+        FrameType::SourcePorts.Reset(Port - FrameType::SourcePortMin);
+    }
+
+    static BOOL IsPortAllocated(WORD Port)
+    {
+        return Port >= FrameType::SourcePortMin &&
+            FrameType::SourcePorts.Test(Port - FrameType::SourcePortMin);
+    }
+
+    // New block with a descriptor, nullptr if the connection limit is
+    // reached or memory ran out. The caller holds TCPLock.
+    static TCB* Allocate()
+    {
+        TCB* App = FrameType::TCBPool.New();
+        if (!App) {return nullptr;}
+        // Rather no block than one without buffers.
+        DWORD Charge = App->BufferCharge();
+        if (!App->Frame || !App->SendBuffer.valid() || !App->ReceiveBuffer.valid() ||
+            !NetMemory::Charge(NetMemory::OwnerTCP, Charge))
+        {
+            FrameType::TCBPool.Delete(App);
+            return nullptr;
+        }
+        App->Charged = Charge;
+        App->Index = FrameType::TCBTable.Insert(App);
+        if (App->Index < 0)
+        {
+            FrameType::TCBPool.Delete(App);
+            return nullptr;
+        }
+        App->References = 1;
+        App->Start();
+        return App;
+    }
+
+    // Take the block out of TCBTable and the hash tables and drop the
+    // reference they held. The caller holds Lock and a reference of its own,
+    // so the block is freed by the caller's Put().
+    void Release()
+    {
+        if (Index < 0) {return;}
+        StopTimer(&RetransmitTimer);
+        StopTimer(&AckTimer);
+        StopTimer(&CorkTimer);
+        StopTimer(&IdleTimer);
+        Unhash();
+        FrameType::AcquireLock();
+        FrameType::TCBTable.Erase(Index);
+        if (EphemeralPort) {FreePort(LocalPort);}
+        FrameType::ReleaseLock();
+        EphemeralPort = 0;
+        Index = -1;
+        Put();
+    }
+
+    // Reset the connections a closed listener never handed out. Neither lock
+    // is held, children lock before their listener.
+    void ReleaseUnaccepted()
+    {
+        while (1)
+        {
+            acquire(&Lock);
+            if (ReceiveQueue.empty())
+            {
+                release(&Lock);
+                return;
+            }
+            TCB* Child = ReceiveQueue.front();
+            ReceiveQueue.pop();
+            Child->Hold();
+            release(&Lock);
+
+            acquire(&Child->Lock);
+            Child->SendControl(Child->SendSequence.Next,
+                Child->ReceiveSequence.Next, FrameType::RST | FrameType::ACK);
+            Child->SetState(CLOSED);
+            Child->Release();
+            Child->Unlock();
+            Child->Put();
+        }
+    }
+
+    void ClearFrame()
+    {
+        int IPHeaderSize = Frame->GetInternetHeaderLength() * sizeof(DWORD);
+        int TCPHeaderSize = Frame->GetDataOffset() * sizeof(DWORD);
+        if (Frame->DataSize())
+        {
+            Frame->EraseData(IPHeaderSize + TCPHeaderSize, Frame->DataSize());
+        }
+        Frame->SetOptions(nullptr, 0);
+    }
+
+    void UpdateRouteData()
+    {
+        typename decltype(IPType::RouteTable)::iterator Route;
+        Route = IPType::RouteTableMatch(Frame->GetDestinationAddress());
+        if (Route == IPType::RouteTable.end()) {return;}
+        Iface = (NetworkAdapter*)Route->Iface;
+    }
+
+    // Copy Frame onto TransmitQueue, see Flush(). The copy is charged until
+    // it is sent, over the hard limit the segment is dropped as if lost.
+    int Queue(BOOL HeaderOnly)
+    {
+        if (!NetMemory::Charge(NetMemory::OwnerTCP, QueueCharge)) {return -1;}
+        FrameType* Pending = new FrameType();
+        if (!Pending || !TransmitQueue.push({Pending, Iface, HeaderOnly}))
+        {
+            delete Pending;
+            NetMemory::Uncharge(NetMemory::OwnerTCP, QueueCharge);
+            return -1;
+        }
+        Charged += QueueCharge;
+        Frame->CopyTo(Pending);
+        // IPv4::ToDevice() advances the copy's ID, keep the template in step.
+        WORD Identification = Frame->GetIdentification() + 1;
+        Frame->SetIdentification(Identification ? Identification : 1);
+        return Pending->Size();
+    }
+
+    int SendControl(DWORD Sequence, DWORD Acknowledge, BYTE Flags)
+    {
+        cprintf((LPSTR)"[TCB] Sending control: SEQ - 0x%x, ACK - 0x%x, FLG - 0x%x\n",
+            Sequence, Acknowledge, Flags);
+        Frame->SetSequenceNumber(Sequence);
+        Frame->SetAcknowledgementNumber(Acknowledge);
+        Frame->SetFlags(Flags);
+        Frame->SetWindow(AdvertiseWindow(Flags));
+        BYTE Options[FrameType::HeaderSizeMax - FrameType::HeaderSizeMin];
+        int OptionSize = 0;
+        if (Flags & FrameType::SYN) {OptionSize = BuildSynOptions(Options, Flags);}
+        else {OptionSize = BuildSegmentOptions(Options, Flags);}
+        if (OptionSize) {Frame->SetOptions(Options, OptionSize);}
+        if (Flags & FrameType::ACK) {AcknowledgeSent();}
+        UpdateRouteData();
+        int ReturnValue = Iface ? Queue(1) : -1;
+        if (OptionSize) {Frame->SetOptions(nullptr, 0);}
+        return ReturnValue;
+    }
+
+    // Send Size bytes of SendBuffer starting at Offset as one segment.
+    int SendSegment(DWORD Sequence, DWORD Offset, DWORD Size, BYTE Flags)
+    {
+        Frame->SetSequenceNumber(Sequence);
+        Frame->SetAcknowledgementNumber(ReceiveSequence.Next);
+        Frame->SetFlags(Flags);
+        Frame->SetWindow(AdvertiseWindow(Flags));
+        BYTE Options[FrameType::HeaderSizeMax - FrameType::HeaderSizeMin];
+        int OptionSize = BuildSegmentOptions(Options, Flags);
+        if (OptionSize) {Frame->SetOptions(Options, OptionSize);}
+        if (Flags & FrameType::ACK) {AcknowledgeSent();}
+        DWORD Copied = 0;
+        while (Copied < Size)
+        {
+            typename decltype(SendBuffer)::size_type Run = Size - Copied;
+            const BYTE* Data = SendBuffer.Contiguous(Offset + Copied, Run);
+            if (!Run) {break;}
+            Frame->SetData(Data, Copied, Run);
+            Copied += Run;
+        }
+        // SetData() never shrinks the frame, trim it to the real length.
+        Frame->Resize(Frame->GetInternetHeaderLength() * sizeof(DWORD) +
+            Frame->GetDataOffset() * sizeof(DWORD) + Copied);
+        UpdateRouteData();
+        int ReturnValue = Iface ? Queue(0) : -1;
+        ClearFrame();
+        return ReturnValue;
+    }
+
+    DWORD FlightSize()const
+    {
+        return SendSequence.Next - SendSequence.Unacknowledged;
+    }
+
+    // States in which queued data or our FIN may still need (re)sending.
+    BOOL HasSendQueue()const
+    {
+        return State == ESTABLISHED || State == CLOSE_WAIT ||
+            State == FIN_WAIT_1 || State == CLOSING || State == LAST_ACK;
+    }
+
+    void AdvanceSendNext(DWORD Length)
+    {
+        SendSequence.Next += Length;
+        if (SequenceLess(SendHighest, SendSequence.Next)) {SendHighest = SendSequence.Next;}
+    }
+
+    // Push as much buffered data as min(cwnd, rwnd) allows, in MSS-sized
+    // segments. Small segments are held back by Nagle's algorithm or a cork
+    // unless Push is set. Returns the number of segments sent.
+    int Output(BOOL Push = 0)
+    {
+        if (!HasSendQueue()) {return 0;}
+        DWORD Window = SendSequence.Window < CongestionVariables.Window ?
+            SendSequence.Window : CongestionVariables.Window;
+        int Segments = 0;
+        while (FlightSize() < SendBuffer.size())
+        {
+            // After a rewind, skip what the receiver already holds.
+            if (auto Range = Sacked.Find(SendSequence.Next))
+            {
+                SendSequence.Next = Range->End;
+                continue;
+            }
+            DWORD InFlight = FlightSize();
+            DWORD Length = SendBuffer.size() - InFlight;
+            if (Length > SendMaxSegmentSize) {Length = SendMaxSegmentSize;}
+            if (auto Range = Sacked.FindAfter(SendSequence.Next))
+            {
+                if (Length > Range->Start - SendSequence.Next) {Length = Range->Start - SendSequence.Next;}
+            }
+            if (InFlight >= Window) {break;}
+            if (Length > Window - InFlight) {Length = Window - InFlight;}
+            // Retransmissions after a rewind are never held back.
+            if (Length < SendMaxSegmentSize && !Push &&
+                SequenceLessEqual(SendHighest, SendSequence.Next))
+            {
+                if (OptionFlags & OptionCork)
+                {
+                    if (!CorkPending)
+                    {
+                        CorkPending = 1;
+                        CorkDeadline = ticks + CorkTimeout;
+                        StartTimer(&CorkTimer, CorkDeadline);
+                    }
+                    break;
+                }
+                // Nagle (RFC 896, RFC 1122 4.2.3.4), one small segment in flight.
+                if (!(OptionFlags & OptionNoDelay) && InFlight) {break;}
+            }
+            BYTE Flags = FrameType::ACK;
+            if (InFlight + Length == SendBuffer.size()) {Flags |= FrameType::PSH;}
+            if (SendSegment(SendSequence.Next, InFlight, Length, Flags) < 0) {break;}
+            // Karn's algorithm, only time segments sent for the first time.
+            if (!RTTTiming && SequenceLessEqual(SendHighest, SendSequence.Next))
+            {
+                StartRTTTiming(SendSequence.Next + Length);
+            }
+            AdvanceSendNext(Length);
+            ++Segments;
+        }
+
+        // After a go-back-N rewind the FIN has to follow the data again.
+        if ((State == FIN_WAIT_1 || State == CLOSING || State == LAST_ACK) &&
+            FlightSize() == SendBuffer.size() &&
+            SequenceLess(SendSequence.Next, SendHighest))
+        {
+            SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::FIN | FrameType::ACK);
+            AdvanceSendNext(1);
+            ++Segments;
+        }
+
+        if (FlightSize() == SendBuffer.size()) {CorkPending = 0;}
+        // Also the persist timer while the peer advertises a zero window.
+        if (!RetransmitPending &&
+            (FlightSize() || (!SendBuffer.empty() && !SendSequence.Window)))
+        {
+            ArmRetransmitTimer();
+        }
+        return Segments;
+    }
+
+    void SendFinish()
+    {
+        SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::FIN | FrameType::ACK);
+        AdvanceSendNext(1);
+        if (!RetransmitPending) {ArmRetransmitTimer();}
+    }
+
+    // Resend the first unacknowledged segment, or the SYN/FIN that is
+    // still outstanding if there is no data left.
+    int Retransmit()
+    {
+        RTTTiming = 0; // Karn's algorithm
+        DWORD Length = SendBuffer.size();
+        if (Length > SendMaxSegmentSize) {Length = SendMaxSegmentSize;}
+        if (Length > SendHighest - SendSequence.Unacknowledged)
+        {
+            Length = SendHighest - SendSequence.Unacknowledged;
+        }
+        if (Length)
+        {
+            BYTE Flags = FrameType::ACK;
+            if (Length == SendBuffer.size()) {Flags |= FrameType::PSH;}
+            if (SequenceLess(RetransmitHigh, SendSequence.Unacknowledged + Length))
+            {
+                RetransmitHigh = SendSequence.Unacknowledged + Length;
+            }
+            return SendSegment(SendSequence.Unacknowledged, 0, Length, Flags);
+        }
+        switch (State)
+        {
+        case SYN_SENT:
+            return SendControl(InitialSendSequenceNumber, 0, FrameType::SYN);
+        case SYN_RECEIVED:
+            return SendControl(InitialSendSequenceNumber, ReceiveSequence.Next,
+                FrameType::SYN | FrameType::ACK);
+        case FIN_WAIT_1:
+        case CLOSING:
+        case LAST_ACK:
+            return SendControl(SendSequence.Unacknowledged, ReceiveSequence.Next,
+                FrameType::FIN | FrameType::ACK);
+        default:
+            return 0;
+        }
+    }
+
+    // Resend the first hole below the highest SACKed byte that has not been
+    // retransmitted yet (RFC 6675 NextSeg() rule 1). Returns 0 if none.
+    BOOL RetransmitHole()
+    {
+        if (Sacked.empty()) {return 0;}
+        DWORD Sequence = SequenceLess(RetransmitHigh, SendSequence.Unacknowledged) ?
+            SendSequence.Unacknowledged : RetransmitHigh;
+        for (size_t i = 0; i < Sacked.size(); ++i)
+        {
+            if (SequenceLess(Sequence, Sacked[i].Start))
+            {
+                DWORD Length = Sacked[i].Start - Sequence;
+                if (Length > SendMaxSegmentSize) {Length = SendMaxSegmentSize;}
+                RTTTiming = 0;
+                SendSegment(Sequence, Sequence - SendSequence.Unacknowledged, Length, FrameType::ACK);
+                RetransmitHigh = Sequence + Length;
+                return 1;
+            }
+            if (SequenceLess(Sequence, Sacked[i].End)) {Sequence = Sacked[i].End;}
+        }
+        return 0;
+    }
+
+    // Sender side of RFC 2018, record the blocks the peer reports.
+    void UpdateScoreboard(const FrameType* TCPFrame)
+    {
+        const SegmentOptions& Options = Received;
+        DWORD Acknowledge = TCPFrame->GetAcknowledgementNumber();
+        for (int i = 0; i < Options.SackBlockCount; ++i)
+        {
+            DWORD Start = Options.SackBlocks[i].Start;
+            DWORD End = Options.SackBlocks[i].End;
+            if (!SequenceLess(Acknowledge, End) || SequenceLess(SendHighest, End)) {continue;}
+            Sacked.Insert(SequenceLess(Start, Acknowledge) ? Acknowledge : Start, End);
+        }
+    }
+
+    // Retransmission timer (RFC 6298)
+    void ArmRetransmitTimer()
+    {
+        RetransmitDeadline = ticks + RetransmitTimeout;
+        RetransmitPending = 1;
+        StartTimer(&RetransmitTimer, RetransmitDeadline);
+    }
+
+    void StartRTTTiming(DWORD EndSequence)
+    {
+        RTTTiming = 1;
+        RTTSequence = EndSequence;
+        RTTStart = ticks;
+    }
+
+    void SampleRoundTrip(DWORD Acknowledge)
+    {
+        if (!RTTTiming || SequenceLess(Acknowledge, RTTSequence)) {return;}
+        RTTTiming = 0;
+        UpdateRoundTrip(int(ticks - RTTStart));
+    }
+
+    // With timestamps every ACK that moves SND.UNA times a segment, also
+    // one that was retransmitted (RFC 7323 4.1), since TSecr names the copy.
+    BOOL SampleTimestamp()
+    {
+        if (!Timestamps || !Received.HasTimestamp || !Received.TimestampEcho) {return 0;}
+        int Sample = int(TimestampNow() - Received.TimestampEcho);
+        if (Sample < 0 || DWORD(Sample) > MaxRetransmitTimeout * 2) {return 0;}
+        RTTTiming = 0;
+        UpdateRoundTrip(Sample);
+        return 1;
+    }
+
+    void UpdateRoundTrip(int Sample)
+    {
+        if (Sample <= 0) {Sample = 1;}
+        if (!SmoothedRTT)
+        {
+            SmoothedRTT = Sample << 3;
+            RTTVariation = Sample << 1;
+        }
+        else
+        {
+            int Delta = Sample - int(SmoothedRTT >> 3);
+            SmoothedRTT += Delta;
+            if (Delta < 0) {Delta = -Delta;}
+            RTTVariation += Delta - int(RTTVariation >> 2);
+        }
+        RetransmitTimeout = (SmoothedRTT >> 3) + (RTTVariation ? RTTVariation : 1);
+        if (RetransmitTimeout < MinRetransmitTimeout) {RetransmitTimeout = MinRetransmitTimeout;}
+        if (RetransmitTimeout > MaxRetransmitTimeout) {RetransmitTimeout = MaxRetransmitTimeout;}
+        CongestionVariables.SmoothedRTT = (SmoothedRTT >> 3) * (1000 / _TICKS_PER_SECOND);
+    }
+
+    void OnRetransmitTimeout()
+    {
+        RetransmitPending = 0;
+        if (State == SYN_SENT || State == SYN_RECEIVED ||
+            SequenceLess(SendSequence.Unacknowledged, SendHighest))
+        {
+            if (++Retransmits > MaxRetransmits)
+            {
+                cprintf((LPSTR)"[TCB] Too many retransmissions, resetting connection.\n");
+                Abort();
+                return;
+            }
+            cprintf((LPSTR)"[TCB] Retransmission timeout (%d), RTO - %d\n",
+                Retransmits, RetransmitTimeout);
+            if (HasSendQueue())
+            {
+                // RFC 5681 3.1, ssthresh is only cut on the first timeout.
+                if (Retransmits == 1)
+                {
+                    CongestionVariables.FlightSize = SendHighest - SendSequence.Unacknowledged;
+                    CongestionVariables.SlowStartThreshold =
+                        Congestion->SlowStartThreshold(CongestionVariables);
+                }
+                CongestionVariables.Window = SendMaxSegmentSize;
+                CongestionVariables.BytesAcked = 0;
+                FastRecovery = 0;
+                DuplicateAcks = 0;
+                RecoveryPoint = SendHighest;
+                RTTTiming = 0;
+                // Go back N, the receiver drops out-of-order segments.
+                SendSequence.Next = SendSequence.Unacknowledged;
+                if (!Output()) {Retransmit();}
+            }
+            else {Retransmit();}
+        }
+        else if (HasSendQueue() && !SendBuffer.empty() && !FlightSize() && !SendSequence.Window)
+        {
+            // Zero window probe (RFC 9293 3.8.6.1)
+            SendSegment(SendSequence.Next, 0, 1, FrameType::ACK);
+            AdvanceSendNext(1);
+        }
+        else {return;}
+
+        RetransmitTimeout *= 2;
+        if (RetransmitTimeout > MaxRetransmitTimeout) {RetransmitTimeout = MaxRetransmitTimeout;}
+        ArmRetransmitTimer();
+    }
+
+    // Give up on a peer that stopped answering, readers and writers wake up
+    // with -7.
+    void Abort()
+    {
+        SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::RST | FrameType::ACK);
+        RetransmitPending = 0;
+        Error = -7;
+        SetState(CLOSED);
+        Notify();
+        if (Orphaned) {Release();}
+    }
+
+    // Arm Timer for Deadline, the caller holds Lock. A pending timer holds
+    // a reference, so the block outlives it. Clearing a pending flag leaves
+    // the timer alone, it finds nothing to do when it runs.
+    void StartTimer(timer* Timer, DWORD Deadline)
+    {
+        if (Index < 0) {return;}
+        Hold();
+        if (timer_add(Timer, Deadline)) {Put();}
+    }
+
+    // The caller holds Lock and a reference of its own. A callback already
+    // running is not waited for, it drops its reference when done.
+    void StopTimer(timer* Timer)
+    {
+        if (timer_detach(Timer)) {Put();}
+    }
+
+    // Timer callback, run in interrupt context with the timer's reference.
+    // The deadline may have moved since it was armed, so the handler checks.
+    template<void (TCB::*Handler)()>
+    static void OnTimer(LPVOID Argument)
+    {
+        TCB* App = static_cast<TCB*>(Argument);
+        acquire(&App->Lock);
+        if (App->Index >= 0) {(App->*Handler)();}
+        App->Unlock();
+        App->Put();
+    }
+
+    void OnRetransmitTimer()
+    {
+        if (State == LISTEN)
+        {
+            OnListenTick();
+            return;
+        }
+        if (RetransmitPending && int(ticks - RetransmitDeadline) >= 0)
+        {
+            OnRetransmitTimeout();
+        }
+    }
+
+    void OnAckTimer()
+    {
+        if (AckPending && int(ticks - AckDeadline) >= 0)
+        {
+            SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
+        }
+    }
+
+    void OnCorkTimer()
+    {
+        if (CorkPending && int(ticks - CorkDeadline) >= 0)
+        {
+            CorkPending = 0;
+            Output(1);
+        }
+    }
+
+    BOOL IsKeepAliveState()const
+    {
+        return State == ESTABLISHED || State == CLOSE_WAIT || State == FIN_WAIT_2;
+    }
+
+    // Next run of OnIdleTimer(), the caller holds Lock. An orphan waits for
+    // the peer's FIN, otherwise keepalive probe n is due n - 1 intervals
+    // after the idle time.
+    void ArmIdleTimer()
+    {
+        if (Orphaned && State == FIN_WAIT_2)
+        {
+            StartTimer(&IdleTimer, FinWaitDeadline);
+        }
+        else if ((OptionFlags & OptionKeepAlive) && IsKeepAliveState())
+        {
+            StartTimer(&IdleTimer, LastReceived + KeepAliveIdle + KeepAliveProbes * KeepAliveInterval);
+        }
+        else {StopTimer(&IdleTimer);}
+    }
+
+    void OnIdleTimer()
+    {
+        if (Orphaned && State == FIN_WAIT_2)
+        {
+            if (int(ticks - FinWaitDeadline) < 0)
+            {
+                ArmIdleTimer();
+                return;
+            }
+            // The peer never closed its side.
+            SetState(CLOSED);
+            Release();
+            return;
+        }
+        if (!(OptionFlags & OptionKeepAlive) || !IsKeepAliveState()) {return;}
+        // Heard from the peer since the timer was set.
+        if (int(ticks - (LastReceived + KeepAliveIdle + KeepAliveProbes * KeepAliveInterval)) < 0)
+        {
+            ArmIdleTimer();
+            return;
+        }
+        // Outstanding data is up to the retransmission timer.
+        if (RetransmitPending)
+        {
+            StartTimer(&IdleTimer, ticks + KeepAliveIdle);
+            return;
+        }
+        if (KeepAliveProbes >= KeepAliveCount)
+        {
+            cprintf((LPSTR)"[TCB] Keepalive timed out, resetting connection.\n");
+            Abort();
+            return;
+        }
+        // SEG.SEQ = SND.NXT - 1 is old, so the peer has to answer.
+        SendControl(SendSequence.Next - 1, ReceiveSequence.Next, FrameType::ACK);
+        ++KeepAliveProbes;
+        ArmIdleTimer();
+    }
+
+    // Delayed ACK, any segment carrying an ACK clears what is owed.
+    void AcknowledgeSent()
+    {
+        LastAcknowledgeSent = Frame->GetAcknowledgementNumber();
+        AckPending = 0;
+        UnackedBytes = 0;
+    }
+
+    // ACK every second full-sized segment, otherwise within 40 ms. Pure
+    // ACKs are skipped if data is sent first and carries the ACK instead.
+    void ScheduleAcknowledge(DWORD Size)
+    {
+        UnackedBytes += Size;
+        if ((OptionFlags & OptionQuickAck) || QuickAcks ||
+            UnackedBytes >= 2 * DWORD(ReceiveMaxSegmentSize))
+        {
+            if (QuickAcks) {--QuickAcks;}
+            SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
+            return;
+        }
+        if (!AckPending)
+        {
+            AckPending = 1;
+            AckDeadline = ticks + DelayedAckTimeout;
+            StartTimer(&AckTimer, AckDeadline);
+        }
+    }
+
+    // Congestion control (RFC 5681, RFC 6582)
+    void InitCongestion()
+    {
+        CongestionVariables.MaxSegmentSize = SendMaxSegmentSize;
+        CongestionVariables.Window = InitialWindowSegments * SendMaxSegmentSize;
+        Congestion->Init(CongestionVariables);
+        DuplicateAcks = 0;
+        FastRecovery = 0;
+    }
+
+    // RFC 5681 2, "DUPLICATE ACKNOWLEDGMENT"
+    BOOL IsDuplicateAcknowledge(const FrameType* TCPFrame)const
+    {
+        return FlightSize() && !TCPFrame->DataSize() &&
+            !(TCPFrame->GetFlags() & (FrameType::SYN | FrameType::FIN)) &&
+            TCPFrame->GetAcknowledgementNumber() == SendSequence.Unacknowledged &&
+            (DWORD(TCPFrame->GetWindow()) << SendWindowScale) == SendSequence.Window;
+    }
+
+    void OnDuplicateAcknowledge()
+    {
+        auto& Variables = CongestionVariables;
+        ++DuplicateAcks;
+        if (FastRecovery)
+        {
+            // Each duplicate means another segment has left the network,
+            // spend it on a SACK hole if there is one.
+            if (!RetransmitHole()) {Variables.Window += SendMaxSegmentSize;}
+            return;
+        }
+        if (DuplicateAcks != DuplicateAckThreshold ||
+            !SequenceLess(RecoveryPoint, SendSequence.Unacknowledged))
+        {
+            return;
+        }
+        cprintf((LPSTR)"[TCB] Fast retransmit: SEQ - 0x%x\n", SendSequence.Unacknowledged);
+        Variables.FlightSize = FlightSize();
+        Variables.SlowStartThreshold = Congestion->SlowStartThreshold(Variables);
+        Variables.BytesAcked = 0;
+        RecoveryPoint = SendHighest;
+        FastRecovery = 1;
+        RetransmitHigh = SendSequence.Unacknowledged;
+        Retransmit();
+        Variables.Window = Variables.SlowStartThreshold + DuplicateAckThreshold * SendMaxSegmentSize;
+    }
+
+    void OnNewAcknowledge(DWORD Acknowledge)
+    {
+        auto& Variables = CongestionVariables;
+        DWORD Acked = Acknowledge - SendSequence.Unacknowledged;
+        // SYN and FIN take sequence space but are not data.
+        DWORD AckedData = Acked < SendBuffer.size() ? Acked : SendBuffer.size();
+        if (!SampleTimestamp()) {SampleRoundTrip(Acknowledge);}
+        AcknowledgeSendBuffer(Acknowledge);
+        Sacked.TrimBelow(Acknowledge);
+        if (SequenceLess(SendSequence.Next, Acknowledge)) {SendSequence.Next = Acknowledge;}
+
+        if (FastRecovery)
+        {
+            if (SequenceLessEqual(RecoveryPoint, Acknowledge))
+            {
+                // Full acknowledgment (RFC 6582 3.2 step 3)
+                DWORD Flight = FlightSize() > SendMaxSegmentSize ? FlightSize() : SendMaxSegmentSize;
+                Flight += SendMaxSegmentSize;
+                Variables.Window = Variables.SlowStartThreshold < Flight ?
+                    Variables.SlowStartThreshold : Flight;
+                FastRecovery = 0;
+            }
+            else
+            {
+                // Partial acknowledgment, the next hole is lost as well.
+                if (!RetransmitHole()) {Retransmit();}
+                Variables.Window = Variables.Window > AckedData ? Variables.Window - AckedData : 0;
+                if (AckedData >= SendMaxSegmentSize) {Variables.Window += SendMaxSegmentSize;}
+                if (Variables.Window < SendMaxSegmentSize) {Variables.Window = SendMaxSegmentSize;}
+            }
+        }
+        else if (Variables.Window < Variables.SlowStartThreshold)
+        {
+            // Slow start (RFC 5681 3.1, L = 1 SMSS)
+            Variables.Window += AckedData < SendMaxSegmentSize ? AckedData : SendMaxSegmentSize;
+        }
+        else if (AckedData)
+        {
+            Variables.FlightSize = FlightSize();
+            Congestion->CongestionAvoidance(Variables, AckedData);
+        }
+
+        DuplicateAcks = 0;
+        Retransmits = 0;
+        if (SendHighest != SendSequence.Unacknowledged) {ArmRetransmitTimer();}
+        else {RetransmitPending = 0;}
+    }
+
+    // SND.UNA moved forward to Acknowledge, release the covered bytes.
+    void AcknowledgeSendBuffer(DWORD Acknowledge)
+    {
+        DWORD Acked = Acknowledge - SendSequence.Unacknowledged;
+        SendBuffer.Discard(Acked < SendBuffer.size() ? Acked : SendBuffer.size());
+        SendSequence.Unacknowledged = Acknowledge;
+        Notify();
+    }
+
+    // RFC 9293 3.10.7.4, SND.WL1/SND.WL2 guard against old segments.
+    void UpdateSendWindow(const FrameType* TCPFrame)
+    {
+        DWORD Sequence = TCPFrame->GetSequenceNumber();
+        DWORD Acknowledge = TCPFrame->GetAcknowledgementNumber();
+        if (SequenceLess(SendSequence.SequenceNumber, Sequence) ||
+            (SendSequence.SequenceNumber == Sequence &&
+            SequenceLessEqual(SendSequence.AcknowledgmentNumber, Acknowledge)))
+        {
+            SendSequence.Window = DWORD(TCPFrame->GetWindow()) << SendWindowScale;
+            SendSequence.SequenceNumber = Sequence;
+            SendSequence.AcknowledgmentNumber = Acknowledge;
+        }
+    }
+
+    // Called when a SYN is seen, records the peer's window and MSS.
+    void AcceptSynParameters(const FrameType* TCPFrame)
+    {
+        SegmentOptions& Options = Received;
+        Options = SegmentOptions();
+        ParseOptions(TCPFrame, Options);
+        SendMaxSegmentSize = Options.MaxSegmentSize ?
+            Options.MaxSegmentSize : DefMaxSegmentSize;
+        if (SendMaxSegmentSize > MaxSegmentSize) {SendMaxSegmentSize = MaxSegmentSize;}
+        // The option takes room from every segment (RFC 7323 4.2).
+        Timestamps = Options.HasTimestamp;
+        if (Timestamps)
+        {
+            SendMaxSegmentSize -= TimestampOptionSize;
+            RecentTimestamp = Options.TimestampValue;
+            RecentTimestampTime = ticks;
+        }
+        InitCongestion();
+        SackPermitted = Options.SackPermitted;
+        WindowScaling = Options.HasWindowScale;
+        SendWindowScale = WindowScaling ? Options.WindowScale : 0;
+        ReceiveWindowScale = WindowScaling ? ComputeWindowScale() : 0;
+        SendSequence.Window = TCPFrame->GetWindow();
+        SendSequence.SequenceNumber = TCPFrame->GetSequenceNumber();
+        SendSequence.AcknowledgmentNumber = TCPFrame->GetAcknowledgementNumber();
+    }
+
+    // Static functions
+    static int Open()
+    {
+        cprintf((LPSTR)"[TCB] TCB Starting...\n");
+        FrameType::AcquireLock();
+        TCB* App = Allocate();
+        if (!App)
+        {
+            FrameType::ReleaseLock();
+            return -1;
+        }
+        int Index = App->Index;
+        FrameType::ReleaseLock();
+        cprintf((LPSTR)"[TCB] TCB Started at %d\n", Index);
+        return Index;
+    }
+
+    static int Close(int Index)
+    {
+        cprintf((LPSTR)"[TCB] TCB %d - Stopping...\n", Index);
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -2;}
+        acquire(&CurrentApp->Lock);
+
+        // FIN must follow every byte already queued by Transmit().
+        while (CurrentApp->IsReadyForTranssmission() &&
+            CurrentApp->FlightSize() < CurrentApp->SendBuffer.size())
+        {
+            CurrentApp->Output(1);
+            if (CurrentApp->FlightSize() < CurrentApp->SendBuffer.size())
+            {
+                CurrentApp->Wait();
+            }
+        }
+
+        switch (CurrentApp->GetState())
+        {
+        case SYN_RECEIVED:
+        case ESTABLISHED:
+            CurrentApp->SendFinish();
+            CurrentApp->SetState(FIN_WAIT_1);
+            while (CurrentApp->GetState() == FIN_WAIT_1) {CurrentApp->Wait();}
+            break;
+        case CLOSE_WAIT:
+            CurrentApp->SendFinish();
+            CurrentApp->SetState(LAST_ACK);
+            while (CurrentApp->GetState() == LAST_ACK) {CurrentApp->Wait();}
+            break;
+        default:
+            break;
+        }
+        BOOL Listening = CurrentApp->GetState() == LISTEN;
+        if (Listening)
+        {
+            // Half-open connections are forgotten, Accept() returns.
+            CurrentApp->DropRequests();
+            CurrentApp->SetState(CLOSED);
+            CurrentApp->Notify();
+        }
+        if (CurrentApp->GetState() == FIN_WAIT_2 || CurrentApp->GetState() == CLOSING)
+        {
+            // Waiting for the peer's FIN is left to the block itself.
+            CurrentApp->Orphaned = 1;
+            CurrentApp->FinWaitDeadline = ticks + FinWait2Timeout;
+            CurrentApp->ArmIdleTimer();
+        }
+        else {CurrentApp->Release();}
+        CurrentApp->Unlock();
+        if (Listening) {CurrentApp->ReleaseUnaccepted();}
+        CurrentApp->Put();
+        cprintf((LPSTR)"[TCB] TCB %d - Stopped\n", Index);
+        return 0;
+    }
+
+    static int Bind(int Index, DWORD Address, WORD Port)
+    {
+        cprintf((LPSTR)"[TCB] Binding TCB %d to port %d\n", Index, Port);
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        if (Address && IP::IPFind(Address) == IP::AdapterIPAddressTable.end())
+        {
+            CurrentApp->Put();
+            return -4;
+        }
+        acquire(&CurrentApp->Lock);
+        if (CurrentApp->GetState() != CLOSED)
+        {
+            CurrentApp->Unlock();
+            CurrentApp->Put();
+            return -3;
+        }
+        // TCPLock keeps the conflict check and the insertion together.
+        // Sockets that all set OptionReusePort may share an address and
+        // port, LookupListener() spreads connections over them.
+        FrameType::AcquireLock();
+        BOOL Reuse = CurrentApp->OptionFlags & OptionReusePort;
+        auto Conflict = FrameType::ListenTable.Find(ListenHash(Port), [&](const TCB& App)
+        {
+            return &App != CurrentApp && App.LocalPort == Port &&
+                (!App.LocalAddress || !Address || App.LocalAddress == Address) &&
+                !(Reuse && (App.OptionFlags & OptionReusePort) && App.LocalAddress == Address);
+        });
+        if (Conflict || IsPortAllocated(Port))
+        {
+            FrameType::ReleaseLock();
+            CurrentApp->Unlock();
+            CurrentApp->Put();
+            return -2;
+        }
+        CurrentApp->Unhash();
+        CurrentApp->LocalAddress = Address;
+        CurrentApp->LocalPort = Port;
+        CurrentApp->GetFrame()->SetSourcePort(Port);
+        CurrentApp->HashBound();
+        FrameType::ReleaseLock();
+        cprintf((LPSTR)"[TCB] TCB %d - Current port is %d\n", Index,
+            CurrentApp->GetFrame()->GetSourcePort());
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return 0;
+    }
+
+    static int Listen(int Index, int Backlog)
+    {
+        cprintf((LPSTR)"[TCB] TCB %d - Starting listen... (%d)\n", Index, Backlog);
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int ReturnValue = 0;
+        if (CurrentApp->GetState() != CLOSED || !CurrentApp->LocalPort) {ReturnValue = -3;}
+        else
+        {
+            if (Backlog < 1) {Backlog = 1;}
+            if (Backlog > MaxBacklog) {Backlog = MaxBacklog;}
+            CurrentApp->Backlog = Backlog;
+            CurrentApp->SetState(LISTEN);
+        }
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return ReturnValue;
+    }
+
+    static int SetCongestionControl(int Index, CongestionControl* Algorithm)
+    {
+        if (!Algorithm) {return -1;}
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        CurrentApp->Congestion = Algorithm;
+        Algorithm->Init(CurrentApp->CongestionVariables);
+        cprintf((LPSTR)"[TCB] TCB %d - Congestion control: %s\n", Index, Algorithm->Name());
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return 0;
+    }
+
+    static int SetOptionFlag(int Index, DWORD Flag, BOOL Enable)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        if (Enable) {CurrentApp->OptionFlags |= Flag;}
+        else {CurrentApp->OptionFlags &= ~Flag;}
+        // Nothing may stay delayed once quick ACKs are turned on.
+        if ((Flag & OptionQuickAck) && Enable && CurrentApp->AckPending)
+        {
+            CurrentApp->SendControl(CurrentApp->SendSequence.Next,
+                CurrentApp->ReceiveSequence.Next, FrameType::ACK);
+        }
+        // Uncorking pushes what was held back, as does disabling Nagle.
+        if ((Flag & OptionCork) && !Enable) {CurrentApp->Output(1);}
+        else if ((Flag & OptionNoDelay) && Enable) {CurrentApp->Output();}
+        if (Flag & OptionKeepAlive) {CurrentApp->ArmIdleTimer();}
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return 0;
+    }
+
+    // Keepalive parameters, times in seconds. A negative value leaves the
+    // parameter as it is.
+    static int SetKeepAlive(int Index, int Idle, int Interval, int Count)
+    {
+        if (!Idle || !Interval || !Count || Idle > MaxKeepAliveTime ||
+            Interval > MaxKeepAliveTime || Count > MaxKeepAliveCount)
+        {
+            return -1;
+        }
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        if (Idle > 0) {CurrentApp->KeepAliveIdle = Idle * _TICKS_PER_SECOND;}
+        if (Interval > 0) {CurrentApp->KeepAliveInterval = Interval * _TICKS_PER_SECOND;}
+        if (Count > 0) {CurrentApp->KeepAliveCount = Count;}
+        CurrentApp->ArmIdleTimer();
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return 0;
+    }
+
+    // Active open, sleeps until the handshake is over. Returns 0 once
+    // connected, -2 if the 4-tuple is taken, -5 without a route or address
+    // and -6 if the peer refused or never answered. Without blocking the
+    // SYN goes out and FINPROGRESS comes back; poll() reports POLLOUT, or
+    // POLLERR on failure, and calling Connect() again gives the outcome.
+    static int Connect(int Index, DWORD DestinationAddress, WORD DestinationPort, BOOL NonBlocking)
+    {
+        if (!DestinationAddress || !DestinationPort) {return -4;}
+        cprintf((LPSTR)"[TCB] TCB %d - Connecting to port %d...\n", Index, DestinationPort);
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int ReturnValue;
+        if (CurrentApp->Connecting) {ReturnValue = CurrentApp->FinishConnect(NonBlocking);}
+        else
+        {
+            CurrentApp->ConnectBoundAddress = CurrentApp->LocalAddress;
+            ReturnValue = CurrentApp->OpenConnection(DestinationAddress, DestinationPort);
+            if (!ReturnValue)
+            {
+                CurrentApp->Connecting = 1;
+                ReturnValue = CurrentApp->FinishConnect(NonBlocking);
+            }
+        }
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return ReturnValue;
+    }
+
+    // FWOULDBLOCK if nothing is queued and the caller cannot wait.
+    static int Accept(int Index, DWORD* DestinationAddress, WORD* DestinationPort, BOOL NonBlocking)
+    {
+        cprintf((LPSTR)"[TCB] TCB %d - Waiting for accept...\n", Index);
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+
+        TCB<4>* CurrentLog = nullptr;
+        while (CurrentApp->GetState() == LISTEN)
+        {
+            if (!CurrentApp->ReceiveQueue.empty())
+            {
+                CurrentLog = CurrentApp->ReceiveQueue.front();
+                CurrentApp->ReceiveQueue.pop();
+                break;
+            }
+            else if (NonBlocking) {break;}
+            else {CurrentApp->Wait();}
+        }
+        int Listening = CurrentApp->GetState() == LISTEN;
+        CurrentApp->Unlock();
+        if (!CurrentLog)
+        {
+            CurrentApp->Put();
+            return Listening ? FWOULDBLOCK : -3;
+        }
+
+        acquire(&CurrentLog->Lock);
+        // Owned by the new socket from now on.
+        if (CurrentLog->ParentBody)
+        {
+            CurrentLog->ParentBody->Put();
+            CurrentLog->ParentBody = nullptr;
+        }
+        DWORD Address = CurrentLog->RemoteAddress;
+        WORD Port = CurrentLog->RemotePort;
+        int NewIndex = CurrentLog->Index;
+        CurrentLog->Unlock();
+        CurrentApp->Put();
+
+        if (DestinationAddress) {*DestinationAddress = Address;}
+        if (DestinationPort) {*DestinationPort = Port;}
+        int IP1, IP2, Ip3, IP4;
+        IP::IPSplit(Address, IP1, IP2, Ip3, IP4);
+        cprintf((LPSTR)"[TCB] TCB %d - %d.%d.%d.%d:%d connected\n",
+            Index, IP1, IP2, Ip3, IP4, Port);
+        return NewIndex;
+    }
+
+    static int Receive(int Index, LPVOID Destination, int Size, BOOL NonBlocking)
+    {
+        if (Size < 0) {return -1;}
+        iovec Vector = {Destination, uintp(Size)};
+        return ReceiveVector(Index, &Vector, 1, NonBlocking);
+    }
+
+    // Waits for data while the connection can still deliver some, which
+    // includes one still being opened by a non-blocking Connect(). Without
+    // blocking that case is FWOULDBLOCK instead. What is there is scattered
+    // over the vectors straight from the receive buffer.
+    static int ReceiveVector(int Index, const iovec* Vectors, int Count, BOOL NonBlocking)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -1;}
+        acquire(&CurrentApp->Lock);
+
+        int TrueDataSize = 0;
+        while (CurrentApp->ReceiveBuffer.empty() && !NonBlocking &&
+            (CurrentApp->IsReadyForReception() || CurrentApp->IsOpening()))
+        {
+            CurrentApp->Wait();
+        }
+        if (!CurrentApp->ReceiveBuffer.empty())
+        {
+            for (int i = 0; i < Count && !CurrentApp->ReceiveBuffer.empty(); ++i)
+            {
+                TrueDataSize += CurrentApp->ReceiveBuffer.Read(Vectors[i].iov_base, Vectors[i].iov_len);
+            }
+            if (CurrentApp->IsReadyForReception()) {CurrentApp->UpdateReceiveWindow();}
+        }
+        else if (CurrentApp->Error)
+        {
+            TrueDataSize = CurrentApp->Error;
+            CurrentApp->Error = 0;
+        }
+        else if (CurrentApp->IsReadyForReception() || CurrentApp->IsOpening())
+        {
+            TrueDataSize = FWOULDBLOCK;
+        }
+
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return TrueDataSize;
+    }
+
+    // Readiness as poll() events. A listener is readable with a connection
+    // to accept; a connection with data, or at its end once the peer
+    // finished or reset it. Connections still opening are neither.
+    static int Poll(int Index)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return POLLNVAL;}
+        acquire(&CurrentApp->Lock);
+
+        int Events = 0;
+        if (CurrentApp->GetState() == LISTEN)
+        {
+            if (!CurrentApp->ReceiveQueue.empty()) {Events |= POLLIN;}
+        }
+        else
+        {
+            BOOL Opening = CurrentApp->IsOpening();
+            BOOL Receiving = Opening || CurrentApp->IsReadyForReception();
+            if (!CurrentApp->ReceiveBuffer.empty() || !Receiving) {Events |= POLLIN;}
+            if (CurrentApp->IsReadyForTranssmission() && CurrentApp->SendBuffer.available())
+            {
+                Events |= POLLOUT;
+            }
+            if (!Receiving && !CurrentApp->IsReadyForTranssmission()) {Events |= POLLHUP;}
+        }
+        if (CurrentApp->Error) {Events |= POLLERR;}
+
+        release(&CurrentApp->Lock);
+        CurrentApp->Put();
+        return Events;
+    }
+
+    // The block stays until its socket is closed, and so does the queue.
+    static pollqueue* GetPollQueue(int Index)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return nullptr;}
+        pollqueue* Queue = &CurrentApp->PollQueue;
+        CurrentApp->Put();
+        return Queue;
+    }
+
+    static int GetReceiveBufferSize(int Index)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int Size = CurrentApp->ReceiveBufferSize;
+        release(&CurrentApp->Lock);
+        CurrentApp->Put();
+        return Size;
+    }
+
+    // Bytes charged to the block, see NetMemory.
+    static int GetMemory(int Index)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int Memory = CurrentApp->Charged;
+        release(&CurrentApp->Lock);
+        CurrentApp->Put();
+        return Memory;
+    }
+
+    static int SetReceiveBufferSize(int Index, int Size)
+    {
+        if (Size < MinReceiveBufferSize) {Size = MinReceiveBufferSize;}
+        if (Size > MaxReceiveBufferSize) {Size = MaxReceiveBufferSize;}
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int ReturnValue = -3;
+        // The window scale is fixed by the SYN, so only before connecting.
+        if (CurrentApp->GetState() == CLOSED || CurrentApp->GetState() == LISTEN)
+        {
+            ReturnValue = CurrentApp->CreateReceiveBuffer(Size) ? 0 : -4;
+        }
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return ReturnValue;
+    }
+
+    static int Transmit(int Index, LPCVOID Data, int Size, BOOL NonBlocking)
+    {
+        if (Size < 0) {return -1;}
+        iovec Vector = {(LPVOID)Data, uintp(Size)};
+        return TransmitVector(Index, &Vector, 1, NonBlocking);
+    }
+
+    // The vectors are gathered into the send buffer before Output() runs,
+    // so a header and its payload leave in the same segment. Without
+    // blocking only what fits into the send buffer is taken, and
+    // FWOULDBLOCK comes back if that is nothing.
+    static int TransmitVector(int Index, const iovec* Vectors, int Count, BOOL NonBlocking)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int ReturnValue = CurrentApp->AwaitTransmission(NonBlocking);
+        if (ReturnValue)
+        {
+            CurrentApp->Unlock();
+            CurrentApp->Put();
+            return ReturnValue;
+        }
+
+        int Size = 0;
+        for (int i = 0; i < Count; ++i) {Size += Vectors[i].iov_len;}
+        int Written = 0;
+        int Vector = 0;
+        uintp Offset = 0;
+        while (Written < Size)
+        {
+            while (Vector < Count)
+            {
+                int Taken = CurrentApp->SendBuffer.Write(
+                    (const BYTE*)Vectors[Vector].iov_base + Offset, Vectors[Vector].iov_len - Offset);
+                Written += Taken;
+                Offset += Taken;
+                if (Offset < Vectors[Vector].iov_len) {break;} // Send buffer full
+                ++Vector;
+                Offset = 0;
+            }
+            CurrentApp->Output();
+            if (Written == Size || NonBlocking) {break;}
+            // Send buffer full, wait for ACKs to make room.
+            CurrentApp->Wait();
+            while (CurrentApp->Filling) {CurrentApp->Wait();}
+            if (!CurrentApp->IsReadyForTranssmission()) {break;}
+        }
+        if (NonBlocking && !Written && Size) {Written = FWOULDBLOCK;}
+
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return Written;
+    }
+
+    // Source of TransmitFill(): stores up to Size bytes, those at Offset
+    // into the transfer, at Destination. Returns the count stored, fewer
+    // at the end of the source, or a negative value on failure.
+    typedef int (*FillFunction)(LPVOID Context, BYTE* Destination, int Offset, int Size);
+
+    // sendfile(): Size bytes from Fill() go straight into the free space of
+    // the send buffer, one page at a time. Lock is dropped around Fill() as
+    // it may sleep on the disk, Filling keeps other senders out meanwhile.
+    // Returns the count queued, which is short if the source ran out.
+    static int TransmitFill(int Index, int Size, BOOL NonBlocking, FillFunction Fill, LPVOID Context)
+    {
+        auto CurrentApp = Get(Index);
+        if (!CurrentApp) {return -3;}
+        acquire(&CurrentApp->Lock);
+        int ReturnValue = CurrentApp->AwaitTransmission(NonBlocking);
+        int Sent = 0;
+        while (!ReturnValue && Sent < Size)
+        {
+            if (!CurrentApp->SendBuffer.available())
+            {
+                if (NonBlocking) {break;}
+                CurrentApp->Wait();
+                while (CurrentApp->Filling) {CurrentApp->Wait();}
+                if (!CurrentApp->IsReadyForTranssmission()) {break;}
+                continue;
+            }
+            typename decltype(SendBuffer)::size_type Run = Size - Sent;
+            BYTE* Destination = CurrentApp->SendBuffer.Reserve(0, Run);
+            CurrentApp->Filling = 1;
+            CurrentApp->Unlock();
+            int Filled = Fill(Context, Destination, Sent, Run);
+            acquire(&CurrentApp->Lock);
+            CurrentApp->Filling = 0;
+            if (Filled > 0)
+            {
+                CurrentApp->SendBuffer.Commit(Filled);
+                Sent += Filled;
+                CurrentApp->Output();
+            }
+            CurrentApp->Notify();
+            if (Filled < 0 && !Sent) {ReturnValue = Filled;}
+            if (Filled < (int)Run) {break;}
+        }
+        if (!ReturnValue && NonBlocking && !Sent && Size) {ReturnValue = FWOULDBLOCK;}
+
+        CurrentApp->Unlock();
+        CurrentApp->Put();
+        return Sent ? Sent : ReturnValue;
+    }
+
+    // Event functions
+    void DoClosed(const FrameType* TCPFrame)
+    {
+        cprintf((LPSTR)"[TCB] Current state: CLOSED\n");
+        if (TCPFrame->GetFlags() & FrameType::RST){return;}
+        DWORD Sequence, Acknowledge;
         if (TCPFrame->GetFlags() & FrameType::ACK)
         {
             Sequence = TCPFrame->GetAcknowledgementNumber();
@@ -777,32 +2739,350 @@ public:
         SendControl(Sequence, Acknowledge, FrameType::RST);
     }
 
-    void DoListen(const FrameType* TCPFrame)
+    // What a SecretHash() is for, so one use cannot stand in for another.
+    enum SecretPurpose {SecretSequence, SecretCookie, SecretTimestamp, SecretPort};
+
+    static void InitSecret() {GatherEntropy(Secret);}
+
+    static QWORD SecretHash(SecretPurpose Purpose, DWORD LocalAddress, WORD LocalPort,
+        DWORD RemoteAddress, WORD RemotePort, QWORD Extra = 0)
     {
-        cprintf((LPSTR)"[TCB] Current state: LISTEN\n");
-        if (TCPFrame->GetFlags() & FrameType::RST){return;}
-        DWORD Sequence, Acknowledge;
-        if (TCPFrame->GetFlags() & FrameType::ACK)
+        QWORD Words[3] = {(QWORD(LocalAddress) << 32) | RemoteAddress,
+            (QWORD((DWORD(LocalPort) << 16) | RemotePort) << 32) | Purpose, Extra};
+        return SipHash(Secret, Words, 3);
+    }
+
+    // RFC 6528: a 4 microsecond clock plus a keyed hash of the 4-tuple.
+    // Each connection gets its own sequence space, and a new incarnation
+    // of one starts above where the old one did.
+    static DWORD GenerateSequenceNumber(DWORD LocalAddress, WORD LocalPort,
+        DWORD RemoteAddress, WORD RemotePort)
+    {
+        DWORD Clock = DWORD(ticks * (1000000 / 4 / _TICKS_PER_SECOND));
+        return Clock + DWORD(SecretHash(SecretSequence, LocalAddress, LocalPort,
+            RemoteAddress, RemotePort));
+    }
+
+    static DWORD CookieCount() {return (ticks / CookiePeriod) & 31;}
+
+    // Random per address pair, so TSval keeps growing across incarnations
+    // of a connection (RFC 7323 5.4) without exposing the uptime.
+    static DWORD TimestampOffsetFor(DWORD LocalAddress, DWORD RemoteAddress)
+    {
+        return DWORD(SecretHash(SecretTimestamp, LocalAddress, 0, RemoteAddress, 0));
+    }
+
+    DWORD TimestampNow()const {return ticks + TimestampOffset;}
+
+    // SYN cookie (RFC 4987 3.6): 5 bits of time, 3 bits of MSS index and a
+    // 24 bit MAC, SipHash over the connection, the peer's ISN, the time
+    // and the MSS index, truncated.
+    static DWORD SynCookie(const SynRequest& Request, WORD LocalPort, DWORD Count, DWORD Index)
+    {
+        QWORD Extra = (QWORD(Request.InitialReceiveSequenceNumber) << 32) | (Count << 8) | Index;
+        DWORD Mac = DWORD(SecretHash(SecretCookie, Request.LocalAddress, LocalPort,
+            Request.RemoteAddress, Request.RemotePort, Extra));
+        return (Count << 27) | (Index << 24) | (Mac & 0xFFFFFF);
+    }
+
+    // Options and addresses of a SYN sent to this listener.
+    void ParseSynRequest(NetworkAdapter* Device, const FrameType* TCPFrame,
+        SynRequest& Request)const
+    {
+        SegmentOptions Options;
+        ParseOptions(TCPFrame, Options);
+        Request.Next = nullptr;
+        Request.Device = Device;
+        Request.LocalAddress = TCPFrame->GetDestinationAddress();
+        Request.RemoteAddress = TCPFrame->GetSourceAddress();
+        Request.RemotePort = TCPFrame->GetSourcePort();
+        Request.Window = TCPFrame->GetWindow();
+        Request.MaxSegmentSize = Options.MaxSegmentSize ?
+            Options.MaxSegmentSize : DefMaxSegmentSize;
+        if (Request.MaxSegmentSize > MaxSegmentSize) {Request.MaxSegmentSize = MaxSegmentSize;}
+        Request.WindowScaling = Options.HasWindowScale;
+        Request.SendWindowScale = Options.HasWindowScale ? Options.WindowScale : 0;
+        Request.ReceiveWindowScale = Options.HasWindowScale ? ComputeWindowScale() : 0;
+        Request.SackPermitted = Options.SackPermitted;
+        Request.Timestamps = Options.HasTimestamp;
+        Request.RecentTimestamp = Options.TimestampValue;
+        Request.TimestampOffset = TimestampOffsetFor(Request.LocalAddress, Request.RemoteAddress);
+        Request.InitialReceiveSequenceNumber = TCPFrame->GetSequenceNumber();
+        Request.InitialSendSequenceNumber = 0;
+        Request.SentAt = ticks;
+        Request.Deadline = ticks + InitialRetransmitTimeout;
+        Request.Retransmits = 0;
+    }
+
+    // Answers from a listener go to whoever sent the segment.
+    void ReplyTo(DWORD Address, WORD Port)
+    {
+        Frame->SetDestinationAddress(Address);
+        Frame->SetDestinationPort(Port);
+    }
+
+    int SendSynAcknowledge(const SynRequest& Request)
+    {
+        ReplyTo(Request.RemoteAddress, Request.RemotePort);
+        Frame->SetSequenceNumber(Request.InitialSendSequenceNumber);
+        Frame->SetAcknowledgementNumber(Request.InitialReceiveSequenceNumber + 1);
+        Frame->SetFlags(FrameType::SYN | FrameType::ACK);
+        DWORD Window = ReceiveBuffer.capacity();
+        Frame->SetWindow(WORD(Window > 0xFFFF ? 0xFFFF : Window));
+        BYTE Options[FrameType::HeaderSizeMax - FrameType::HeaderSizeMin];
+        int OptionSize = BuildSynOptions(Options, FrameType::SYN | FrameType::ACK,
+            Request.SackPermitted, Request.WindowScaling, Request.ReceiveWindowScale,
+            Request.Timestamps, ticks + Request.TimestampOffset, Request.RecentTimestamp);
+        Frame->SetOptions(Options, OptionSize);
+        UpdateRouteData();
+        int ReturnValue = Iface ? Queue(1) : -1;
+        Frame->SetOptions(nullptr, 0);
+        return ReturnValue;
+    }
+
+    SynRequest** FindRequest(DWORD LocalAddress, DWORD RemoteAddress, WORD RemotePort)
+    {
+        for (SynRequest** Link = &HalfOpen; *Link; Link = &(*Link)->Next)
         {
-            Sequence = TCPFrame->GetAcknowledgementNumber();
-            Acknowledge = 0;
-            SendControl(Sequence, Acknowledge, FrameType::RST);
+            if ((*Link)->RemotePort == RemotePort && (*Link)->RemoteAddress == RemoteAddress &&
+                (*Link)->LocalAddress == LocalAddress)
+            {
+                return Link;
+            }
+        }
+        return nullptr;
+    }
+
+    void DropRequest(SynRequest** Link)
+    {
+        SynRequest* Request = *Link;
+        *Link = Request->Next;
+        --HalfOpenCount;
+        RequestPool.Delete(Request);
+    }
+
+    void DropRequests()
+    {
+        while (HalfOpen) {DropRequest(&HalfOpen);}
+    }
+
+    DWORD HalfOpenLimit()const {return Backlog > MinHalfOpen ? Backlog : MinHalfOpen;}
+
+    // The retransmission timer of a listener runs at the earliest SYN-ACK
+    // that is due.
+    void ArmListenTimer(DWORD Deadline)
+    {
+        if (RetransmitPending && !SequenceLess(Deadline, RetransmitDeadline)) {return;}
+        RetransmitDeadline = Deadline;
+        RetransmitPending = 1;
+        StartTimer(&RetransmitTimer, Deadline);
+    }
+
+    // Resend SYN-ACKs that were not answered, the peer's retransmitted SYN
+    // is answered at once instead.
+    void OnListenTick()
+    {
+        RetransmitPending = 0;
+        for (SynRequest** Link = &HalfOpen; *Link;)
+        {
+            SynRequest* Request = *Link;
+            if (int(ticks - Request->Deadline) >= 0)
+            {
+                if (++Request->Retransmits > MaxSynRetransmits)
+                {
+                    DropRequest(Link);
+                    continue;
+                }
+                SendSynAcknowledge(*Request);
+                DWORD Timeout = InitialRetransmitTimeout << Request->Retransmits;
+                Request->Deadline = ticks + (Timeout < MaxRetransmitTimeout ? Timeout : MaxRetransmitTimeout);
+            }
+            ArmListenTimer(Request->Deadline);
+            Link = &Request->Next;
+        }
+    }
+
+    void OnSyn(NetworkAdapter* Device, const FrameType* TCPFrame)
+    {
+        // Without room to accept, the peer's SYN retransmission tries again.
+        if (ReceiveQueue.size() >= Backlog)
+        {
+            cprintf((LPSTR)"[TCB] Accept queue full, dropping SYN.\n");
             return;
         }
-        if (TCPFrame->GetFlags() & FrameType::SYN)
+        SynRequest** Link = FindRequest(TCPFrame->GetDestinationAddress(),
+            TCPFrame->GetSourceAddress(), TCPFrame->GetSourcePort());
+        if (Link)
         {
-            ReceiveSequence.Next = TCPFrame->GetSequenceNumber() + 1;
-            InitialReceiveSequenceNumber = TCPFrame->GetSequenceNumber();
-            mt19937l* Engine = new mt19937l(time(nullptr));
-            InitialSendSequenceNumber = Engine->Gen();
-            delete Engine;
-            Sequence = InitialSendSequenceNumber;
-            Acknowledge = ReceiveSequence.Next;
-            SendControl(Sequence, Acknowledge, FrameType::SYN | FrameType::ACK);
-            SendSequence.Next = InitialSendSequenceNumber + 1;
-            SendSequence.Unacknowledged = InitialSendSequenceNumber;
-            SetState(SYN_RECEIVED);
+            if ((*Link)->InitialReceiveSequenceNumber == TCPFrame->GetSequenceNumber())
+            {
+                SendSynAcknowledge(**Link);
+            }
+            return;
+        }
+
+        SynRequest Request;
+        ParseSynRequest(Device, TCPFrame, Request);
+        SynRequest* Entry = HalfOpenCount < HalfOpenLimit() ? RequestPool.New() : nullptr;
+        if (Entry)
+        {
+            Request.InitialSendSequenceNumber = GenerateSequenceNumber(Request.LocalAddress,
+                LocalPort, Request.RemoteAddress, Request.RemotePort);
+            *Entry = Request;
+            Entry->Next = HalfOpen;
+            HalfOpen = Entry;
+            ++HalfOpenCount;
+            SendSynAcknowledge(*Entry);
+            ArmListenTimer(Entry->Deadline);
+            return;
+        }
+
+        // SYN-RECEIVED table full, keep no state at all. Window scaling,
+        // SACK and timestamps do not fit in the cookie.
+        DWORD Index = 0;
+        while (Index + 1 < sizeof(CookieSegmentSizes) / sizeof(WORD) &&
+            CookieSegmentSizes[Index + 1] <= Request.MaxSegmentSize) {++Index;}
+        Request.InitialSendSequenceNumber = SynCookie(Request, LocalPort, CookieCount(), Index);
+        Request.WindowScaling = 0;
+        Request.SendWindowScale = 0;
+        Request.ReceiveWindowScale = 0;
+        Request.SackPermitted = 0;
+        Request.Timestamps = 0;
+        LastCookie = ticks;
+        CookiesSent = 1;
+        SendSynAcknowledge(Request);
+    }
+
+    // Rebuild the request an ACK answers from its SYN cookie.
+    BOOL CheckCookie(NetworkAdapter* Device, const FrameType* TCPFrame, SynRequest& Request)
+    {
+        if (!CookiesSent || DWORD(ticks - LastCookie) >= 2 * CookiePeriod) {return 0;}
+        DWORD Cookie = TCPFrame->GetAcknowledgementNumber() - 1;
+        DWORD Count = Cookie >> 27;
+        DWORD Index = (Cookie >> 24) & 7;
+        if (((CookieCount() - Count) & 31) > 1 ||
+            Index >= sizeof(CookieSegmentSizes) / sizeof(WORD))
+        {
+            return 0;
+        }
+        ParseSynRequest(Device, TCPFrame, Request);
+        Request.InitialReceiveSequenceNumber = TCPFrame->GetSequenceNumber() - 1;
+        if (SynCookie(Request, LocalPort, Count, Index) != Cookie) {return 0;}
+        Request.InitialSendSequenceNumber = Cookie;
+        Request.MaxSegmentSize = CookieSegmentSizes[Index];
+        Request.WindowScaling = 0;
+        Request.SendWindowScale = 0;
+        Request.ReceiveWindowScale = 0;
+        Request.SackPermitted = 0;
+        Request.Timestamps = 0;
+        Request.Retransmits = 1; // No RTT sample
+        return 1;
+    }
+
+    // Handshake a listener finished, nothing is locked. The new connection
+    // is returned held, nullptr if it could not be queued for Accept().
+    TCB* CreateChild(const SynRequest& Request)
+    {
+        FrameType::AcquireLock();
+        TCB* App = Allocate();
+        if (App) {App->Hold();}
+        FrameType::ReleaseLock();
+        if (!App)
+        {
+            cprintf((LPSTR)"[TCB] No free TCB, dropping connection.\n");
+            return nullptr;
+        }
+
+        acquire(&App->Lock);
+        App->Establish(this, Request);
+        // A cookie ACK may have been processed on another CPU meanwhile.
+        TCB* Existing = App->HashConnection();
+        if (Existing)
+        {
+            App->Release();
+            App->Unlock();
+            App->Put();
+            return Existing;
+        }
+
+        acquire(&Lock);
+        if (State == LISTEN && ReceiveQueue.size() < Backlog && ReceiveQueue.push(App))
+        {
+            Notify();
+            release(&Lock);
+            App->Unlock();
+            return App;
+        }
+        release(&Lock);
+        App->SendControl(App->SendSequence.Next, App->ReceiveSequence.Next,
+            FrameType::RST | FrameType::ACK);
+        App->SetState(CLOSED);
+        App->Release();
+        App->Unlock();
+        App->Put();
+        return nullptr;
+    }
+
+    // Segment for a listener that matched no connection (RFC 9293 3.10.7.2).
+    // The listener is held, not locked. A completed handshake returns its
+    // new connection held, which then takes the segment like any other.
+    TCB* ListenInput(NetworkAdapter* Device, const FrameType* TCPFrame)
+    {
+        cprintf((LPSTR)"[TCB] Current state: LISTEN\n");
+        BYTE Flags = TCPFrame->GetFlags();
+        acquire(&Lock);
+        if (State != LISTEN)
+        {
+            release(&Lock);
+            return nullptr;
+        }
+        ReplyTo(TCPFrame->GetSourceAddress(), TCPFrame->GetSourcePort());
+        SynRequest** Link = FindRequest(TCPFrame->GetDestinationAddress(),
+            TCPFrame->GetSourceAddress(), TCPFrame->GetSourcePort());
+
+        if (Flags & FrameType::RST)
+        {
+            // The peer refused our SYN-ACK.
+            if (Link && TCPFrame->GetSequenceNumber() ==
+                (*Link)->InitialReceiveSequenceNumber + 1) {DropRequest(Link);}
+            Unlock();
+            return nullptr;
+        }
+        if (!(Flags & FrameType::ACK))
+        {
+            if (Flags & FrameType::SYN) {OnSyn(Device, TCPFrame);}
+            Unlock();
+            return nullptr;
+        }
+
+        SynRequest Request;
+        BOOL Valid = 0;
+        if (Link && !(Flags & FrameType::SYN))
+        {
+            Valid = TCPFrame->GetAcknowledgementNumber() ==
+                (*Link)->InitialSendSequenceNumber + 1;
+        }
+        else if (!(Flags & FrameType::SYN)) {Valid = CheckCookie(Device, TCPFrame, Request);}
+        if (!Valid)
+        {
+            SendControl(TCPFrame->GetAcknowledgementNumber(), 0, FrameType::RST);
+            Unlock();
+            return nullptr;
+        }
+        // Keep the request, the SYN-ACK is resent until there is room.
+        if (ReceiveQueue.size() >= Backlog)
+        {
+            cprintf((LPSTR)"[TCB] Accept queue full, dropping ACK.\n");
+            Unlock();
+            return nullptr;
+        }
+        if (Link)
+        {
+            Request = **Link;
+            DropRequest(Link);
         }
+        Unlock();
+        return CreateChild(Request);
     }
 
     void DoSynSent(const FrameType* TCPFrame)
@@ -811,8 +3091,8 @@ public:
         DWORD Sequence, Acknowledge;
         if (TCPFrame->GetFlags() & FrameType::ACK)
         {
-            if (TCPFrame->GetAcknowledgementNumber() <= InitialSendSequenceNumber ||
-                TCPFrame->GetAcknowledgementNumber() > SendSequence.Next)
+            if (SequenceLessEqual(TCPFrame->GetAcknowledgementNumber(), InitialSendSequenceNumber) ||
+                SequenceLess(SendSequence.Next, TCPFrame->GetAcknowledgementNumber()))
             {
                 if (!(TCPFrame->GetFlags() & FrameType::RST))
                 {
@@ -825,9 +3105,13 @@ public:
         }
         if (TCPFrame->GetFlags() & FrameType::RST)
         {
+            // Connection refused
             if (TCPFrame->GetFlags() & FrameType::ACK)
             {
-                // TCB Close
+                RetransmitPending = 0;
+                Error = -6;
+                SetState(CLOSED);
+                Notify();
             }
             return;
         }
@@ -835,34 +3119,44 @@ public:
         {
             ReceiveSequence.Next = TCPFrame->GetSequenceNumber() + 1;
             InitialReceiveSequenceNumber = TCPFrame->GetSequenceNumber();
+            AcceptSynParameters(TCPFrame);
             if (TCPFrame->GetFlags() & FrameType::ACK)
             {
                 SendSequence.Unacknowledged = TCPFrame->GetAcknowledgementNumber();
-                if (SendSequence.Unacknowledged > InitialSendSequenceNumber)
+                RecoveryPoint = InitialSendSequenceNumber;
+                if (SequenceLess(InitialSendSequenceNumber, SendSequence.Unacknowledged))
                 {
+                    if (!SampleTimestamp()) {SampleRoundTrip(SendSequence.Unacknowledged);}
+                    Retransmits = 0;
+                    RetransmitPending = 0;
                     SetState(ESTABLISHED);
+                    ArmIdleTimer();
                     Sequence = SendSequence.Next;
                     Acknowledge = ReceiveSequence.Next;
                     SendControl(Sequence, Acknowledge, FrameType::ACK);
-                    wakeup(this);
+                    Notify();
                 }
                 return;
             }
-            Sequence = InitialSendSequenceNumber;
-            Acknowledge = ReceiveSequence.Next;
-            SendControl(Sequence, Acknowledge, FrameType::ACK);
+            // Simultaneous open (RFC 9293 3.5, figure 8)
+            SetState(SYN_RECEIVED);
+            SendControl(InitialSendSequenceNumber, ReceiveSequence.Next,
+                FrameType::SYN | FrameType::ACK);
         }
     }
 
     void DoSynReceived(const FrameType* TCPFrame)
     {
         cprintf((LPSTR)"[TCB] Current state: SYN-RSVD\n");
-        if (SendSequence.Unacknowledged <= TCPFrame->GetAcknowledgementNumber() &&
-            TCPFrame->GetAcknowledgementNumber() <= SendSequence.Next)
+        // SND.UNA <= SEG.ACK <= SND.NXT, modulo 2^32.
+        if (SequenceLessEqual(SendSequence.Unacknowledged, TCPFrame->GetAcknowledgementNumber()) &&
+            SequenceLessEqual(TCPFrame->GetAcknowledgementNumber(), SendSequence.Next))
         {
+            // Passive opens never get here, see ListenInput().
+            RetransmitPending = 0;
             SetState(ESTABLISHED);
-            ParentBody->ReceiveQueue.push(this);
-            wakeup(ParentBody);
+            ArmIdleTimer();
+            Notify();
         }
         else
         {
@@ -882,25 +3176,28 @@ public:
     int DoClosing(const FrameType* TCPFrame)
     {
         cprintf((LPSTR)"[TCB] Current state: %d\n", GetState());
-        if (SendSequence.Unacknowledged < TCPFrame->GetAcknowledgementNumber() &&
-            TCPFrame->GetAcknowledgementNumber() <= SendSequence.Next)
-        {
-            SendSequence.Unacknowledged = TCPFrame->GetAcknowledgementNumber();
-        }
-        else if (TCPFrame->GetAcknowledgementNumber() > SendSequence.Next)
+        DWORD Acknowledge = TCPFrame->GetAcknowledgementNumber();
+        if (SequenceLess(SendHighest, Acknowledge))
         {
             SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
             return 1;
         }
+        if (SackPermitted) {UpdateScoreboard(TCPFrame);}
+        if (SequenceLess(SendSequence.Unacknowledged, Acknowledge))
+        {
+            OnNewAcknowledge(Acknowledge);
+        }
+        else if (IsDuplicateAcknowledge(TCPFrame)) {OnDuplicateAcknowledge();}
+        if (SequenceLessEqual(SendSequence.Unacknowledged, Acknowledge))
+        {
+            UpdateSendWindow(TCPFrame);
+            Output();
+        }
 
         if (State == FIN_WAIT_1) {DoFinWait1(TCPFrame);}
         else if (State == CLOSING)
         {
-            if (TCPFrame->GetAcknowledgementNumber() == SendSequence.Next)
-            {
-                State = TIME_WAIT;
-                wakeup(this);
-            }
+            if (TCPFrame->GetAcknowledgementNumber() == SendSequence.Next) {EnterTimeWait();}
             return 1;
         }
         return 0;
@@ -909,22 +3206,134 @@ public:
     void DoLastAck(const FrameType* TCPFrame)
     {
         cprintf((LPSTR)"[TCB] Current state: LAST-ACK\n");
-        wakeup(this);
-        Clear();
+        // Close() is waiting for this and releases the block.
+        SetState(CLOSED);
+        Notify();
+    }
+
+    void StoreData(const FrameType* TCPFrame)
+    {
+        cprintf((LPSTR)"[TCB] Storing data...\n");
+        DWORD Sequence = TCPFrame->GetSequenceNumber();
+        DWORD Size = TCPFrame->DataSize();
+        DWORD Skip = 0;
+        BOOL HadHoles = !OutOfOrder.empty();
+        if (Size > ReceiveMaxSegmentSize)
+        {
+            ReceiveMaxSegmentSize = Size < MaxSegmentSize ? Size : MaxSegmentSize;
+        }
+        // Drop the part we already have.
+        if (SequenceLess(Sequence, ReceiveSequence.Next))
+        {
+            Skip = ReceiveSequence.Next - Sequence;
+            Size = Skip < Size ? Size - Skip : 0;
+            Sequence = ReceiveSequence.Next;
+        }
+
+        // Anything beyond the free space is dropped and will be resent.
+        DWORD Offset = Sequence - ReceiveSequence.Next;
+        if (Offset >= ReceiveBuffer.available()) {Size = 0;}
+        else if (Size > ReceiveBuffer.available() - Offset)
+        {
+            Size = ReceiveBuffer.available() - Offset;
+        }
+        if (Size && Offset && !OutOfOrder.Insert(Sequence, Sequence + Size)) {Size = 0;}
+
+        for (DWORD Copied = 0; Copied < Size;)
+        {
+            typename decltype(ReceiveBuffer)::size_type Run = Size - Copied;
+            BYTE* Destination = ReceiveBuffer.Reserve(Offset + Copied, Run);
+            if (!Run) {break;}
+            TCPFrame->GetData(Destination, Skip + Copied, Run);
+            Copied += Run;
+        }
+
+        if (Offset) {LastOutOfOrder = Sequence;}
+        else if (Size)
+        {
+            ReceiveBuffer.Commit(Size);
+            ReceiveSequence.Next += Size;
+            // Queued segments that are now in order are already in place.
+            while (!OutOfOrder.empty() &&
+                SequenceLessEqual(OutOfOrder[0].Start, ReceiveSequence.Next))
+            {
+                DWORD End = OutOfOrder[0].End;
+                if (SequenceLess(ReceiveSequence.Next, End))
+                {
+                    ReceiveBuffer.Commit(End - ReceiveSequence.Next);
+                    ReceiveSequence.Next = End;
+                }
+                OutOfOrder.TrimBelow(ReceiveSequence.Next);
+            }
+            Notify();
+        }
+        // Out-of-order data, or data filling a hole, is ACKed at once
+        // (RFC 5681 4.2).
+        if (Offset || HadHoles || !Size)
+        {
+            if (Offset) {QuickAcks = QuickAckSegments;}
+            SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
+        }
+        else {ScheduleAcknowledge(Size);}
+    }
+
+    // RFC 9293 3.10.7.4, segment overlaps the receive window.
+    BOOL IsAcceptable(const FrameType* TCPFrame)const
+    {
+        DWORD Sequence = TCPFrame->GetSequenceNumber();
+        DWORD Length = TCPFrame->DataSize();
+        if (TCPFrame->GetFlags() & FrameType::SYN) {++Length;}
+        if (TCPFrame->GetFlags() & FrameType::FIN) {++Length;}
+        DWORD Window = ReceiveBuffer.available();
+        DWORD Right = ReceiveSequence.Next + Window;
+        if (!Length)
+        {
+            if (!Window) {return Sequence == ReceiveSequence.Next;}
+            return SequenceLessEqual(ReceiveSequence.Next, Sequence) && SequenceLess(Sequence, Right);
+        }
+        if (!Window) {return 0;}
+        DWORD Last = Sequence + Length - 1;
+        return (SequenceLessEqual(ReceiveSequence.Next, Sequence) && SequenceLess(Sequence, Right)) ||
+            (SequenceLessEqual(ReceiveSequence.Next, Last) && SequenceLess(Last, Right));
+    }
+
+    // PAWS (RFC 7323 5.3 R1), a TSval older than TS.Recent belongs to an
+    // earlier trip around the sequence space. TS.Recent goes stale after
+    // 24 idle days, when the peer's clock may have wrapped.
+    BOOL CheckTimestamp(const FrameType* TCPFrame)const
+    {
+        if (!Timestamps || !Received.HasTimestamp) {return 1;}
+        if (TCPFrame->GetFlags() & FrameType::RST) {return 1;}
+        if (DWORD(ticks - RecentTimestampTime) >= RecentTimestampLifetime) {return 1;}
+        return !SequenceLess(Received.TimestampValue, RecentTimestamp);
+    }
+
+    // RFC 7323 5.3 R3 and 4.3, only a segment that covers Last.ACK.sent
+    // may update TS.Recent, so delayed ACKs echo the earliest TSval.
+    void UpdateRecentTimestamp(const FrameType* TCPFrame)
+    {
+        if (!Timestamps || !Received.HasTimestamp) {return;}
+        if (SequenceLess(LastAcknowledgeSent, TCPFrame->GetSequenceNumber())) {return;}
+        if (SequenceLess(Received.TimestampValue, RecentTimestamp) &&
+            DWORD(ticks - RecentTimestampTime) < RecentTimestampLifetime)
+        {
+            return;
+        }
+        RecentTimestamp = Received.TimestampValue;
+        RecentTimestampTime = ticks;
     }
 
-    void StoreData(const FrameType* TCPFrame)
+    // Receiver side SWS avoidance (RFC 9293 3.8.6.2.2), tell the peer once
+    // reading has opened the window by a useful amount.
+    void UpdateReceiveWindow()
     {
-        cprintf((LPSTR)"[TCB] Storing data...\n");
-        DWORD Sequence, Acknowledge;
-        TCPFrame->GetData(Window + (DefWindowSize - ReceiveSequence.Window),
-            0, TCPFrame->DataSize());
-        ReceiveSequence.Next = TCPFrame->GetSequenceNumber() + TCPFrame->DataSize();
-        ReceiveSequence.Window -= TCPFrame->DataSize();
-        Sequence = SendSequence.Next;
-        Acknowledge = ReceiveSequence.Next;
-        SendControl(Sequence, Acknowledge, FrameType::ACK);
-        wakeup(this);
+        ShrinkReceiveBuffer();
+        DWORD Threshold = ReceiveBuffer.capacity() / 2;
+        if (Threshold > MaxSegmentSize) {Threshold = MaxSegmentSize;}
+        if (OfferableWindow() >= ReceiveSequence.Window + Threshold)
+        {
+            SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
+        }
     }
 
     void Terminate(const FrameType* TCPFrame)
@@ -936,27 +3345,43 @@ public:
         case SYN_RECEIVED:
         case ESTABLISHED:
             SetState(CLOSE_WAIT);
-            wakeup(this);
+            Notify();
             break;
         case FIN_WAIT_1:
-            SetState(FIN_WAIT_2);
+            // Our FIN is not acknowledged yet, see DoFinWait1().
+            SetState(CLOSING);
             break;
         case FIN_WAIT_2:
-            SetState(TIME_WAIT);
-            wakeup(this);
+            EnterTimeWait();
             break;
         default:
             break;
         }
     }
 
+    // Both FINs are acknowledged. A TimeWaitBlock takes over the 2 MSL
+    // wait so the TCB itself can go now.
+    void EnterTimeWait()
+    {
+        RetransmitPending = 0;
+        AckPending = 0;
+        CorkPending = 0;
+        SetState(TIME_WAIT);
+        // The record keeps an ephemeral port until it expires.
+        if (TimeWaitBlock<Version>::Enter(*this)) {EphemeralPort = 0;}
+        Notify();
+        if (Orphaned) {Release();}
+    }
+
     // Main Function
     void Main(const FrameType* TCPFrame)
     {
+        // Any segment shows the peer is alive, see OnIdleTimer().
+        LastReceived = ticks;
+        KeepAliveProbes = 0;
         switch (State)
         {
-        case LISTEN:
-            DoListen(TCPFrame);
+        case LISTEN: // Never hashed as a connection, see ListenInput()
             return;
         case SYN_SENT:
             DoSynSent(TCPFrame);
@@ -964,15 +3389,30 @@ public:
         case CLOSED:
             DoClosed(TCPFrame);
             return;
+        case TIME_WAIT: // Until released, the TimeWaitBlock answers
+            return;
         default:
             break;
         }
 
-        if (TCPFrame->GetSequenceNumber() != ReceiveSequence.Next)
+        Received = SegmentOptions();
+        ParseOptions(TCPFrame, Received);
+        if (!CheckTimestamp(TCPFrame))
+        {
+            cprintf((LPSTR)"[TCB] PAWS check failed.\n");
+            SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
+            return;
+        }
+        if (!IsAcceptable(TCPFrame))
         {
             cprintf((LPSTR)"[TCB] Sequence number check failed.\n");
+            if (!(TCPFrame->GetFlags() & FrameType::RST))
+            {
+                SendControl(SendSequence.Next, ReceiveSequence.Next, FrameType::ACK);
+            }
             return;
         }
+        UpdateRecentTimestamp(TCPFrame);
         if (TCPFrame->GetFlags() & (FrameType::RST | FrameType::SYN))
         {
             cprintf((LPSTR)"[TCB] Reconnecting...\n");
@@ -1004,7 +3444,7 @@ public:
             break;
         }
 
-        if ((TCPFrame->GetFlags() & FrameType::PSH) && TCPFrame->DataSize())
+        if (TCPFrame->DataSize())
         {
             switch (State)
             {
@@ -1018,7 +3458,9 @@ public:
             }
         }
 
-        if (TCPFrame->GetFlags() & (FrameType::FIN))
+        // A FIN only counts once everything before it has arrived.
+        if ((TCPFrame->GetFlags() & (FrameType::FIN)) &&
+            TCPFrame->GetSequenceNumber() + TCPFrame->DataSize() == ReceiveSequence.Next)
         {
             Terminate(TCPFrame);
             return;
@@ -1026,23 +3468,234 @@ public:
     }
 };
 
-inline void TCP<4>::Register()
+// What is left of a connection in TIME-WAIT (RFC 9293 3.6.1): enough to
+// ACK a retransmitted FIN and to keep the 4-tuple from being reused while
+// old segments may still be around. Each record has its own kernel timer
+// and all of them are guarded by TimeWaitLock, lock order is TCB, then
+// TimeWaitLock, then TCPLock.
+template<BYTE Version>
+class TimeWaitBlock
 {
-    cprintf((LPSTR)"[TCP] Registering...\n");
-    TCBTable.resize(TCBTable.max_size());
-    for (auto i = 0U; i < TCBTable.size(); ++i)
+public:
+    using FrameType = TCP<Version>;
+    using Controller = TCB<Version>;
+
+    static const auto Timeout = 60 * _TICKS_PER_SECOND; // 2 MSL, MSL = 30 s
+
+    template<typename Tp, size_t BucketCount>
+    friend class HashTable;
+
+private:
+    NetworkAdapter* Device = nullptr;
+    DWORD LocalAddress = 0;
+    WORD  LocalPort = 0;
+    DWORD RemoteAddress = 0;
+    WORD  RemotePort = 0;
+    DWORD SendNext = 0;
+    DWORD ReceiveNext = 0;
+    WORD  Window = 0; // Last advertised, as sent
+    BOOL  Timestamps = 0;
+    DWORD TimestampOffset = 0;
+    DWORD RecentTimestamp = 0;
+    BOOL  EphemeralPort = 0;
+
+    TimeWaitBlock* HashNext = nullptr;
+    timer Timer; // Changed under TimeWaitLock, see OnTimer()
+
+    static DWORD Hash(DWORD LocalAddress, WORD LocalPort, DWORD RemoteAddress, WORD RemotePort)
+    {
+        return Controller::ConnectionHash(LocalAddress, LocalPort, RemoteAddress, RemotePort);
+    }
+
+    DWORD Hash()const {return Hash(LocalAddress, LocalPort, RemoteAddress, RemotePort);}
+
+    // Caller holds TimeWaitLock.
+    static TimeWaitBlock* Find(DWORD LocalAddress, WORD LocalPort,
+        DWORD RemoteAddress, WORD RemotePort)
+    {
+        return FrameType::TimeWaitTable.Find(
+            Hash(LocalAddress, LocalPort, RemoteAddress, RemotePort),
+            [&](const TimeWaitBlock& Block)
+            {
+                return Block.LocalPort == LocalPort && Block.RemotePort == RemotePort &&
+                    Block.RemoteAddress == RemoteAddress && Block.LocalAddress == LocalAddress;
+            });
+    }
+
+    void Schedule() {timer_add(&Timer, ticks + Timeout);}
+
+    // Drop the record once its 2 MSL are over, in interrupt context. A FIN
+    // that came in while the callback waited for the lock restarted it.
+    static void OnTimer(LPVOID Argument)
+    {
+        TimeWaitBlock* Block = static_cast<TimeWaitBlock*>(Argument);
+        acquire(&FrameType::TimeWaitLock);
+        if (!timer_pending(&Block->Timer)) {Block->Remove();}
+        release(&FrameType::TimeWaitLock);
+    }
+
+    // Caller holds TimeWaitLock and the timer is not pending.
+    void Remove()
+    {
+        FrameType::TimeWaitTable.Erase(Hash(), this);
+        if (EphemeralPort)
+        {
+            FrameType::AcquireLock();
+            Controller::FreePort(LocalPort);
+            FrameType::ReleaseLock();
+        }
+        FrameType::TimeWaitPool.Delete(this);
+    }
+
+    int SendAcknowledge()const
+    {
+        if (!Device) {return -1;}
+        FrameType* Reply = new FrameType();
+        if (!Reply) {return -1;}
+        Reply->SetSourcePort(LocalPort);
+        Reply->SetDestinationAddress(RemoteAddress);
+        Reply->SetDestinationPort(RemotePort);
+        Reply->SetSequenceNumber(SendNext);
+        Reply->SetAcknowledgementNumber(ReceiveNext);
+        Reply->SetFlags(FrameType::ACK);
+        Reply->SetWindow(Window);
+        BYTE Options[Controller::TimestampOptionSize];
+        if (Timestamps)
+        {
+            Controller::BuildTimestampOption(Options, ticks + TimestampOffset, RecentTimestamp);
+            Reply->SetOptions(Options, sizeof(Options));
+        }
+        int ReturnValue = Reply->ToDevice(*Device, 1);
+        delete Reply;
+        return ReturnValue;
+    }
+
+public:
+    TimeWaitBlock() {timer_init(&Timer, OnTimer, this);}
+
+    static void Init()
+    {
+        initlock(&FrameType::TimeWaitLock, (char*)"TCP time-wait");
+        FrameType::TimeWaitTable.Init((char*)"TCP time-wait");
+        FrameType::TimeWaitPool.Init((char*)"TCP time-wait pool");
+        FrameType::TimeWaitLimit = FrameType::DefTimeWaitLimit;
+    }
+
+    // Record App, whose lock the caller holds. Without a record (limit
+    // reached or no memory) the connection simply closes.
+    static BOOL Enter(const Controller& App)
+    {
+        acquire(&FrameType::TimeWaitLock);
+        TimeWaitBlock* Block = nullptr;
+        if (FrameType::TimeWaitPool.size() < FrameType::TimeWaitLimit)
+        {
+            Block = FrameType::TimeWaitPool.New();
+        }
+        if (!Block)
+        {
+            release(&FrameType::TimeWaitLock);
+            cprintf((LPSTR)"[TCB] Time-wait table full, closing at once.\n");
+            return 0;
+        }
+        Block->Device = App.Iface;
+        Block->LocalAddress = App.LocalAddress;
+        Block->LocalPort = App.LocalPort;
+        Block->RemoteAddress = App.RemoteAddress;
+        Block->RemotePort = App.RemotePort;
+        Block->SendNext = App.SendSequence.Next;
+        Block->ReceiveNext = App.ReceiveSequence.Next;
+        DWORD Field = App.ReceiveSequence.Window >> App.ReceiveWindowScale;
+        Block->Window = WORD(Field > 0xFFFF ? 0xFFFF : Field);
+        Block->Timestamps = App.Timestamps;
+        Block->TimestampOffset = App.TimestampOffset;
+        Block->RecentTimestamp = App.RecentTimestamp;
+        Block->EphemeralPort = App.EphemeralPort;
+        Block->Schedule();
+        FrameType::TimeWaitTable.Insert(Block->Hash(), Block);
+        release(&FrameType::TimeWaitLock);
+        return 1;
+    }
+
+    static BOOL Exists(DWORD LocalAddress, WORD LocalPort, DWORD RemoteAddress, WORD RemotePort)
+    {
+        acquire(&FrameType::TimeWaitLock);
+        BOOL Found = Find(LocalAddress, LocalPort, RemoteAddress, RemotePort) != nullptr;
+        release(&FrameType::TimeWaitLock);
+        return Found;
+    }
+
+    // Segment that matched no TCB. Returns 0 if no record took it, so it
+    // goes on to the listeners.
+    static BOOL Input(const FrameType* TCPFrame)
     {
-        TCBTable[i].Init();
+        BYTE Flags = TCPFrame->GetFlags();
+        acquire(&FrameType::TimeWaitLock);
+        TimeWaitBlock* Block = Find(
+            TCPFrame->GetDestinationAddress(), TCPFrame->GetDestinationPort(),
+            TCPFrame->GetSourceAddress(), TCPFrame->GetSourcePort());
+        if (!Block)
+        {
+            release(&FrameType::TimeWaitLock);
+            return 0;
+        }
+        // RFC 1337, a RST must not cut TIME-WAIT short.
+        if (Flags & FrameType::RST)
+        {
+            release(&FrameType::TimeWaitLock);
+            return 1;
+        }
+        // RFC 1122 4.2.2.13, a new incarnation may start above the old
+        // sequence space. With timestamps on both sides a newer TSval is
+        // enough (RFC 6191).
+        typename Controller::SegmentOptions Options;
+        Controller::ParseOptions(TCPFrame, Options);
+        BOOL Newer = (Block->Timestamps && Options.HasTimestamp) ?
+            Controller::SequenceLess(Block->RecentTimestamp, Options.TimestampValue) :
+            Controller::SequenceLess(Block->ReceiveNext, TCPFrame->GetSequenceNumber());
+        if ((Flags & FrameType::SYN) && !(Flags & FrameType::ACK) && Newer)
+        {
+            cprintf((LPSTR)"[TCB] Reopening connection in TIME-WAIT.\n");
+            // Already fired, the callback removes it as soon as we let go.
+            if (timer_detach(&Block->Timer)) {Block->Remove();}
+            release(&FrameType::TimeWaitLock);
+            return 0;
+        }
+        // A retransmitted FIN means our ACK was lost, restart the wait.
+        if (Flags & FrameType::FIN) {Block->Schedule();}
+        TimeWaitBlock Reply = *Block;
+        release(&FrameType::TimeWaitLock);
+        Reply.SendAcknowledge();
+        return 1;
     }
+
+};
+
+template<BYTE Version>
+ObjectPool<typename TCB<Version>::SynRequest> TCB<Version>::RequestPool;
+template<BYTE Version>
+QWORD TCB<Version>::Secret[2];
+
+inline void TCP<4>::Register()
+{
+    cprintf((LPSTR)"[TCP] Registering...\n");
     initlock(&TCPLock, (char*)"TCP");
+    TCBTable.Init(DefTCBLimit);
+    TCBPool.Init((char*)"TCB pool");
+    ConnectionTable.Init((char*)"TCP connections");
+    ListenTable.Init((char*)"TCP listeners");
+    TCB<4>::RequestPool.Init((char*)"TCP SYN requests");
+    TCB<4>::InitSecret();
+    TimeWaitBlock<4>::Init();
+    SourcePortHint = TCB<4>::SecretHash(TCB<4>::SecretPort, 0, 0, 0, 0) % SourcePorts.size();
     cprintf((LPSTR)"[TCP] DONE.\n");
 }
 
 inline void TCP<4>::Main(NetworkAdapter* Device, const Mybase& Frame)
 {
     TCP<4>* TCPFrame = new TCP<4>(Frame);
+    if (!TCPFrame) {return;}
     //TCPFrame->Print("TCP Received.\n");
-    if (!TCPFrame->IsValid())
+    if (!LoopbackNetworkAdapter::IsLoopback(Device) && !TCPFrame->IsValid())
     {
         //cprintf((char*)"[TCP] Invalid TCP frame. (0x%x)\n",
         cprintf((char*)"[TCP] WARNING: TCP Checksum incorrect (0x%x), "
@@ -1056,51 +3709,39 @@ inline void TCP<4>::Main(NetworkAdapter* Device, const Mybase& Frame)
         TCPFrame->GetAcknowledgementNumber(),
         TCPFrame->GetFlags());
 
-    decltype(TCBTable)::iterator App, AppF = nullptr, AppL = nullptr;
-    AcquireLock();
-    for (App = TCBTable.begin(); App != TCBTable.end(); ++App)
+    TCB<4>* App = TCB<4>::Lookup(Device,
+        TCPFrame->GetDestinationAddress(), TCPFrame->GetDestinationPort(),
+        TCPFrame->GetSourceAddress(), TCPFrame->GetSourcePort());
+    if (!App && TimeWaitBlock<4>::Input(TCPFrame))
     {
-        if (!App->IsStarted())
-        {
-            if (!AppF)
-            {
-                //cprintf((LPSTR)"[TCB] Allocate new block.\n");
-                AppF = App;
-            }
-        }
-        else if ((!App->GetDevice() || App->GetDevice() == Device)
-            && App->GetFrame()->GetSourcePort() == TCPFrame->GetDestinationPort())
-        {
-            if (App->GetFrame()->GetDestinationAddress() == TCPFrame->GetSourceAddress() &&
-                App->GetFrame()->GetDestinationPort() == TCPFrame->GetSourcePort())
-            {
-                //cprintf((LPSTR)"[TCB] Found specified block.\n");
-                break;
-            }
-            if ((App->GetState() == App->LISTEN) && !AppL)
-            {
-                //cprintf((LPSTR)"[TCB] Found listening.\n");
-                AppL = App;
-            }
-        }
+        delete TCPFrame;
+        return;
     }
-
-    if (App == TCBTable.end())
+    if (!App)
     {
-        if (!AppF || !AppL || !(TCPFrame->GetFlags() & SYN))
+        TCB<4>* Listener = TCB<4>::LookupListener(
+            TCPFrame->GetDestinationAddress(), TCPFrame->GetDestinationPort(),
+            TCPFrame->GetSourceAddress(), TCPFrame->GetSourcePort());
+        if (!Listener)
         {
             cprintf((LPSTR)"[TCB] Unexpected state, sendinng RST...\n");
             // Send RST, TODO...
-            ReleaseLock();
+            delete TCPFrame;
+            return;
+        }
+        App = Listener->ListenInput(Device, TCPFrame);
+        Listener->Put();
+        if (!App)
+        {
+            delete TCPFrame;
             return;
         }
-
-        App = AppF;
-        App->Fork(AppL, Device, TCPFrame);
     }
+    acquire(&App->Lock);
 
     App->Main(TCPFrame);
-    ReleaseLock();
+    App->Unlock();
+    App->Put();
     delete TCPFrame;
 }
 
@@ -1113,7 +3754,19 @@ public:
     using Mybase = Signature;
 
     static const auto ProtocolNumber        = 17;
-    static const auto UDPTableSize          = 16;
+    static const auto DefUDPLimit           = 1024; // See NetTunable()
+    static const auto PortBuckets           = 16;
+    static const auto MaxMessageBatch       = 64; // Datagrams per sendmmsg()/recvmmsg()
+    static const auto SendBatchSize         = 8;  // Frames per adapter doorbell
+    static const auto ReceiveBatchSize      = 8;  // Frames per hold of UDPLock in recvmmsg()
+
+    // A queued datagram holds a page however small it is, so that is what
+    // it is charged against the receive buffer.
+    static const auto DatagramCharge        = 4096;
+    static const auto DefReceiveBufferSize  = 64 * DatagramCharge;  // See NetTunable()
+    static const auto MinReceiveBufferSize  = DatagramCharge;
+    static const auto MaxReceiveBufferSize  = 512 * DatagramCharge; // One page of handles
+    static const auto ControllerCharge      = 2 * NetMemory::PageCharge; // Template and queue
 
     static const auto HeaderSize            = 8;
     static const auto SourcePort            = 0; // 0 - 1
@@ -1230,7 +3883,20 @@ public:
     UDP() : __UDPBase<IPv4>() {}
     UDP(const Mybase& Frame) : __UDPBase(Frame) {}
 
-    static ArrayList<class UDPController<4>, UDPTableSize> UDPTable;
+    // Live controllers by socket descriptor
+    static IndexTable<class UDPController<4>> UDPTable;
+    static ObjectPool<class UDPController<4>> UDPPool;
+    // Bound controllers by local port, see UDPController<4>::Lookup()
+    static HashTable<class UDPController<4>, PortBuckets> PortTable;
+    // Frames of a sendmmsg() run, guarded by UDPLock
+    static UDP<4>* BatchFrames[SendBatchSize];
+    // Receive buffer of new controllers and datagrams dropped for lack of
+    // room on any, guarded by UDPLock
+    static DWORD ReceiveBufferDefault;
+    static DWORD ReceiveDrops;
+
+    // Largest payload that fits into one frame
+    static const auto MaxDatagramSize = EthernetFrame::MaxDataSize - 20 - HeaderSize;
 
 private:
     WORD VerifyChecksum(BOOL ComputeOnly = 0)const override
@@ -1276,7 +3942,7 @@ public:
         }
 
         Mybase::SetSourceAddress(it->IPAddress);
-        SetChecksum(VerifyChecksum(1));
+        if (!LoopbackNetworkAdapter::IsLoopback(&Device)) {SetChecksum(VerifyChecksum(1));}
         /*if (VerifyChecksum())
         {
             cprintf((LPSTR)"[TCP] WARNING: Verifying transmission checksum error (0x%x)\n",
@@ -1285,6 +3951,16 @@ public:
         return Mybase::ToDevice(Device, 0);
     }
 
+    // ToDevice() without the transmission, see IPv4::PrepareTransmit().
+    int PrepareTransmit(NetworkAdapter& Device)
+    {
+        auto it = Mybase::IPFind(&Device);
+        if (it == Mybase::AdapterIPAddressTable.end()) {return -1;}
+        Mybase::SetSourceAddress(it->IPAddress);
+        if (!LoopbackNetworkAdapter::IsLoopback(&Device)) {SetChecksum(VerifyChecksum(1));}
+        return Mybase::PrepareTransmit(Device, 0);
+    }
+
     static void AcquireLock() {acquire(&UDPLock);}
     static void ReleaseLock() {release(&UDPLock);}
 
@@ -1300,12 +3976,28 @@ public:
     using IPType    = FrameType::Mybase;
 
     friend class UDP<Version>;
+    template<typename Tp, size_t BucketCount>
+    friend class HashTable;
 
 private:
+    int  Index = -1; // Socket descriptor, slot in UDPTable
     BOOL Started = 0;
     NetworkAdapter* Iface = nullptr;
     FrameType* Frame = nullptr;
-    LinkedQueue<FrameType*> ReceiveQueue;
+    // Datagrams for Receive(), up to ReceiveBufferSize / DatagramCharge.
+    // Main() drops what ChargeDatagram() refuses and counts it in ReceiveDrops.
+    BoundedQueue<FrameType*> ReceiveQueue;
+    DWORD ReceiveBufferSize = 0;
+    DWORD ReceiveDrops = 0;
+    DWORD Charged = 0; // Bytes charged to NetMemory::OwnerUDP
+
+    // Cached local port and PortTable link, set while bound.
+    WORD LocalPort = 0;
+    BOOL ReusePort = 0; // Share the port with others that set it, see Bind()
+    UDPController* HashNext = nullptr;
+    BOOL Hashed = 0;
+
+    pollqueue PollQueue; // poll() and epoll waiters
 
 public:
     UDPController() {Init();}
@@ -1320,7 +4012,10 @@ public:
 
     void Init()
     {
+        pollqueueinit(&PollQueue);
         Frame = new FrameType();
+        ReceiveBufferSize = FrameType::ReceiveBufferDefault;
+        ReceiveQueue.Create(ReceiveBufferSize / FrameType::DatagramCharge);
     }
 
     void Destory()
@@ -1330,13 +4025,101 @@ public:
             delete ReceiveQueue.front();
             ReceiveQueue.pop();
         }
+        ReceiveQueue.Destory();
         delete Frame;
+        Frame = nullptr;
+        NetMemory::Uncharge(NetMemory::OwnerUDP, Charged);
+        Charged = 0;
+    }
+
+    // Take a datagram's charge before queueing it. The queue holds up to
+    // its limit, only half of that under memory pressure, and nothing
+    // once the hard limit is reached. The caller holds UDPLock.
+    BOOL ChargeDatagram()
+    {
+        DWORD Limit = ReceiveQueue.limit();
+        if (NetMemory::UnderPressure()) {Limit /= 2;}
+        if (ReceiveQueue.size() >= Limit) {return 0;}
+        if (!NetMemory::Charge(NetMemory::OwnerUDP, FrameType::DatagramCharge)) {return 0;}
+        Charged += FrameType::DatagramCharge;
+        return 1;
+    }
+
+    // Datagram taken off the queue, the caller holds UDPLock.
+    void UnchargeDatagram()
+    {
+        Charged -= FrameType::DatagramCharge;
+        NetMemory::Uncharge(NetMemory::OwnerUDP, FrameType::DatagramCharge);
+    }
+
+    // New controller with a descriptor, nullptr if the limit is reached or
+    // memory ran out. The caller holds UDPLock.
+    static UDPController* Allocate()
+    {
+        UDPController* Block = FrameType::UDPPool.New();
+        if (!Block) {return nullptr;}
+        if (!Block->Frame || !Block->ReceiveQueue.valid() ||
+            !NetMemory::Charge(NetMemory::OwnerUDP, FrameType::ControllerCharge))
+        {
+            FrameType::UDPPool.Delete(Block);
+            return nullptr;
+        }
+        Block->Charged = FrameType::ControllerCharge;
+        Block->Index = FrameType::UDPTable.Insert(Block);
+        if (Block->Index < 0)
+        {
+            FrameType::UDPPool.Delete(Block);
+            return nullptr;
+        }
+        Block->Start();
+        return Block;
+    }
+
+    // Drop the controller and its descriptor.
+    void Release()
+    {
+        Unhash();
+        FrameType::UDPTable.Erase(Index);
+        FrameType::UDPPool.Delete(this);
+    }
+
+    static DWORD PortHash(WORD LocalPort) {return HashMix(0, 0, LocalPort);}
+
+    void Hash(WORD Port)
+    {
+        Unhash();
+        LocalPort = Port;
+        FrameType::PortTable.Insert(PortHash(LocalPort), this);
+        Hashed = 1;
+    }
+
+    void Unhash()
+    {
+        if (Hashed) {FrameType::PortTable.Erase(PortHash(LocalPort), this);}
+        Hashed = 0;
+    }
+
+    // Another controller already bound to Port on Adapter (nullptr for any).
+    // Controllers that all set ReusePort may share the same binding.
+    static BOOL Conflicts(const UDPController* Block, NetworkAdapter* Adapter, WORD Port)
+    {
+        return FrameType::PortTable.Find(PortHash(Port), [&](const UDPController& Blk)
+        {
+            return &Blk != Block && Blk.LocalPort == Port &&
+                (!Adapter || !Blk.Iface || Blk.Iface == Adapter) &&
+                !(Block->ReusePort && Blk.ReusePort && Blk.Iface == Adapter);
+        }) != nullptr;
     }
 
-    void Clear()
+    // Controller bound to Port on Device, the caller holds UDPLock. Key, a
+    // hash of the datagram's addresses and ports, picks one of a group
+    // sharing the port, so a flow always reaches the same socket.
+    static UDPController* Lookup(NetworkAdapter* Device, WORD Port, DWORD Key)
     {
-        *this = UDPController();
-        Init();
+        return FrameType::PortTable.Select(PortHash(Port), [&](const UDPController& Block)
+        {
+            return Block.LocalPort == Port && (!Block.Iface || Block.Iface == Device);
+        }, Key);
     }
 
     void ClearFrame()
@@ -1349,22 +4132,27 @@ public:
         }
     }
 
-    void UpdateRouteData()
+    // Adapter a datagram to Destination leaves on: the bound one, or the
+    // route's. The route is not kept, an unbound controller goes on
+    // receiving from every adapter, 127.0.0.1 included.
+    NetworkAdapter* RouteFor(DWORD Destination)const
     {
+        if (Iface) {return Iface;}
         typename decltype(IPType::RouteTable)::iterator Route;
-        Route = IPType::RouteTableMatch(Frame->GetDestinationAddress());
-        if (Route == IPType::RouteTable.end()) {return;}
-        Iface = (NetworkAdapter*)Route->Iface;
+        Route = IPType::RouteTableMatch(Destination);
+        if (Route == IPType::RouteTable.end()) {return nullptr;}
+        return (NetworkAdapter*)Route->Iface;
     }
 
     int SendData(DWORD Destination, WORD DestiPort, LPCVOID Data, int Size)
     {
         if (!Destination || !DestiPort) {return -1;}
+        NetworkAdapter* Device = RouteFor(Destination);
+        if (!Device) {return -5;}
         Frame->SetDestinationAddress(Destination);
         Frame->SetDestinationPort(DestiPort);
         Frame->SetData(Data, 0, Size);
-        if (!Iface) {UpdateRouteData();}
-        Frame->ToDevice(*Iface);
+        Frame->ToDevice(*Device);
         ClearFrame();
         return Size;
     }
@@ -1374,33 +4162,29 @@ public:
     {
         cprintf((LPSTR)"[UDP Controller] Starting Controller...\n");
         FrameType::AcquireLock();
-        for (auto i = 0U; i < FrameType::UDPTable.size(); ++i)
+        UDPController* Block = Allocate();
+        if (!Block)
         {
-            if (!FrameType::UDPTable[i].IsStarted())
-            {
-                FrameType::UDPTable[i].Start();
-                FrameType::ReleaseLock();
-                cprintf((LPSTR)"[UDP Controller] Controller Started at %d\n", i);
-                return i;
-            }
+            FrameType::ReleaseLock();
+            return -1;
         }
+        int Index = Block->Index;
         FrameType::ReleaseLock();
-        return -1;
+        cprintf((LPSTR)"[UDP Controller] Controller Started at %d\n", Index);
+        return Index;
     }
 
     static int Close(int Index)
     {
-        if (Index > int(FrameType::UDPTable.size())) {return -1;}
-
         cprintf((LPSTR)"[UDP Controller] Controller %d - Closing...\n", Index);
         FrameType::AcquireLock();
-        auto Block = &(FrameType::UDPTable[Index]);
-        if (!Block->IsStarted())
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
         {
             FrameType::ReleaseLock();
             return -2;
         }
-        Block->Clear();
+        Block->Release();
         FrameType::ReleaseLock();
         cprintf((LPSTR)"[UDP Controller] Controller %d - Closed.\n", Index);
         return 0;
@@ -1412,14 +4196,9 @@ public:
         IP::IPSplit(Address, Address1, Address2, Address3, Address4);
         cprintf((LPSTR)"[UDP Controller] Binding Controller %d to %d.%d.%d.%d:%d\n",
             Index, Address1, Address2, Address3, Address4, Port);
-        if (Index > int(FrameType::UDPTable.size())) {return -1;}
-        if ((Address & IP::LocalhostMask) == IP::Localhost)
-        {
-            return -2;
-        }
         FrameType::AcquireLock();
-        auto Block = &(FrameType::UDPTable[Index]);
-        if (!Block->IsStarted())
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
         {
             FrameType::ReleaseLock();
             return -3;
@@ -1434,19 +4213,14 @@ public:
                 return -4;
             }
         }
-        for (int i = 0; i < int(FrameType::UDPTable.size()); ++i)
+        if (Conflicts(Block, Address ? (NetworkAdapter*)IPAddr->Adapter : nullptr, Port))
         {
-            auto Blk = &(FrameType::UDPTable[i]);
-            if (Blk->IsStarted() && (i != Index) &&
-                (!Blk->Iface || Blk->Iface == IPAddr->Adapter) &&
-                Port == Blk->GetFrame()->GetSourcePort())
-            {
-                FrameType::ReleaseLock();
-                return -5;
-            }
+            FrameType::ReleaseLock();
+            return -5;
         }
         Block->Iface = Address ? (NetworkAdapter*)IPAddr->Adapter : nullptr;
         Block->GetFrame()->SetSourcePort(Port);
+        Block->Hash(Port);
         FrameType::ReleaseLock();
         cprintf((LPSTR)"[UDP Controller] Controller %d - Current port is %d\n", Index,
             Block->GetFrame()->GetSourcePort());
@@ -1455,37 +4229,32 @@ public:
 
     static int Bind(int Index, NetworkAdapter* Adapter, WORD Port)
     {
-        if (Index > int(FrameType::UDPTable.size())) {return -1;}
         FrameType::AcquireLock();
-        auto Block = &(FrameType::UDPTable[Index]);
-        if (!Block->IsStarted())
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
         {
             FrameType::ReleaseLock();
             return -2;
         }
-        for (int i = 0; i < FrameType::UDPTable.size(); ++i)
+        if (Conflicts(Block, Adapter, Port))
         {
-            auto Blk = &(FrameType::UDPTable[i]);
-            if (Blk->IsStarted() && (i != Index) &&
-                (!Blk->Iface || Blk->Iface == Adapter) &&
-                Port == Blk->GetFrame()->GetSourcePort())
-            {
-                FrameType::ReleaseLock();
-                return -3;
-            }
+            FrameType::ReleaseLock();
+            return -3;
         }
         Block->Iface = Adapter;
         Block->GetFrame()->SetSourcePort(Port);
+        Block->Hash(Port);
         FrameType::ReleaseLock();
         return 0;
     }
 
-    static int Receive(int Index, DWORD* DestiAddress, WORD* DestiPort, LPVOID Destination, int Size)
+    // FWOULDBLOCK with nothing queued if the caller cannot wait.
+    static int Receive(int Index, DWORD* DestiAddress, WORD* DestiPort, LPVOID Destination, int Size, BOOL NonBlocking)
     {
-        if (Index > int(FrameType::UDPTable.size())) {return -1;}
+        if (Size < 0) {return -1;}
         FrameType::AcquireLock();
-        auto Block = &(FrameType::UDPTable[Index]);
-        if (!Block->IsStarted())
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
         {
             FrameType::ReleaseLock();
             return -2;
@@ -1497,8 +4266,14 @@ public:
             {
                 Frame = Block->ReceiveQueue.front();
                 Block->ReceiveQueue.pop();
+                Block->UnchargeDatagram();
                 break;
             }
+            else if (NonBlocking)
+            {
+                FrameType::ReleaseLock();
+                return FWOULDBLOCK;
+            }
             else {sleep(Block, &FrameType::UDPLock);}
         }
         FrameType::ReleaseLock();
@@ -1513,33 +4288,234 @@ public:
         return TrueSize;
     }
 
-    static int Transmit(int Index, DWORD DestiAddress, WORD DestiPort, LPCVOID Destination, int Size)
+    // recvmmsg(): waits for the first datagram like Receive(), then takes
+    // whatever else is queued up to Count. Frames leave the queue
+    // ReceiveBatchSize at a time under UDPLock and are copied out after it,
+    // so only a few pointers are on the stack. Returns the number of
+    // messages filled in.
+    static int ReceiveBatch(int Index, DatagramMessage* Messages, int Count, BOOL NonBlocking)
+    {
+        if (Count > FrameType::MaxMessageBatch) {Count = FrameType::MaxMessageBatch;}
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
+        {
+            FrameType::ReleaseLock();
+            return -2;
+        }
+        while (Block->ReceiveQueue.empty())
+        {
+            if (NonBlocking)
+            {
+                FrameType::ReleaseLock();
+                return FWOULDBLOCK;
+            }
+            sleep(Block, &FrameType::UDPLock);
+        }
+        int Taken = 0;
+        while (1)
+        {
+            FrameType* Frames[FrameType::ReceiveBatchSize];
+            int Batched = 0;
+            while (Taken + Batched < Count && Batched < FrameType::ReceiveBatchSize &&
+                !Block->ReceiveQueue.empty())
+            {
+                Frames[Batched++] = Block->ReceiveQueue.front();
+                Block->ReceiveQueue.pop();
+                Block->UnchargeDatagram();
+            }
+            FrameType::ReleaseLock();
+
+            for (int i = 0; i < Batched; ++i)
+            {
+                DatagramMessage& Message = Messages[Taken + i];
+                Message.Address = Frames[i]->GetSourceAddress();
+                Message.Port = Frames[i]->GetSourcePort();
+                Message.Length = Message.Size < Frames[i]->DataSize() ? Message.Size : Frames[i]->DataSize();
+                Frames[i]->GetData(Message.Buffer, 0, Message.Length);
+                delete Frames[i];
+            }
+            Taken += Batched;
+            if (Taken >= Count || Batched < FrameType::ReceiveBatchSize) {return Taken;}
+
+            FrameType::AcquireLock();
+            Block = FrameType::UDPTable[Index];
+            if (!Block)
+            {
+                FrameType::ReleaseLock();
+                return Taken;
+            }
+        }
+    }
+
+    // Readable with a datagram queued, always writable.
+    static int Poll(int Index)
     {
-        if (Index > int(FrameType::UDPTable.size())) {return -1;}
         FrameType::AcquireLock();
-        auto Block = &(FrameType::UDPTable[Index]);
-        Block->SendData(DestiAddress, DestiPort, Destination, Size);
+        auto Block = FrameType::UDPTable[Index];
+        int Events = Block ? POLLOUT : POLLNVAL;
+        if (Block && !Block->ReceiveQueue.empty()) {Events |= POLLIN;}
+        FrameType::ReleaseLock();
+        return Events;
+    }
+
+    static pollqueue* GetPollQueue(int Index)
+    {
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        FrameType::ReleaseLock();
+        return Block ? &Block->PollQueue : nullptr;
+    }
+
+    // Takes effect at once, datagrams already queued beyond a smaller
+    // buffer stay.
+    static int SetReceiveBufferSize(int Index, int Size)
+    {
+        if (Size < FrameType::MinReceiveBufferSize) {Size = FrameType::MinReceiveBufferSize;}
+        if (Size > FrameType::MaxReceiveBufferSize) {Size = FrameType::MaxReceiveBufferSize;}
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        if (Block)
+        {
+            Block->ReceiveBufferSize = Size;
+            Block->ReceiveQueue.SetLimit(Size / FrameType::DatagramCharge);
+        }
+        FrameType::ReleaseLock();
+        return Block ? 0 : -3;
+    }
+
+    // Before Bind(), like SO_REUSEPORT.
+    static int SetReusePort(int Index, BOOL Enable)
+    {
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        if (Block) {Block->ReusePort = Enable ? 1 : 0;}
+        FrameType::ReleaseLock();
+        return Block ? 0 : -3;
+    }
+
+    static int GetReceiveBufferSize(int Index)
+    {
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        int Size = Block ? (int)Block->ReceiveBufferSize : -3;
         FrameType::ReleaseLock();
         return Size;
     }
+
+    static int GetReceiveDrops(int Index)
+    {
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        int Drops = Block ? (int)Block->ReceiveDrops : -3;
+        FrameType::ReleaseLock();
+        return Drops;
+    }
+
+    // Bytes charged to the controller, see NetMemory.
+    static int GetMemory(int Index)
+    {
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        int Memory = Block ? (int)Block->Charged : -3;
+        FrameType::ReleaseLock();
+        return Memory;
+    }
+
+    static int Transmit(int Index, DWORD DestiAddress, WORD DestiPort, LPCVOID Destination, int Size)
+    {
+        if (Size < 0) {return -1;}
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
+        {
+            FrameType::ReleaseLock();
+            return -1;
+        }
+        int ReturnValue = Block->SendData(DestiAddress, DestiPort, Destination, Size);
+        FrameType::ReleaseLock();
+        return ReturnValue;
+    }
+
+    // sendmmsg(): the messages go out under one hold of UDPLock, built in
+    // BatchFrames and handed to the adapter SendBatchSize at a time. Those
+    // waiting for address resolution leave as copies later. Returns the
+    // number of messages sent, or the error of the first one if none was.
+    static int TransmitBatch(int Index, DatagramMessage* Messages, int Count)
+    {
+        if (Count > FrameType::MaxMessageBatch) {Count = FrameType::MaxMessageBatch;}
+        FrameType::AcquireLock();
+        auto Block = FrameType::UDPTable[Index];
+        if (!Block)
+        {
+            FrameType::ReleaseLock();
+            return -1;
+        }
+        int Sent = 0;
+        int ReturnValue = 0;
+        while (Sent < Count && !ReturnValue)
+        {
+            EthernetFrame* Ready[FrameType::SendBatchSize];
+            NetworkAdapter* BatchDevice = nullptr;
+            int Batched = 0;
+            while (Sent < Count && Batched < FrameType::SendBatchSize)
+            {
+                DatagramMessage& Message = Messages[Sent];
+                if (!Message.Address || !Message.Port || Message.Size < 0 ||
+                    Message.Size > FrameType::MaxDatagramSize)
+                {
+                    ReturnValue = -1;
+                    break;
+                }
+                NetworkAdapter* Device = Block->RouteFor(Message.Address);
+                if (!Device)
+                {
+                    ReturnValue = -5;
+                    break;
+                }
+                // A batch goes to one adapter, the next starts with this one.
+                if (BatchDevice && Device != BatchDevice) {break;}
+                BatchDevice = Device;
+                FrameType* Out = FrameType::BatchFrames[Batched];
+                *Out = *Block->Frame;
+                Out->SetDestinationAddress(Message.Address);
+                Out->SetDestinationPort(Message.Port);
+                Out->SetData(Message.Buffer, 0, Message.Size);
+                ReturnValue = Out->PrepareTransmit(*Device);
+                if (ReturnValue < 0) {break;}
+                if (ReturnValue)
+                {
+                    // Next datagram gets the next IP identification.
+                    Block->Frame->SetIdentification(Out->GetIdentification());
+                    Ready[Batched++] = Out;
+                }
+                ReturnValue = 0;
+                Message.Length = Message.Size;
+                ++Sent;
+            }
+            if (Batched) {BatchDevice->TransmitBatch(Ready, Batched);}
+        }
+        FrameType::ReleaseLock();
+        return Sent ? Sent : ReturnValue;
+    }
 };
 
 inline void UDP<4>::Register()
 {
     cprintf((LPSTR)"[UDP] Registering...\n");
-    UDPTable.resize(UDPTable.max_size());
-    for (auto i = 0U; i < UDPTable.size(); ++i)
-    {
-        UDPTable[i].Init();
-    }
     initlock(&UDPLock, (char*)"UDP");
+    UDPTable.Init(DefUDPLimit);
+    UDPPool.Init((char*)"UDP pool");
+    PortTable.Init((char*)"UDP ports");
+    for (int i = 0; i < SendBatchSize; ++i) {BatchFrames[i] = new UDP<4>();}
     cprintf((LPSTR)"[UDP] DONE.\n");
 }
 
 inline void UDP<4>::Main(NetworkAdapter* Device, const Mybase& Frame)
 {
     UDP<4>* UDPFrame = new UDP<4>(Frame);
-    if (!UDPFrame->IsValid())
+    if (!UDPFrame) {return;}
+    if (!LoopbackNetworkAdapter::IsLoopback(Device) && !UDPFrame->IsValid())
     {
         //cprintf((char*)"[UDP] Invalid TCP frame. (0x%x)\n",
         cprintf((char*)"[UDP] WARNING: UDP Checksum incorrect (0x%x)\n",
@@ -1549,20 +4525,29 @@ inline void UDP<4>::Main(NetworkAdapter* Device, const Mybase& Frame)
 
     cprintf((LPSTR)"[UDP] Frame Received.\n");
     AcquireLock();
-    for (auto Block = UDPTable.begin(); Block != UDPTable.end(); ++Block)
+    DWORD Key = HashMix(UDPFrame->GetSourceAddress(), UDPFrame->GetDestinationAddress(),
+        (DWORD(UDPFrame->GetSourcePort()) << 16) | UDPFrame->GetDestinationPort());
+    auto Block = UDPController<4>::Lookup(Device, UDPFrame->GetDestinationPort(), Key);
+    if (Block)
     {
-        if (Block->IsStarted() && (!Block->GetDevice() || Block->GetDevice() == Device)
-            && Block->GetFrame()->GetSourcePort() == UDPFrame->GetDestinationPort())
+        //cprintf((LPSTR)"[UDP] Found specified block.\n");
+        if (!Block->ChargeDatagram())
         {
-            //cprintf((LPSTR)"[UDP] Found specified block.\n");
-            Block->ReceiveQueue.push(UDPFrame);
-            wakeup(Block);
+            ++Block->ReceiveDrops;
+            ++ReceiveDrops;
             ReleaseLock();
+            delete UDPFrame;
             return;
         }
+        Block->ReceiveQueue.push(UDPFrame);
+        wakeup(Block);
+        pollnotify(&Block->PollQueue);
+        ReleaseLock();
+        return;
     }
 
     ReleaseLock();
+    delete UDPFrame;
     // Send network unreachable. (ICMP)
 }
 
@@ -79,9 +79,11 @@ public:
         return MyLast->Data;
     }
 
-    void push(const value_type& x)
+    // Every value takes a container of its own, false if there is no memory.
+    bool push(const value_type& x)
     {
         container* NewContainer = new container();
+        if (!NewContainer) {return false;}
         NewContainer->Data = x;
         if (!MyLast)
         {
@@ -93,6 +95,7 @@ public:
             MyLast->Next = NewContainer;
             MyLast = MyLast->Next;
         }
+        return true;
     }
 
     void pop()
@@ -106,4 +109,76 @@ public:
     void clear() {*this = LinkedQueue();}
 };
 
+// FIFO of up to limit() values in a single kalloc() page, for queues fed
+// from the network that must not grow with what arrives. push() fails
+// instead of allocating once the limit is reached.
+template<typename Tp, size_t PageSize = 4096>
+class BoundedQueue
+{
+public:
+    using value_type      = Tp;
+    using reference       = Tp&;
+    using const_reference = const Tp&;
+    using size_type       = DWORD;
+
+    static const size_type MaxLimit = PageSize / sizeof(Tp);
+
+private:
+    Tp* Slots = nullptr;
+    size_type Head = 0;
+    size_type Count = 0;
+    size_type Limit = 0;
+
+public:
+    BoundedQueue() {}
+    ~BoundedQueue() {Destory();}
+
+    BOOL Create(size_type NewLimit)
+    {
+        Destory();
+        Slots = (Tp*)kalloc();
+        if (!Slots) {return 0;}
+        SetLimit(NewLimit);
+        return 1;
+    }
+
+    void Destory()
+    {
+        if (Slots) {kfree((char*)Slots);}
+        Slots = nullptr;
+        Head = 0;
+        Count = 0;
+        Limit = 0;
+    }
+
+    // Lowering the limit keeps what is queued, pushes fail until it drains.
+    void SetLimit(size_type NewLimit)
+    {
+        Limit = NewLimit < MaxLimit ? NewLimit : MaxLimit;
+    }
+
+    [[__nodiscard__]] BOOL valid()const {return Slots != nullptr;}
+    [[__nodiscard__]] size_type limit()const {return Limit;}
+    [[__nodiscard__]] size_type size()const {return Count;}
+    [[__nodiscard__]] BOOL empty()const {return !Count;}
+    [[__nodiscard__]] BOOL full()const {return Count >= Limit;}
+
+    [[__nodiscard__]] reference front() {return Slots[Head];}
+    [[__nodiscard__]] const_reference front()const {return Slots[Head];}
+
+    BOOL push(const value_type& x)
+    {
+        if (!Slots || full()) {return 0;}
+        Slots[(Head + Count) % MaxLimit] = x;
+        ++Count;
+        return 1;
+    }
+
+    void pop()
+    {
+        Head = (Head + 1) % MaxLimit;
+        --Count;
+    }
+};
+
 #endif // UQUEUE_TCC
@@ -79,4 +79,80 @@ using mt19937l_64 = MersenneTwisterEngineLite
     0x71D67FFFEDA60000, 0xFFF7EEE000000000, 17, 37,
     29, 0x5555555555555555, 43, 0x5851F42D4C957F2D>;
 
+// SipHash-2-4 (Aumasson and Bernstein) over Count 64 bit words. A keyed
+// hash: without the 128 bit key its output can neither be predicted nor
+// forged, which is what sequence numbers and SYN cookies need.
+inline QWORD SipHash(const QWORD Key[2], const QWORD* Words, size_t Count)
+{
+    auto Rotate = [](QWORD X, int K) {return (X << K) | (X >> (64 - K));};
+    QWORD V0 = Key[0] ^ 0x736F6D6570736575ULL;
+    QWORD V1 = Key[1] ^ 0x646F72616E646F6DULL;
+    QWORD V2 = Key[0] ^ 0x6C7967656E657261ULL;
+    QWORD V3 = Key[1] ^ 0x7465646279746573ULL;
+    auto Round = [&]()
+    {
+        V0 += V1; V1 = Rotate(V1, 13); V1 ^= V0; V0 = Rotate(V0, 32);
+        V2 += V3; V3 = Rotate(V3, 16); V3 ^= V2;
+        V0 += V3; V3 = Rotate(V3, 21); V3 ^= V0;
+        V2 += V1; V1 = Rotate(V1, 17); V1 ^= V2; V2 = Rotate(V2, 32);
+    };
+    auto Compress = [&](QWORD Word)
+    {
+        V3 ^= Word;
+        Round();
+        Round();
+        V0 ^= Word;
+    };
+    for (size_t i = 0; i < Count; ++i) {Compress(Words[i]);}
+    Compress(QWORD(Count * sizeof(QWORD)) << 56);
+    V2 ^= 0xFF;
+    for (int i = 0; i < 4; ++i) {Round();}
+    return V0 ^ V1 ^ V2 ^ V3;
+}
+
+inline QWORD ReadTimeStampCounter()
+{
+    DWORD Low, High;
+    asm volatile("rdtsc" : "=a"(Low), "=d"(High));
+    return (QWORD(High) << 32) | Low;
+}
+
+// RDRAND, 0 if the CPU has none or it kept failing.
+inline BOOL ReadHardwareRandom(QWORD& Value)
+{
+    DWORD Eax = 1, Ebx, Ecx = 0, Edx;
+    asm volatile("cpuid" : "+a"(Eax), "=b"(Ebx), "+c"(Ecx), "=d"(Edx));
+    if (!(Ecx & (1u << 30))) {return 0;}
+    for (int Try = 0; Try < 10; ++Try)
+    {
+        BYTE Done;
+        asm volatile("rdrand %0; setc %1" : "=r"(Value), "=qm"(Done) : : "cc");
+        if (Done) {return 1;}
+    }
+    return 0;
+}
+
+// A 128 bit key nobody outside can guess. RDRAND where the CPU has it,
+// mixed with the TSC and its jitter: how long a serializing CPUID takes
+// varies with caches, interrupts and, under a hypervisor, VM exits, and
+// the counter itself tells how long this boot took to get here.
+inline void GatherEntropy(QWORD Key[2])
+{
+    QWORD Pool[2] = {ReadTimeStampCounter(), ticks};
+    for (int i = 0; i < 64; ++i)
+    {
+        QWORD Start = ReadTimeStampCounter();
+        DWORD Eax = 0, Ebx, Ecx = 0, Edx;
+        asm volatile("cpuid" : "+a"(Eax), "=b"(Ebx), "+c"(Ecx), "=d"(Edx));
+        QWORD Sample[2] = {ReadTimeStampCounter() - Start, Start};
+        Pool[i & 1] ^= SipHash(Pool, Sample, 2);
+    }
+    QWORD Input[3] = {0, 0, 0};
+    ReadHardwareRandom(Input[0]);
+    ReadHardwareRandom(Input[1]);
+    Key[0] = SipHash(Pool, Input, 3);
+    Input[2] = 1;
+    Key[1] = SipHash(Pool, Input, 3);
+}
+
 #endif // URANDOM_H
@@ -0,0 +1,186 @@
+#ifndef URINGBUFFER_TCC
+#define URINGBUFFER_TCC
+
+#include "UDef.hh"
+
+_EXTERN_C
+#include "kernel/string.h"
+_ADD_KALLOC
+_ADD_KFREE
+_END_EXTERN_C
+
+// Byte ring buffer spread over separately allocated pages. kalloc() only
+// hands out single pages, so the buffer keeps a page table (one page of
+// pointers) instead of relying on physically contiguous memory.
+template<size_t PageSize = 4096>
+class RingBuffer
+{
+public:
+    using size_type = DWORD;
+
+    static const size_type MaxPages = PageSize / sizeof(BYTE*);
+
+private:
+    BYTE** Pages = nullptr;
+    size_type PageCount = 0;
+    size_type Head = 0; // Position of the first stored byte
+    size_type Used = 0;
+
+    BYTE* Locate(size_type Offset)const
+    {
+        size_type Position = (Head + Offset) % capacity();
+        return Pages[Position / PageSize] + Position % PageSize;
+    }
+
+public:
+    RingBuffer() {}
+    ~RingBuffer() {Destory();}
+
+    // The pages have one owner: copying would free them twice, moving hands
+    // them over and leaves the source empty.
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    RingBuffer(RingBuffer&& Other) noexcept {*this = static_cast<RingBuffer&&>(Other);}
+
+    RingBuffer& operator=(RingBuffer&& Other) noexcept
+    {
+        if (this == &Other) {return *this;}
+        Destory();
+        Pages = Other.Pages;
+        PageCount = Other.PageCount;
+        Head = Other.Head;
+        Used = Other.Used;
+        Other.Pages = nullptr;
+        Other.PageCount = 0;
+        Other.Head = 0;
+        Other.Used = 0;
+        return *this;
+    }
+
+    // Allocate at least NewCapacity bytes (rounded up to whole pages).
+    BOOL Create(size_type NewCapacity)
+    {
+        Destory();
+        size_type NewPageCount = (NewCapacity + PageSize - 1) / PageSize;
+        if (!NewPageCount) {NewPageCount = 1;}
+        if (NewPageCount > MaxPages) {NewPageCount = MaxPages;}
+        Pages = (BYTE**)kalloc();
+        if (!Pages) {return 0;}
+        for (PageCount = 0; PageCount < NewPageCount; ++PageCount)
+        {
+            Pages[PageCount] = (BYTE*)kalloc();
+            if (!Pages[PageCount]) {break;}
+        }
+        Head = 0;
+        Used = 0;
+        if (!PageCount)
+        {
+            Destory();
+            return 0;
+        }
+        return PageCount == NewPageCount;
+    }
+
+    void Destory()
+    {
+        if (Pages)
+        {
+            for (size_type i = 0; i < PageCount; ++i) {kfree((char*)Pages[i]);}
+            kfree((char*)Pages);
+        }
+        Pages = nullptr;
+        PageCount = 0;
+        Head = 0;
+        Used = 0;
+    }
+
+    [[__nodiscard__]] BOOL valid()const {return Pages != nullptr;}
+    [[__nodiscard__]] size_type capacity()const {return PageCount * PageSize;}
+    [[__nodiscard__]] size_type size()const {return Used;}
+    [[__nodiscard__]] size_type available()const {return capacity() - Used;}
+    [[__nodiscard__]] BOOL empty()const {return !Used;}
+
+    // Longest run of stored bytes starting at Offset that does not cross a
+    // page boundary. Size is clipped to that run.
+    const BYTE* Contiguous(size_type Offset, size_type& Size)const
+    {
+        if (Offset >= Used) {Size = 0; return nullptr;}
+        if (Size > Used - Offset) {Size = Used - Offset;}
+        size_type Position = (Head + Offset) % capacity();
+        size_type Run = PageSize - Position % PageSize;
+        if (Size > Run) {Size = Run;}
+        return Locate(Offset);
+    }
+
+    // Append up to Size bytes, returns the count actually stored.
+    size_type Write(LPCVOID Src, size_type Size)
+    {
+        if (!valid()) {return 0;}
+        if (Size > available()) {Size = available();}
+        size_type Done = 0;
+        while (Done < Size)
+        {
+            size_type Position = (Head + Used) % capacity();
+            size_type Run = PageSize - Position % PageSize;
+            if (Run > Size - Done) {Run = Size - Done;}
+            memcopy(Pages[Position / PageSize] + Position % PageSize,
+                (const BYTE*)Src + Done, Run);
+            Used += Run;
+            Done += Run;
+        }
+        return Done;
+    }
+
+    // Copy Size bytes starting at Offset without consuming them.
+    size_type Peek(LPVOID Dst, size_type Offset, size_type Size)const
+    {
+        size_type Done = 0;
+        while (Done < Size)
+        {
+            size_type Run = Size - Done;
+            const BYTE* Src = Contiguous(Offset + Done, Run);
+            if (!Run) {break;}
+            memcopy((BYTE*)Dst + Done, Src, Run);
+            Done += Run;
+        }
+        return Done;
+    }
+
+    // Writable run starting Offset bytes past the stored data, so callers can
+    // fill the buffer in place. Size is clipped to the run and to the free
+    // space; Commit() makes the bytes part of the stored data.
+    BYTE* Reserve(size_type Offset, size_type& Size)
+    {
+        if (!valid() || Offset >= available()) {Size = 0; return nullptr;}
+        if (Size > available() - Offset) {Size = available() - Offset;}
+        size_type Position = (Head + Used + Offset) % capacity();
+        size_type Run = PageSize - Position % PageSize;
+        if (Size > Run) {Size = Run;}
+        return Pages[Position / PageSize] + Position % PageSize;
+    }
+
+    size_type Commit(size_type Size)
+    {
+        if (Size > available()) {Size = available();}
+        Used += Size;
+        return Size;
+    }
+
+    // Drop up to Size bytes from the front. Head + Used stays where it is,
+    // so space handed out by Reserve() keeps its place while it is filled.
+    size_type Discard(size_type Size)
+    {
+        if (Size > Used) {Size = Used;}
+        if (Size) {Head = (Head + Size) % capacity();}
+        Used -= Size;
+        return Size;
+    }
+
+    size_type Read(LPVOID Dst, size_type Size)
+    {
+        return Discard(Peek(Dst, 0, Size));
+    }
+};
+
+#endif // URINGBUFFER_TCC
@@ -9,6 +9,9 @@ _EXTERN_C
 
 #include "file.h"
 
+struct inode;
+struct pollqueue;
+
 enum DomainType
 {
     Unspecified,
@@ -22,15 +25,63 @@ enum ConnectionType
     Datagram // UDP
 };
 
+enum SocketOptionName
+{
+    TCPCongestion       = 1, // Stream only, value is a CongestionControlType
+    SocketReceiveBuffer = 2, // Bytes; Stream before listen(), Datagram and Localhost at any time
+    TCPQuickAck         = 3, // Stream only, nonzero disables delayed ACKs
+    TCPNoDelay          = 4, // Stream only, nonzero disables Nagle
+    TCPCork             = 5, // Stream only, nonzero holds partial segments
+    SocketKeepAlive     = 6, // Stream only, nonzero probes idle connections
+    TCPKeepIdle         = 7, // Stream only, seconds idle before the first probe
+    TCPKeepInterval     = 8, // Stream only, seconds between probes
+    TCPKeepCount        = 9, // Stream only, unanswered probes before a reset
+    SocketReceiveDrops  = 10, // Datagram only, read-only, dropped on a full receive buffer
+    SocketReusePort     = 11, // Nonzero before bind() shares the port with others that set it
+    SocketMemory        = 12  // Read-only, bytes of kernel memory charged to the socket
+};
+
+enum CongestionControlType
+{
+    CongestionNewReno,
+    CongestionCubic
+};
+
+// send() and recv() flags
+enum SocketMessageFlags
+{
+    MessageDontWait = 0x40 // MSG_DONTWAIT, return FWOULDBLOCK instead of sleeping
+};
+
+// One datagram of sendmmsg() and recvmmsg(), same layout as in Socket.h
+struct DatagramMessage
+{
+    DWORD  Address;
+    WORD   Port;
+    LPVOID Buffer;
+    int    Size;   // Bytes to send, or room in Buffer
+    int    Length; // Bytes sent or received
+};
+
 struct file* CreateSocket(int Domain, int Type, int Protocol);
 void DestorySocket(struct file* f);
 int BindSocket(const struct file* f, DWORD Address, WORD Port);
 int SocketStartListen(const struct file* f, int Backlog);
-struct file* SocketAccept(const struct file* f, DWORD* DestinationAddress, WORD* DestinationPort);
-int SocketRead(const struct file* f, LPVOID Buffer, int Size);
+int SocketAccept(const struct file* f, struct file** Accepted, DWORD* DestinationAddress, WORD* DestinationPort);
+int SocketRead(const struct file* f, LPVOID Buffer, int Size, int Flags);
 int SocketReceiveFrom(const struct file* f, DWORD* Address, WORD* Port, LPVOID Buffer, int Size);
-int SocketWrite(const struct file* f, LPCVOID Buffer, int Size);
+int SocketWrite(const struct file* f, LPCVOID Buffer, int Size, int Flags);
+int SocketSendFile(const struct file* f, struct inode* ip, uint Offset, int Count);
+int SocketReadVector(const struct file* f, const struct iovec* Vectors, int Count, int Flags);
+int SocketWriteVector(const struct file* f, const struct iovec* Vectors, int Count, int Flags);
 int SocketSendTo(const struct file* f, DWORD Address, WORD Port, LPVOID Buffer, int Size);
+int SocketSendBatch(const struct file* f, struct DatagramMessage* Messages, int Count);
+int SocketReceiveBatch(const struct file* f, struct DatagramMessage* Messages, int Count, int Flags);
+int SetSocketOption(const struct file* f, int Option, int Value);
+int GetSocketOption(const struct file* f, int Option);
+int SocketConnect(const struct file* f, DWORD Address, WORD Port);
+int SocketPoll(const struct file* f);
+struct pollqueue* SocketPollQueue(const struct file* f);
 
 int SOC_CreateSocket();
 int SOC_BindSocket();
@@ -40,6 +91,18 @@ int SOC_SocketRead();
 int SOC_SocketReceiveFrom();
 int SOC_SocketWrite();
 int SOC_SocketSendTo();
+int SOC_SetSocketOption();
+int SOC_GetSocketOption();
+int SOC_SocketConnect();
+int SOC_SocketSend();
+int SOC_SocketReceive();
+int SOC_SocketSendFile();
+int SOC_SocketSendVector();
+int SOC_SocketReceiveVector();
+int SOC_SocketSendBatch();
+int SOC_SocketReceiveBatch();
+int SOC_BindLocalSocket();
+int SOC_ConnectLocalSocket();
 
 #ifdef __cplusplus
 _END_EXTERN_C
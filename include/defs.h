@@ -2,7 +2,9 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
+struct pollqueue;
 struct proc;
 struct spinlock;
 struct stat;
@@ -32,7 +34,11 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
 int             fileseek(struct file *f, int offset);
+int             filepoll(struct file*);
+struct pollqueue* filepollqueue(struct file*);
 
 // vfs.c
 void            readsb(int dev, struct superblock *sb);
@@ -106,6 +112,8 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipepoll(struct pipe*, int);
+struct pollqueue* pipepollqueue(struct pipe*);
 
 // proc.c
 struct proc*    copyproc(struct proc*);
@@ -153,8 +161,15 @@ int             argstr(int, char**);
 int             arguintp(int, uintp*);
 int             fetchuintp(uintp, uintp*);
 int             fetchstr(uintp, char**);
+int             argiovec(int, int, struct iovec**);
+int             checkptr(uintp, int);
 void            syscall(void);
 
+// sysfile.c
+struct inode*   socknodecreate(char*);
+struct inode*   socknodelookup(char*);
+void            socknodeput(struct inode*);
+
 // timer.c
 void            timerinit(void);
 
@@ -0,0 +1,35 @@
+#ifndef EPOLL_H
+#define EPOLL_H
+
+// Event bits are the ones of poll(), see unix/poll.h.
+#define EPOLLIN       0x001
+#define EPOLLPRI      0x008
+#define EPOLLOUT      0x010
+#define EPOLLERR      0x040
+#define EPOLLHUP      0x080
+#define EPOLLONESHOT  (1u << 30) // Disarm after one event until EPOLL_CTL_MOD
+#define EPOLLET       (1u << 31) // Report readiness once per change
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+typedef union epoll_data
+{
+    void* ptr;
+    int fd;
+    unsigned int u32;
+    unsigned long long u64;
+} epoll_data_t;
+
+struct epoll_event
+{
+    unsigned int events;
+    epoll_data_t data;
+};
+
+int epoll_create(int Size);
+int epoll_ctl(int EventPollFD, int Operation, int FD, struct epoll_event* Event);
+int epoll_wait(int EventPollFD, struct epoll_event* Events, int MaxEvents, int Timeout);
+
+#endif // EPOLL_H
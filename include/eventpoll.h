@@ -0,0 +1,41 @@
+#ifndef EVENTPOLL_H
+#define EVENTPOLL_H
+
+// struct spinlock must already be defined, spinlock.h has no include guard.
+
+struct epoll_event;
+struct eventpoll;
+struct file;
+struct pollentry;
+struct pollfd;
+
+// Waiters on a pollable object: a pipe, a TCB or a UDP controller. The
+// object calls pollnotify() wherever its readiness may have changed,
+// which runs the callback of every entry. Lock order: the object's own
+// lock, then the queue's, then the lock of whoever waits.
+struct pollqueue {
+	struct spinlock lock;
+	struct pollentry* head;
+};
+
+struct pollentry {
+	struct pollentry* next;
+	struct pollentry** pprev; // Link that points here, 0 if not queued
+	struct pollqueue* queue;
+	void (*func)(struct pollentry*);
+};
+
+// eventpoll.c
+void            eventpollinit(void);
+void            pollqueueinit(struct pollqueue*);
+void            pollqueueadd(struct pollqueue*, struct pollentry*, void (*)(struct pollentry*));
+void            pollqueueremove(struct pollentry*);
+void            pollnotify(struct pollqueue*);
+int             pollfds(struct pollfd*, int, int);
+struct file*    epollcreate(void);
+int             epollctl(struct file*, int, int, struct file*, struct epoll_event*);
+int             epollwait(struct file*, struct epoll_event*, int, int);
+void            epollclose(struct eventpoll*);
+void            eventpoll_release(struct file*);
+
+#endif // EVENTPOLL_H
@@ -4,6 +4,13 @@
 #define O_WRONLY   _BIT(2)
 #define O_RDWR     _BIT(3)
 #define O_CREATE   _BIT(4)
+#define O_NONBLOCK _BIT(5)
+
+// fcntl() commands
+#define F_GETFL    1
+#define F_SETFL    2
 
 #define F_ERROR    (-1)
 #define FNOT_READY (-2)
+#define FWOULDBLOCK (-11)  // Non-blocking call found nothing to do, EAGAIN
+#define FINPROGRESS (-115) // Non-blocking connect() started, EINPROGRESS
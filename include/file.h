@@ -2,16 +2,19 @@
 #define __FILE_H
 
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_SOCKET } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_SOCKET, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
+  int flags; // O_NONBLOCK
   struct pipe *pipe;
   struct inode *ip;
+  struct eventpoll *ep;
   uint off;
 
   struct SocketInfo
   {
+      int Domain;
       int Type;
       int Desc;
   }Socket;
@@ -47,6 +50,14 @@ extern struct devsw devsw[];
 #define TTY0    1
 #define TTY1    2
 #define LOOP0   3
+#define LOCALSOCK 4 // Socket node of a Localhost domain socket, no devsw entry
+
+// Same layout as in unix/sys/uio.h
+struct iovec {
+    void* iov_base;
+    uintp iov_len;
+};
+#define IOV_MAX 16
 
 struct pollfd {
     int   fd;         /* file descriptor */
@@ -54,4 +65,12 @@ struct pollfd {
     short revents;    /* returned events */
 };
 
+// Same values as in unix/poll.h
+#define POLLIN      0x001
+#define POLLPRI     0x008
+#define POLLOUT     0x010
+#define POLLERR     0x040
+#define POLLHUP     0x080
+#define POLLNVAL    0x100
+
 #endif
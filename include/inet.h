@@ -14,6 +14,26 @@ void RTPrint();
 //void RTDelete();
 void Ping(unsigned int IP);
 
+enum NetTunableName
+{
+    TunableTCPMaxConnections = 0, // Live TCBs, listeners and children included
+    TunableUDPMaxSockets     = 1,
+    TunableTCPMaxTimeWait    = 2, // Time-wait records, more close without TIME-WAIT
+    TunableUDPReceiveBuffer  = 3, // Bytes, receive buffer of new UDP sockets
+    TunableUDPReceiveDrops   = 4, // Datagrams dropped on full receive buffers
+    TunableMemorySoftLimit   = 5, // Bytes of network memory before buffers start small
+    TunableMemoryHardLimit   = 6, // Bytes of network memory before allocations fail
+    TunableMemoryTCP         = 7, // Read-only, bytes held by TCP
+    TunableMemoryUDP         = 8, // Read-only, bytes held by UDP
+    TunableMemoryLocal       = 9, // Read-only, bytes held by Localhost domain sockets
+    TunableMemoryFrames      = 10, // Read-only, bytes held in frames and adapter buffers
+    TunableMemoryFailures    = 11, // Allocations refused at the hard limit
+    TunableMemoryPressure    = 12, // Read-only, 0 none, 1 soft, 2 hard limit reached
+};
+
+// Returns the tunable's value after setting it, Value < 0 only reads it.
+int NetTunable(int Name, int Value);
+
 unsigned StringToIPHex(const char* Str, _Bool* OK);
 
 #endif // NETWORK_H
@@ -1,8 +1,9 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU        128  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NOFILE      256  // open files per process
+#define NFILE      1024  // open files per system
+#define NEPITEM    1024  // descriptors watched by all epoll instances
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define MAXARG       32  // max exec arguments
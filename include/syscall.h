@@ -48,6 +48,7 @@
 #define SYS_RTPrint       46
 #define SYS_RTDelete      47
 #define SYS_Ping          48
+#define SYS_NetTunable    49
 
 #define SYS_socket        50
 #define SYS_bind          51
@@ -57,3 +58,23 @@
 #define SYS_sockrecv      55
 #define SYS_sockrecvfrom  56
 #define SYS_socksendto    57
+#define SYS_setsockopt    58
+#define SYS_connect       59
+
+#define SYS_kpoll         60
+#define SYS_epoll_create  61
+#define SYS_epoll_ctl     62
+#define SYS_epoll_wait    63
+#define SYS_fcntl         64
+#define SYS_send          65
+#define SYS_recv          66
+#define SYS_sendmmsg      67
+#define SYS_recvmmsg      68
+#define SYS_readv         69
+#define SYS_writev        70
+#define SYS_sendmsg       71
+#define SYS_recvmsg       72
+#define SYS_sendfile      73
+#define SYS_getsockopt    74
+#define SYS_bindlocal     75
+#define SYS_connectlocal  76
@@ -39,3 +39,4 @@ int nprocs(void);
 void cpuhalt(void);
 int getpriority(int);
 int setpriority(int, int);
+int fcntl(int, int, int);
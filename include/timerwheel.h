@@ -0,0 +1,30 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+struct spinlock;
+struct timerbase;
+
+// Callback at a future tick, see timerwheel.c. Set up with timer_init(),
+// the fields belong to the wheel afterwards.
+struct timer {
+	struct timer* next;
+	struct timer** pprev;     // Link that points here, 0 if not pending
+	struct timerbase* base;   // Wheel it was last added to
+	uint expires;             // Tick to fire at
+	void (*func)(void*);
+	void* arg;
+};
+
+// timerwheel.c
+void            timerwheelinit(void);
+void            timer_init(struct timer*, void (*)(void*), void*);
+int             timer_add(struct timer*, uint);
+int             timer_cancel(struct timer*);
+int             timer_detach(struct timer*);
+int             timer_pending(struct timer*);
+void            timer_tick(void);
+
+// proc.c
+int             sleep_until(void*, struct spinlock*, uint);
+
+#endif // TIMERWHEEL_H
@@ -21,3 +21,6 @@ typedef unsigned long nfds_t;
 
 //defined in posix.c:
 int poll(struct pollfd fds[], nfds_t nfds, int timeout);
+
+//system call behind poll(), timeout in milliseconds
+int kpoll(struct pollfd fds[], int nfds, int timeout);
@@ -0,0 +1,11 @@
+//sys/uio.h - POSIX Base Definitions, Issue 6
+
+#define IOV_MAX 16
+
+struct iovec {
+    void* iov_base;         // Base address of a memory region for input or output.
+    unsigned long iov_len;  // The size of the memory pointed to by iov_base.
+};
+
+int readv(int fd, const struct iovec* iov, int iovcnt);
+int writev(int fd, const struct iovec* iov, int iovcnt);
@@ -0,0 +1,135 @@
+#include "UCongestion.hh"
+#include "USocket.hh"
+
+NewRenoCongestionControl NewRenoCongestionControl::Instance;
+CubicCongestionControl CubicCongestionControl::Instance;
+
+void CongestionControl::Init(CongestionState& State)
+{
+    // RFC 5681 3.1, ssthresh starts arbitrarily high.
+    State.SlowStartThreshold = 0xFFFFFFFF;
+    State.BytesAcked = 0;
+    State.Cubic = {};
+}
+
+CongestionControl* CongestionControl::Find(int Type)
+{
+    switch (Type)
+    {
+    case CongestionNewReno:
+        return &NewRenoCongestionControl::Instance;
+    case CongestionCubic:
+        return &CubicCongestionControl::Instance;
+    default:
+        return nullptr;
+    }
+}
+
+// -------------------------- NewReno -------------------------- //
+
+void NewRenoCongestionControl::CongestionAvoidance(CongestionState& State, DWORD Acked)
+{
+    // One SMSS per window of acknowledged bytes (RFC 5681 3.1, RFC 3465).
+    State.BytesAcked += Acked;
+    if (State.BytesAcked >= State.Window)
+    {
+        State.BytesAcked -= State.Window;
+        State.Window += State.MaxSegmentSize;
+    }
+}
+
+DWORD NewRenoCongestionControl::SlowStartThreshold(CongestionState& State)
+{
+    // RFC 5681 eq.4
+    DWORD Threshold = State.FlightSize / 2;
+    return Threshold > 2 * State.MaxSegmentSize ? Threshold : 2 * State.MaxSegmentSize;
+}
+
+// -------------------------- CUBIC -------------------------- //
+
+QWORD CubicCongestionControl::CubeRoot(QWORD Value)
+{
+    QWORD Low = 0, High = 2097152; // 2^21, (2^21)^3 > 2^63
+    while (Low < High)
+    {
+        QWORD Middle = (Low + High + 1) / 2;
+        if (Middle * Middle * Middle <= Value) {Low = Middle;}
+        else {High = Middle - 1;}
+    }
+    return Low;
+}
+
+DWORD CubicCongestionControl::Now()
+{
+    return ticks * (1000 / _TICKS_PER_SECOND);
+}
+
+// W_cubic(t) = C * (t - K)^3 + W_max (RFC 9438 eq.1), Time in milliseconds.
+long long CubicCongestionControl::WindowAt(const CongestionState& State, long long Time)
+{
+    long long Offset = Time - State.Cubic.Origin;
+    if (Offset > 100000) {Offset = 100000;}
+    if (Offset < -100000) {Offset = -100000;}
+    long long Delta = Offset * Offset * Offset;
+    Delta = Delta * State.MaxSegmentSize / 1000000;
+    Delta = Delta * ScaleC / (Scale * 1000);
+    return State.Cubic.WindowMax + Delta;
+}
+
+void CubicCongestionControl::CongestionAvoidance(CongestionState& State, DWORD Acked)
+{
+    auto& Cubic = State.Cubic;
+    DWORD Time = Now();
+    if (!Cubic.EpochStart)
+    {
+        Cubic.EpochStart = Time ? Time : 1;
+        Cubic.RenoWindow = State.Window;
+        Cubic.Remainder = 0;
+        if (State.Window < Cubic.WindowMax)
+        {
+            // K = cbrt((W_max - cwnd_epoch) / C) (RFC 9438 eq.2)
+            QWORD Cube = QWORD(Cubic.WindowMax - State.Window) * 1000000000ULL;
+            Cube = Cube / State.MaxSegmentSize * Scale / ScaleC;
+            Cubic.Origin = DWORD(CubeRoot(Cube));
+        }
+        else
+        {
+            Cubic.Origin = 0;
+            Cubic.WindowMax = State.Window;
+        }
+    }
+
+    // Aim one RTT ahead, never more than 1.5 * cwnd (RFC 9438 4.2).
+    long long Elapsed = (long long)(Time - Cubic.EpochStart) + State.SmoothedRTT;
+    long long Limit = State.Window + State.Window / 2;
+    long long Target = WindowAt(State, Elapsed);
+    if (Target < State.Window) {Target = State.Window;}
+    if (Target > Limit) {Target = Limit;}
+
+    // Reno-friendly region (RFC 9438 4.3)
+    Cubic.RenoWindow += DWORD(QWORD(ScaleAlpha) * State.MaxSegmentSize * Acked /
+        (QWORD(Scale) * State.Window));
+    if (Cubic.RenoWindow > Target)
+    {
+        Target = Cubic.RenoWindow < Limit ? Cubic.RenoWindow : Limit;
+    }
+
+    QWORD Growth = QWORD(Target - State.Window) * Acked + Cubic.Remainder;
+    Cubic.Remainder = Growth % State.Window;
+    State.Window += DWORD(Growth / State.Window);
+}
+
+DWORD CubicCongestionControl::SlowStartThreshold(CongestionState& State)
+{
+    auto& Cubic = State.Cubic;
+    Cubic.EpochStart = 0;
+    // Fast convergence (RFC 9438 4.7)
+    if (State.Window < Cubic.WindowMax)
+    {
+        Cubic.WindowMax = DWORD(QWORD(State.Window) * (Scale + ScaleBeta) / (2 * Scale));
+    }
+    else {Cubic.WindowMax = State.Window;}
+    // RFC 9438 4.6
+    DWORD Threshold = DWORD(QWORD(State.FlightSize) * ScaleBeta / Scale);
+    return Threshold > 2 * State.MaxSegmentSize ? Threshold : 2 * State.MaxSegmentSize;
+}
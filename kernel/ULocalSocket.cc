@@ -0,0 +1,613 @@
+#include "USocket.hh"
+
+_EXTERN_C
+#include "kernel/string.h"
+#include "spinlock.h"
+#include "eventpoll.h"
+#include "fcntl.h"
+_ADD_KALLOC
+_ADD_KFREE
+_ADD_INITLOCK
+_ADD_KERN_PRINT_FUNC
+void wakeup(void*);
+void sleep(void*, struct spinlock*);
+void socknodeput(struct inode* ip);
+_END_EXTERN_C
+
+#include "ULocalSocket.hh"
+#include "UNetMemory.hh"
+
+spinlock LocalSocket::LocalLock;
+IndexTable<LocalSocket> LocalSocket::LocalTable;
+ObjectPool<LocalSocket> LocalSocket::LocalPool;
+HashTable<LocalSocket, LocalSocket::NodeBuckets> LocalSocket::NodeTable;
+
+// Position in the iovec array of one call, Gather() and Scatter() move it on.
+struct VectorCursor
+{
+    const iovec* Vectors;
+    int Count;
+    int Vector = 0;
+    uintp Offset = 0;
+
+    VectorCursor(const iovec* Vectors, int Count) : Vectors(Vectors), Count(Count) {}
+
+    template<typename Copier>
+    void Walk(int Size, Copier Copy)
+    {
+        int Done = 0;
+        while (Done < Size && Vector < Count)
+        {
+            uintp Left = Vectors[Vector].iov_len - Offset;
+            int Piece = (uintp)(Size - Done) < Left ? Size - Done : (int)Left;
+            Copy((BYTE*)Vectors[Vector].iov_base + Offset, Done, Piece);
+            Done += Piece;
+            Offset += Piece;
+            if (Offset == Vectors[Vector].iov_len)
+            {
+                ++Vector;
+                Offset = 0;
+            }
+        }
+    }
+
+    void Gather(BYTE* Destination, int Size)
+    {
+        Walk(Size, [Destination](BYTE* User, int At, int Piece) {memmove(Destination + At, User, Piece);});
+    }
+
+    void Scatter(const BYTE* Source, int Size)
+    {
+        Walk(Size, [Source](BYTE* User, int At, int Piece) {memmove(User, Source + At, Piece);});
+    }
+};
+
+static int VectorSize(const iovec* Vectors, int Count)
+{
+    int Size = 0;
+    for (int i = 0; i < Count; ++i) {Size += Vectors[i].iov_len;}
+    return Size;
+}
+
+// nullptr over the hard limit of NetMemory, or out of memory.
+static LocalBuffer* NewBuffer()
+{
+    static_assert(sizeof(LocalBuffer) <= 4096);
+    if (!NetMemory::Charge(NetMemory::OwnerLocal, LocalSocket::BufferCharge)) {return nullptr;}
+    LocalBuffer* Buffer = (LocalBuffer*)kalloc();
+    if (!Buffer)
+    {
+        NetMemory::Uncharge(NetMemory::OwnerLocal, LocalSocket::BufferCharge);
+        return nullptr;
+    }
+    Buffer->Next = nullptr;
+    Buffer->Size = 0;
+    Buffer->Offset = 0;
+    return Buffer;
+}
+
+static void FreeBuffer(LocalBuffer* Buffer)
+{
+    kfree((char*)Buffer);
+    NetMemory::Uncharge(NetMemory::OwnerLocal, LocalSocket::BufferCharge);
+}
+
+LocalSocket::LocalSocket()
+{
+    pollqueueinit(&PollQueue);
+}
+
+void LocalSocket::Register()
+{
+    cprintf((LPSTR)"[Local Socket] Registering...\n");
+    initlock(&LocalLock, (char*)"local socket");
+    LocalTable.Init(DefLocalLimit);
+    LocalPool.Init((char*)"local socket pool");
+    NodeTable.Init((char*)"local socket nodes");
+    cprintf((LPSTR)"[Local Socket] DONE.\n");
+}
+
+// New socket with a descriptor, nullptr if the limit is reached or memory
+// ran out. The caller holds LocalLock.
+LocalSocket* LocalSocket::Allocate(int Type)
+{
+    LocalSocket* Socket = LocalPool.New();
+    if (!Socket) {return nullptr;}
+    Socket->Index = LocalTable.Insert(Socket);
+    if (Socket->Index < 0)
+    {
+        LocalPool.Delete(Socket);
+        return nullptr;
+    }
+    Socket->Type = Type;
+    return Socket;
+}
+
+// Drop the socket, what it still queues and its descriptor. The caller
+// holds LocalLock and puts the nodes once it is released.
+void LocalSocket::Release()
+{
+    Unhash();
+    while (First)
+    {
+        LocalBuffer* Next = First->Next;
+        FreeBuffer(First);
+        First = Next;
+    }
+    LocalTable.Erase(Index);
+    LocalPool.Delete(this);
+}
+
+DWORD LocalSocket::NodeHash(const inode* Node)
+{
+    return HashMix(Node->dev, Node->inum, 0);
+}
+
+void LocalSocket::Hash(inode* NewNode)
+{
+    Node = NewNode;
+    NodeTable.Insert(NodeHash(Node), this);
+    Hashed = 1;
+}
+
+void LocalSocket::Unhash()
+{
+    if (Hashed) {NodeTable.Erase(NodeHash(Node), this);}
+    Hashed = 0;
+}
+
+// Socket of Type bound to Node, nullptr if none. The caller holds
+// LocalLock, which keeps it alive.
+LocalSocket* LocalSocket::Lookup(const inode* Node, int Type)
+{
+    return NodeTable.Find(NodeHash(Node), [&](const LocalSocket& Socket)
+    {
+        return Socket.Node == Node && Socket.Type == Type;
+    });
+}
+
+// ReceiveBufferSize, a quarter of it under memory pressure.
+DWORD LocalSocket::ReceiveLimit()const
+{
+    if (!NetMemory::UnderPressure()) {return ReceiveBufferSize;}
+    DWORD Limit = ReceiveBufferSize / 4;
+    return Limit > MinReceiveBufferSize ? Limit : MinReceiveBufferSize;
+}
+
+// Whether Size more bytes may be queued here. A stream fills up the last
+// buffer before it is charged for a new one, one buffer always fits.
+BOOL LocalSocket::HasRoom(int Size)const
+{
+    if (!Charged || Charged + BufferCharge <= ReceiveLimit()) {return 1;}
+    return Type == Stream && Last && Last->Size + Size <= LocalBuffer::Capacity;
+}
+
+// Data arrived, or the socket's end did.
+void LocalSocket::Notify()
+{
+    wakeup(this);
+    pollnotify(&PollQueue);
+}
+
+// End the connection of a stream socket. The peer reads what is queued and
+// then the end of it, its writers give up.
+void LocalSocket::Disconnect()
+{
+    if (!Peer) {return;}
+    LocalSocket* Other = Peer;
+    Other->Peer = nullptr;
+    Peer = nullptr;
+    wakeup(&Charged); // Other's writers sleep here
+    Other->Notify();
+}
+
+int LocalSocket::Open(int Type)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = Allocate(Type);
+    int Index = Socket ? Socket->Index : -1;
+    release(&LocalLock);
+    return Index;
+}
+
+int LocalSocket::Close(int Index)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    if (!Socket)
+    {
+        release(&LocalLock);
+        return -2;
+    }
+    inode* Node = Socket->Node;
+    inode* PeerNode = Socket->PeerNode;
+    Socket->Unhash();
+    // Connections nobody accepted end here, their clients see them closed.
+    while (Socket->PendingFirst)
+    {
+        LocalSocket* Pending = Socket->PendingFirst;
+        Socket->PendingFirst = Pending->PendingNext;
+        Pending->Disconnect();
+        Pending->Release();
+    }
+    wakeup(&Socket->PendingCount); // Connect() waiting for the backlog
+    wakeup(&Socket->Charged);      // Datagram writers waiting for room
+    Socket->Disconnect();
+    Socket->Release();
+    release(&LocalLock);
+    if (Node) {socknodeput(Node);}
+    if (PeerNode) {socknodeput(PeerNode);}
+    return 0;
+}
+
+BOOL LocalSocket::IsBound(int Index)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    BOOL Bound = Socket && Socket->Node;
+    release(&LocalLock);
+    return Bound;
+}
+
+int LocalSocket::Bind(int Index, inode* Node)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    int ReturnValue = 0;
+    if (!Socket) {ReturnValue = -2;}
+    else if (Socket->Node || Socket->State != Idle) {ReturnValue = -3;}
+    else {Socket->Hash(Node);}
+    release(&LocalLock);
+    if (ReturnValue) {socknodeput(Node);}
+    return ReturnValue;
+}
+
+int LocalSocket::Listen(int Index, int Backlog)
+{
+    if (Backlog < 1) {Backlog = 1;}
+    if (Backlog > MaxBacklog) {Backlog = MaxBacklog;}
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    int ReturnValue = 0;
+    if (!Socket) {ReturnValue = -2;}
+    else if (Socket->Type != Stream || !Socket->Node || Socket->State == Connected) {ReturnValue = -3;}
+    else
+    {
+        Socket->State = Listening;
+        Socket->Backlog = Backlog;
+    }
+    release(&LocalLock);
+    return ReturnValue;
+}
+
+// A stream socket is connected once this returns 0: the other end waits
+// for Accept() on the listener, data may flow before it is accepted. A
+// datagram socket sends to the socket bound to Node from now on. -4 if
+// nothing listens or is bound there.
+int LocalSocket::Connect(int Index, inode* Node, BOOL NonBlocking)
+{
+    inode* Unused = Node;
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    int ReturnValue = 0;
+    if (!Socket) {ReturnValue = -2;}
+    else if (Socket->Type == Datagram)
+    {
+        if (!Lookup(Node, Datagram)) {ReturnValue = -4;}
+        else
+        {
+            Unused = Socket->PeerNode;
+            Socket->PeerNode = Node;
+        }
+    }
+    else if (Socket->State != Idle) {ReturnValue = -3;}
+    else
+    {
+        LocalSocket* Listener;
+        while (1)
+        {
+            Listener = Lookup(Node, Stream);
+            if (!Listener || Listener->State != Listening)
+            {
+                ReturnValue = -4;
+                break;
+            }
+            if (Listener->PendingCount < Listener->Backlog) {break;}
+            if (NonBlocking)
+            {
+                ReturnValue = FWOULDBLOCK;
+                break;
+            }
+            sleep(&Listener->PendingCount, &LocalLock);
+            // Closed meanwhile?
+            if (LocalTable[Index] != Socket || Socket->State != Idle)
+            {
+                ReturnValue = -3;
+                break;
+            }
+        }
+        LocalSocket* Accepted = ReturnValue ? nullptr : Allocate(Stream);
+        if (!ReturnValue && !Accepted) {ReturnValue = -1;}
+        if (Accepted)
+        {
+            Accepted->ReceiveBufferSize = Listener->ReceiveBufferSize;
+            Accepted->State = Connected;
+            Accepted->Peer = Socket;
+            Socket->State = Connected;
+            Socket->Peer = Accepted;
+            if (Listener->PendingLast) {Listener->PendingLast->PendingNext = Accepted;}
+            else {Listener->PendingFirst = Accepted;}
+            Listener->PendingLast = Accepted;
+            ++Listener->PendingCount;
+            Listener->Notify();
+        }
+    }
+    release(&LocalLock);
+    if (Unused) {socknodeput(Unused);}
+    return ReturnValue;
+}
+
+// Descriptor of the next connection on a listener.
+int LocalSocket::Accept(int Index, BOOL NonBlocking)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    if (!Socket || Socket->State != Listening)
+    {
+        release(&LocalLock);
+        return -3;
+    }
+    while (!Socket->PendingFirst)
+    {
+        if (NonBlocking)
+        {
+            release(&LocalLock);
+            return FWOULDBLOCK;
+        }
+        sleep(Socket, &LocalLock);
+        if (LocalTable[Index] != Socket)
+        {
+            release(&LocalLock);
+            return -3;
+        }
+    }
+    LocalSocket* Accepted = Socket->PendingFirst;
+    Socket->PendingFirst = Accepted->PendingNext;
+    if (!Socket->PendingFirst) {Socket->PendingLast = nullptr;}
+    Accepted->PendingNext = nullptr;
+    --Socket->PendingCount;
+    wakeup(&Socket->PendingCount);
+    int AcceptedIndex = Accepted->Index;
+    release(&LocalLock);
+    return AcceptedIndex;
+}
+
+// Copies into the peer's last buffer while it has room, then into new
+// ones while the peer's receive buffer does. The caller holds LocalLock.
+int LocalSocket::TransmitStream(const iovec* Vectors, int Count, int Total, BOOL NonBlocking)
+{
+    VectorCursor Cursor(Vectors, Count);
+    int Written = 0;
+    while (Written < Total)
+    {
+        if (!Peer) {return Written ? Written : -5;}
+        LocalSocket* Receiver = Peer;
+        int Size = Total - Written;
+        LocalBuffer* Tail = Receiver->Last;
+        if (Tail && Tail->Size < LocalBuffer::Capacity)
+        {
+            int Piece = LocalBuffer::Capacity - Tail->Size;
+            if (Piece > Size) {Piece = Size;}
+            Cursor.Gather(Tail->Data + Tail->Size, Piece);
+            Tail->Size += Piece;
+            Written += Piece;
+        }
+        else if (Receiver->HasRoom(Size))
+        {
+            LocalBuffer* Buffer = NewBuffer();
+            if (!Buffer) {return Written ? Written : -1;}
+            int Piece = Size < LocalBuffer::Capacity ? Size : LocalBuffer::Capacity;
+            Cursor.Gather(Buffer->Data, Piece);
+            Buffer->Size = Piece;
+            if (Tail) {Tail->Next = Buffer;}
+            else {Receiver->First = Buffer;}
+            Receiver->Last = Buffer;
+            Receiver->Charged += BufferCharge;
+            Written += Piece;
+        }
+        else
+        {
+            // Full, let the reader at what is there before waiting.
+            if (Written) {Receiver->Notify();}
+            if (NonBlocking) {return Written ? Written : FWOULDBLOCK;}
+            sleep(&Receiver->Charged, &LocalLock);
+            continue;
+        }
+        if (Written == Total) {Receiver->Notify();}
+    }
+    return Written;
+}
+
+// One datagram, one buffer, to the socket bound to PeerNode. The caller
+// holds LocalLock.
+int LocalSocket::TransmitDatagram(const iovec* Vectors, int Count, int Total, BOOL NonBlocking)
+{
+    if (!PeerNode) {return -3;}
+    if (Total > MaxDatagramSize) {return -1;}
+    LocalSocket* Receiver;
+    while (1)
+    {
+        Receiver = Lookup(PeerNode, Datagram);
+        if (!Receiver) {return -4;}
+        if (Receiver->HasRoom(Total)) {break;}
+        if (NonBlocking) {return FWOULDBLOCK;}
+        sleep(&Receiver->Charged, &LocalLock);
+    }
+    LocalBuffer* Buffer = NewBuffer();
+    if (!Buffer) {return -1;}
+    VectorCursor(Vectors, Count).Gather(Buffer->Data, Total);
+    Buffer->Size = Total;
+    if (Receiver->Last) {Receiver->Last->Next = Buffer;}
+    else {Receiver->First = Buffer;}
+    Receiver->Last = Buffer;
+    Receiver->Charged += BufferCharge;
+    Receiver->Notify();
+    return Total;
+}
+
+int LocalSocket::TransmitVector(int Index, const iovec* Vectors, int Count, BOOL NonBlocking)
+{
+    int Total = VectorSize(Vectors, Count);
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    int ReturnValue;
+    if (!Socket) {ReturnValue = -2;}
+    else if (Socket->Type == Datagram)
+    {
+        ReturnValue = Socket->TransmitDatagram(Vectors, Count, Total, NonBlocking);
+    }
+    else if (Socket->State != Connected) {ReturnValue = -3;}
+    else {ReturnValue = Socket->TransmitStream(Vectors, Count, Total, NonBlocking);}
+    release(&LocalLock);
+    return ReturnValue;
+}
+
+// A stream reads what is queued up to the size of the vectors, 0 once the
+// peer is gone and nothing is left. A datagram reads one, the part that
+// does not fit is lost.
+int LocalSocket::ReceiveVector(int Index, const iovec* Vectors, int Count, BOOL NonBlocking)
+{
+    int Total = VectorSize(Vectors, Count);
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    if (!Socket || Socket->State == Listening)
+    {
+        release(&LocalLock);
+        return Socket ? -3 : -2;
+    }
+    while (!Socket->First)
+    {
+        BOOL Ended = Socket->Type == Stream && !Socket->Peer;
+        if (Ended || NonBlocking)
+        {
+            int ReturnValue = !Ended ? FWOULDBLOCK : Socket->State == Connected ? 0 : -3;
+            release(&LocalLock);
+            return ReturnValue;
+        }
+        sleep(Socket, &LocalLock);
+    }
+
+    VectorCursor Cursor(Vectors, Count);
+    int Read = 0;
+    while (Socket->First && Read < Total)
+    {
+        LocalBuffer* Buffer = Socket->First;
+        int Piece = Buffer->Size - Buffer->Offset;
+        if (Piece > Total - Read) {Piece = Total - Read;}
+        Cursor.Scatter(Buffer->Data + Buffer->Offset, Piece);
+        Buffer->Offset += Piece;
+        Read += Piece;
+        if (Socket->Type == Datagram || Buffer->Offset == Buffer->Size)
+        {
+            Socket->First = Buffer->Next;
+            if (!Socket->First) {Socket->Last = nullptr;}
+            Socket->Charged -= BufferCharge;
+            FreeBuffer(Buffer);
+        }
+        if (Socket->Type == Datagram) {break;}
+    }
+    // Room for the writers, and POLLOUT for the stream's other end.
+    wakeup(&Socket->Charged);
+    if (Socket->Peer) {pollnotify(&Socket->Peer->PollQueue);}
+    release(&LocalLock);
+    return Read;
+}
+
+int LocalSocket::Transmit(int Index, LPCVOID Source, int Size, BOOL NonBlocking)
+{
+    if (Size < 0) {return -1;}
+    iovec Vector = {(void*)Source, (uintp)Size};
+    return TransmitVector(Index, &Vector, 1, NonBlocking);
+}
+
+int LocalSocket::Receive(int Index, LPVOID Destination, int Size, BOOL NonBlocking)
+{
+    if (Size < 0) {return -1;}
+    iovec Vector = {Destination, (uintp)Size};
+    return ReceiveVector(Index, &Vector, 1, NonBlocking);
+}
+
+// A listener is readable with a connection to accept, any other socket with
+// data queued or, for a stream, at the end of its connection. Writable
+// while the receiving end has room.
+int LocalSocket::Poll(int Index)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    if (!Socket)
+    {
+        release(&LocalLock);
+        return POLLNVAL;
+    }
+    int Events = 0;
+    if (Socket->State == Listening)
+    {
+        if (Socket->PendingFirst) {Events |= POLLIN;}
+    }
+    else if (Socket->Type == Stream)
+    {
+        if (Socket->First) {Events |= POLLIN;}
+        if (Socket->Peer && Socket->Peer->HasRoom(1)) {Events |= POLLOUT;}
+        if (Socket->State == Connected && !Socket->Peer) {Events |= POLLIN | POLLHUP;}
+    }
+    else
+    {
+        if (Socket->First) {Events |= POLLIN;}
+        LocalSocket* Receiver = Socket->PeerNode ? Lookup(Socket->PeerNode, Datagram) : nullptr;
+        if (Receiver && Receiver->HasRoom(1)) {Events |= POLLOUT;}
+    }
+    release(&LocalLock);
+    return Events;
+}
+
+pollqueue* LocalSocket::GetPollQueue(int Index)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    release(&LocalLock);
+    return Socket ? &Socket->PollQueue : nullptr;
+}
+
+// Takes effect at once, what is already queued beyond a smaller size stays.
+int LocalSocket::SetReceiveBufferSize(int Index, int Size)
+{
+    if (Size < MinReceiveBufferSize) {Size = MinReceiveBufferSize;}
+    if (Size > MaxReceiveBufferSize) {Size = MaxReceiveBufferSize;}
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    if (Socket)
+    {
+        Socket->ReceiveBufferSize = Size;
+        wakeup(&Socket->Charged);
+    }
+    release(&LocalLock);
+    return Socket ? 0 : -2;
+}
+
+int LocalSocket::GetMemory(int Index)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    int Memory = Socket ? (int)Socket->Charged : -2;
+    release(&LocalLock);
+    return Memory;
+}
+
+int LocalSocket::GetReceiveBufferSize(int Index)
+{
+    acquire(&LocalLock);
+    LocalSocket* Socket = LocalTable[Index];
+    int Size = Socket ? (int)Socket->ReceiveBufferSize : -2;
+    release(&LocalLock);
+    return Size;
+}
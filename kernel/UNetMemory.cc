@@ -0,0 +1,55 @@
+#include "UNetMemory.hh"
+
+QWORD NetMemory::Charged[OwnerCount] = {0};
+QWORD NetMemory::Total = 0;
+QWORD NetMemory::SoftLimit = DefSoftLimit;
+QWORD NetMemory::HardLimit = DefHardLimit;
+QWORD NetMemory::Failures = 0;
+
+BOOL NetMemory::Charge(int Owner, QWORD Bytes)
+{
+    // Take the bytes first, so racing charges cannot all pass the check.
+    QWORD NewTotal = __atomic_add_fetch(&Total, Bytes, __ATOMIC_RELAXED);
+    if (NewTotal > __atomic_load_n(&HardLimit, __ATOMIC_RELAXED))
+    {
+        __atomic_sub_fetch(&Total, Bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&Failures, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_add_fetch(&Charged[Owner], Bytes, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void NetMemory::ForceCharge(int Owner, QWORD Bytes)
+{
+    __atomic_add_fetch(&Total, Bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&Charged[Owner], Bytes, __ATOMIC_RELAXED);
+}
+
+void NetMemory::Uncharge(int Owner, QWORD Bytes)
+{
+    __atomic_sub_fetch(&Charged[Owner], Bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&Total, Bytes, __ATOMIC_RELAXED);
+}
+
+int NetMemory::Pressure()
+{
+    QWORD Current = __atomic_load_n(&Total, __ATOMIC_RELAXED);
+    if (Current >= __atomic_load_n(&HardLimit, __ATOMIC_RELAXED)) {return PressureHard;}
+    if (Current >= __atomic_load_n(&SoftLimit, __ATOMIC_RELAXED)) {return PressureSoft;}
+    return PressureNone;
+}
+
+QWORD NetMemory::Usage(int Owner)
+{
+    if (Owner < 0 || Owner >= OwnerCount) {return 0;}
+    return __atomic_load_n(&Charged[Owner], __ATOMIC_RELAXED);
+}
+
+QWORD NetMemory::GetTotal() {return __atomic_load_n(&Total, __ATOMIC_RELAXED);}
+QWORD NetMemory::GetFailures() {return __atomic_load_n(&Failures, __ATOMIC_RELAXED);}
+void NetMemory::SetFailures(QWORD Value) {__atomic_store_n(&Failures, Value, __ATOMIC_RELAXED);}
+QWORD NetMemory::GetSoftLimit() {return __atomic_load_n(&SoftLimit, __ATOMIC_RELAXED);}
+QWORD NetMemory::GetHardLimit() {return __atomic_load_n(&HardLimit, __ATOMIC_RELAXED);}
+void NetMemory::SetSoftLimit(QWORD Limit) {__atomic_store_n(&SoftLimit, Limit, __ATOMIC_RELAXED);}
+void NetMemory::SetHardLimit(QWORD Limit) {__atomic_store_n(&HardLimit, Limit, __ATOMIC_RELAXED);}
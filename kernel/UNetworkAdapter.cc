@@ -1,6 +1,7 @@
 #include "UDef.hh"
 #include "UNetworkAdapter.hh"
 #include "UEtherFrame.hh"
+#include "UNetMemory.hh"
 
 _EXTERN_C
 _ADD_PANIC
@@ -10,6 +11,8 @@ _ADD_KALLOC
 _ADD_DELAY
 _ADD_PICENABLE
 _ADD_IOAPICENABLE
+_ADD_INITLOCK
+#include "spinlock.h"
 _END_EXTERN_C
 
 struct NetworkAdapterMatchCase
@@ -141,6 +144,36 @@ int Intel8254xNetworkAdapter::Transmit(EthernetFrame& Frame)
     return TDescLayout[TransmitTail].Length;
 }
 
+// Fills as many descriptors as the ring allows and moves the tail once
+// for all of them. Only the last one asks for a status write-back, the
+// adapter completes descriptors in order.
+int Intel8254xNetworkAdapter::TransmitBatch(EthernetFrame** Frames, int Count)
+{
+    int Sent = 0;
+    while (Sent < Count)
+    {
+        int Run = Count - Sent;
+        if (Run > TDescLayoutMaxSize - 1) {Run = TDescLayoutMaxSize - 1;}
+        DWORD TransmitTail = GetRegister(EthernetControllerRegisters::Transmit::TDT);
+        DWORD Last = TransmitTail;
+        for (int i = 0; i < Run; ++i)
+        {
+            EthernetFrame* Frame = Frames[Sent + i];
+            Last = TransmitTail;
+            TDescLayout[Last].BufferAddress = VirtualAddressToPhysical(Frame->Get());
+            TDescLayout[Last].Length = Frame->Size();
+            TDescLayout[Last].Status = 0;
+            TDescLayout[Last].Command = TransmitDescriptorCommandField::EOP |
+                (i == Run - 1 ? TransmitDescriptorCommandField::RS : 0);
+            TransmitTail = (TransmitTail + 1) % TDescLayoutMaxSize;
+        }
+        SetRegister(EthernetControllerRegisters::Transmit::TDT, TransmitTail);
+        while (!(TDescLayout[Last].Status & 0xF)) {microdelay(10);}
+        Sent += Run;
+    }
+    return Sent;
+}
+
 int Intel8254xNetworkAdapter::Receive(EthernetFrame* FrameBuffer)
 {
     int BufferSize = 0;
@@ -328,6 +361,7 @@ void Intel8254xNetworkAdapter::AllocateReceiveDescrBuffer()
         // A more space-saving method is put 2 buffers in 1 page. (By. yas-nyan)
         RDescLayout[i].BufferAddress = VirtualAddressToPhysical(kalloc());
     }
+    NetMemory::ForceCharge(NetMemory::OwnerFrames, (RDescLayoutMaxSize + 1) * NetMemory::PageCharge);
 }
 
 void Intel8254xNetworkAdapter::EnableInterrupts()
@@ -391,6 +425,92 @@ NetworkAdapter* Intel8254xNetworkAdapter::Start(PCIFuncCPointer PCIFunction)
     return HInstance;
 }
 
+// ---------- Member functions of LoopbackNetworkAdapter ----------- //
+
+LoopbackNetworkAdapter* LoopbackNetworkAdapter::Instance = nullptr;
+spinlock LoopbackNetworkAdapter::Lock;
+
+// Frames being delivered, only the CPU that won BeginDelivery() uses it.
+static EthernetFrame LoopbackFrameBuffer[LoopbackNetworkAdapter::DeliveryBatch];
+
+int LoopbackNetworkAdapter::Transmit(EthernetFrame& Frame)
+{
+    acquire(&Lock);
+    if (Count == QueueSize)
+    {
+        release(&Lock);
+        return -1;
+    }
+    Frame.CopyTo(Queue[(Head + Count) % QueueSize]);
+    ++Count;
+    release(&Lock);
+    return Frame.Size();
+}
+
+int LoopbackNetworkAdapter::TransmitBatch(EthernetFrame** Frames, int Total)
+{
+    int Sent = 0;
+    while (Sent < Total && Transmit(*Frames[Sent]) >= 0) {++Sent;}
+    return Sent;
+}
+
+int LoopbackNetworkAdapter::Receive(EthernetFrame* FrameBuffer)
+{
+    acquire(&Lock);
+    int BufferSize = 0;
+    while (Count && BufferSize < DeliveryBatch)
+    {
+        Queue[Head]->CopyTo(&FrameBuffer[BufferSize++]);
+        Head = (Head + 1) % QueueSize;
+        --Count;
+    }
+    // Checked under the same hold as the queue, a frame queued after
+    // this starts a new delivery.
+    if (!BufferSize) {Delivering = 0;}
+    release(&Lock);
+    return BufferSize;
+}
+
+BOOL LoopbackNetworkAdapter::BeginDelivery()
+{
+    acquire(&Lock);
+    BOOL Begun = !Delivering && Count;
+    if (Begun) {Delivering = 1;}
+    release(&Lock);
+    return Begun;
+}
+
+void LoopbackNetworkAdapter::EndDelivery()
+{
+    acquire(&Lock);
+    Delivering = 0;
+    release(&Lock);
+}
+
+NetworkAdapter* LoopbackNetworkAdapter::Start()
+{
+    cprintf((char*)"[LoopbackNetworkAdapter] Starting...\n");
+    static_assert(2 * sizeof(EthernetFrame) <= 4096);
+    if (!NetworkAdapterList) {NetworkAdapterList = decltype(NetworkAdapterList)(kalloc());}
+    if (!NetworkAdapterList) {return nullptr;}
+    initlock(&Lock, (char*)"loopback");
+    LoopbackNetworkAdapter* HInstance = new LoopbackNetworkAdapter();
+    if (!HInstance) {return nullptr;}
+    for (int i = 0; i < QueueSize; i += 2) // Two frames to a page
+    {
+        EthernetFrame* Pair = (EthernetFrame*)kalloc();
+        if (!Pair) {panic((char*)"LoopbackNetworkAdapter: out of memory");}
+        HInstance->Queue[i] = Pair;
+        HInstance->Queue[i + 1] = Pair + 1;
+    }
+    NetMemory::ForceCharge(NetMemory::OwnerFrames, QueueSize / 2 * NetMemory::PageCharge);
+    NetworkAdapterList[NetworkAdapterListSize] = HInstance;
+    ++NetworkAdapterListSize;
+    Instance = HInstance;
+    cprintf((char*)"[LoopbackNetworkAdapter] Started.\n");
+    return HInstance;
+}
+
 // ------------------------------------------------------------------ //
 
 _EXTERN_C
@@ -416,6 +536,29 @@ void Intel8254xInterrupt()
     }
 }
 
+// Delivers what the loopback adapter queued. Called where no locks are
+// held: on return from every system call and on every tick.
+void LoopbackInterrupt()
+{
+    static const int MaxRounds = 4 * LoopbackNetworkAdapter::QueueSize /
+        LoopbackNetworkAdapter::DeliveryBatch;
+    auto Device = LoopbackNetworkAdapter::Instance;
+    if (!Device || !Device->HasInterrupt() || !Device->BeginDelivery()) {return;}
+    // Delivery queues replies of its own, bounded so a pair of sockets
+    // talking to each other cannot hold the CPU here.
+    for (int Round = 0; ; ++Round)
+    {
+        if (Round == MaxRounds)
+        {
+            Device->EndDelivery();
+            break;
+        }
+        int Size = Device->Receive(LoopbackFrameBuffer);
+        if (!Size) {break;}
+        FrameBufferHandler(Device, LoopbackFrameBuffer, Size);
+    }
+}
+
 int NetworkAdapterSetup(struct pci_func* PCIFunction)
 {
     if (!NetworkAdapterList) {NetworkAdapterList = decltype(NetworkAdapterList)(kalloc());}
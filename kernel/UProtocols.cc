@@ -1,14 +1,16 @@
 #include "UProtocols.hh"
 #include "UProtocols4.tcc"
+#include "ULocalSocket.hh"
 #include "UNetworkAdapter.hh"
 #include "URandom.tcc"
+#include "UNetMemory.hh"
 
 _EXTERN_C
 _ADD_KERN_PRINT_FUNC
 _ADD_INITLOCK
 _ADD_KALLOC
 _ADD_KFREE
-_ADD_DELAY
+void wakeup(void*);
 _END_EXTERN_C
 
 const ProtocolMainFunctionInvoker ProtocolInvokers[] =
@@ -23,6 +25,9 @@ const ProtocolMainFunctionInvoker ProtocolInvokers[] =
 time_t ARP::ARPTimestamp;
 spinlock ARP::ARPLock;
 ArrayList<ARP::ARPTableItem, ARP::ARPTableSize> ARP::ARPTable;
+ARP::PendingFrame ARP::ResolveQueue[ARP::ResolveQueueSize];
+int ARP::ResolveQueueCount = 0;
+struct timer ARP::ResolveTimer;
 
 WORD ARP::GetHardwareType() const
 {
@@ -179,6 +184,9 @@ int ARP::Tester::ARPing(DWORD TargetIPAddress)
     cprintf((char*)"ARPING %d.%d.%d.%d\n",
         TargetIP[0], TargetIP[1], TargetIP[2], TargetIP[3]);
 
+    ARP* ARPFrame = new ARP();
+    if (!ARPFrame) {return NoMemory;}
+
     // Init
     ARPingIsTesting = 1;
     ARPingIsReceived = 0;
@@ -186,8 +194,6 @@ int ARP::Tester::ARPing(DWORD TargetIPAddress)
     int ARPingReceived = 0;
     ReturnValue ReturnVal = Passed;
 
-    ARP* ARPFrame = new ARP();
-    int Delay = 0;
     int Count = 0;
     int UnansweredCount = 0;
 
@@ -223,13 +229,14 @@ int ARP::Tester::ARPing(DWORD TargetIPAddress)
         ARPFrame->ToDevice(*Device);
         ++ARPingSent;
 
-        // Receive
-        while(/*!ARPingIsReceived &&*/ MaxDelay > Delay) // check for multiple receptions
-        {
-            microdelay(10);
-            ++Delay;
-        }
-        if (!ARPingIsReceived)
+        // Receive, waiting out the whole period to report every reply
+        AcquireLock();
+        DWORD Deadline = ticks + WaitTime;
+        while (sleep_until(&ARPingIsReceived, &ARPLock, Deadline) == 0) {}
+        BOOL Received = ARPingIsReceived;
+        ARPingIsReceived = 0;
+        ReleaseLock();
+        if (!Received)
         {
             cprintf((char*)"Timeout\n");
             ReturnVal = Timeout;
@@ -237,7 +244,6 @@ int ARP::Tester::ARPing(DWORD TargetIPAddress)
             continue;
         }
         ++ARPingReceived;
-        ARPingIsReceived = 0;
     }
 
     EndTesting:
@@ -283,33 +289,177 @@ void ARP::Print(const char* Title) const
     cprintf((char*)"\n");
 }
 
+// MAC address of IP if it is known. Nothing waits for a reply here, a
+// frame for an unknown address goes through Defer().
 BYTE* ARP::RequestFrom(NetworkAdapter& Device, DWORD IP)
 {
     auto SenderAddress = IPv4::IPFind(&Device);
     if (SenderAddress == IPv4::AdapterIPAddressTable.end()) {return nullptr;}
 
+    AcquireLock();
     auto it = ARPTableFind(IP);
-    if (it == ARPTable.end())
-    {
-        ARP* ARPFrame = new ARP();
-        ARPFrame->Prepare(Request);
-        ARPFrame->SetSenderHardwareAddress(Device.GetMACAddress());
-        ARPFrame->SetSenderProtocolAddress(SenderAddress->IPAddress);
-        ARPFrame->SetTargetProtocolAddress(IP);
-        ARPFrame->Broadcast();
-        ARPFrame->ToDevice(Device);
-        delete ARPFrame;
-
-        auto Delay = Tester::MaxDelay;
-        while (Delay)
+    BYTE* MACAddress = it != ARPTable.end() ? it->MACAddress : nullptr;
+    ReleaseLock();
+    return MACAddress;
+}
+
+void ARP::SendRequest(NetworkAdapter& Device, DWORD IP)
+{
+    auto SenderAddress = IPv4::IPFind(&Device);
+    if (SenderAddress == IPv4::AdapterIPAddressTable.end()) {return;}
+
+    ARP* ARPFrame = new ARP();
+    if (!ARPFrame) {return;}
+    ARPFrame->Prepare(Request);
+    ARPFrame->SetSenderHardwareAddress(Device.GetMACAddress());
+    ARPFrame->SetSenderProtocolAddress(SenderAddress->IPAddress);
+    ARPFrame->SetTargetProtocolAddress(IP);
+    ARPFrame->Broadcast();
+    ARPFrame->ToDevice(Device);
+    delete ARPFrame;
+}
+
+// Keep a copy of a frame whose next hop is not resolved yet and ask for
+// it. The frame is sent by Resolved() once the reply is in, or dropped
+// by OnResolveTimer() after ResolveRetries unanswered requests. The copy
+// is charged to NetMemory::OwnerFrames while it waits, see FreePending().
+BOOL ARP::Defer(NetworkAdapter& Device, const IPv4& Frame, WORD ResizeTo)
+{
+    DWORD IP = Frame.GetDestinationAddress();
+    if (!NetMemory::Charge(NetMemory::OwnerFrames, NetMemory::PageCharge)) {return 0;}
+    IPv4* Copy = new IPv4(Frame);
+    if (!Copy)
+    {
+        NetMemory::Uncharge(NetMemory::OwnerFrames, NetMemory::PageCharge);
+        return 0;
+    }
+
+    AcquireLock();
+    if (ResolveQueueCount >= ResolveQueueSize)
+    {
+        ReleaseLock();
+        FreePending(Copy);
+        cprintf((char*)"[ARP] Resolution queue is full.\n");
+        return 0;
+    }
+    DWORD Requests = 0;
+    for (int i = 0; i < ResolveQueueCount; ++i)
+    {
+        if (ResolveQueue[i].Address == IP) {Requests = ResolveQueue[i].Requests;}
+    }
+    BOOL Outstanding = Requests != 0;
+    ResolveQueue[ResolveQueueCount++] = {Copy, &Device, IP, ResizeTo, Outstanding ? Requests : 1,
+        PendingFrame::Waiting};
+    if (!timer_pending(&ResolveTimer)) {timer_add(&ResolveTimer, ticks + ResolveInterval);}
+    ReleaseLock();
+
+    if (!Outstanding) {SendRequest(Device, IP);}
+    return 1;
+}
+
+void ARP::FreePending(IPv4* Frame)
+{
+    delete Frame;
+    NetMemory::Uncharge(NetMemory::OwnerFrames, NetMemory::PageCharge);
+}
+
+// The oldest frame waiting for IP, removed from the queue.
+BOOL ARP::TakePending(DWORD IP, PendingFrame& Taken)
+{
+    AcquireLock();
+    for (int i = 0; i < ResolveQueueCount; ++i)
+    {
+        if (ResolveQueue[i].Address != IP) {continue;}
+        Taken = ResolveQueue[i];
+        for (int j = i + 1; j < ResolveQueueCount; ++j) {ResolveQueue[j - 1] = ResolveQueue[j];}
+        --ResolveQueueCount;
+        ReleaseLock();
+        return 1;
+    }
+    ReleaseLock();
+    return 0;
+}
+
+// The oldest entry OnResolveTimer() marked. Ask entries stay queued with
+// the mark cleared, Send and Drop ones are removed.
+BOOL ARP::TakeMarked(PendingFrame& Taken)
+{
+    AcquireLock();
+    for (int i = 0; i < ResolveQueueCount; ++i)
+    {
+        if (ResolveQueue[i].Action == PendingFrame::Waiting) {continue;}
+        Taken = ResolveQueue[i];
+        if (Taken.Action == PendingFrame::Ask) {ResolveQueue[i].Action = PendingFrame::Waiting;}
+        else
         {
-            it = ARPTableFind(IP);
-            if (it != ARPTable.end()) {break;}
-            --Delay;
+            for (int j = i + 1; j < ResolveQueueCount; ++j) {ResolveQueue[j - 1] = ResolveQueue[j];}
+            --ResolveQueueCount;
+        }
+        ReleaseLock();
+        return 1;
+    }
+    ReleaseLock();
+    return 0;
+}
+
+// IP is in the table now, send what waited for it.
+void ARP::Resolved(DWORD IP)
+{
+    PendingFrame Ready;
+    while (TakePending(IP, Ready))
+    {
+        Ready.Frame->ToDevice(*Ready.Device, Ready.ResizeTo);
+        FreePending(Ready.Frame);
+    }
+}
+
+// Runs every ResolveInterval while frames are queued: sends what resolved
+// meanwhile, asks again for the rest and gives up after ResolveRetries.
+// This is timer interrupt context, so the entries are only marked under
+// ARPLock and then handled one by one, see TakeMarked().
+void ARP::OnResolveTimer(LPVOID)
+{
+    AcquireLock();
+    BOOL Waiting = 0;
+    for (int i = 0; i < ResolveQueueCount; ++i)
+    {
+        PendingFrame& Entry = ResolveQueue[i];
+        BOOL First = 1;
+        for (int j = 0; j < i; ++j) {First &= ResolveQueue[j].Address != Entry.Address;}
+
+        if (ARPTableFind(Entry.Address) != ARPTable.end()) {Entry.Action = PendingFrame::Send;}
+        else if (Entry.Requests >= ResolveRetries) {Entry.Action = PendingFrame::Drop;}
+        else
+        {
+            // One request per address, all its frames count it.
+            ++Entry.Requests;
+            Entry.Action = First ? PendingFrame::Ask : PendingFrame::Waiting;
+            Waiting = 1;
+        }
+    }
+    if (Waiting) {timer_add(&ResolveTimer, ticks + ResolveInterval);}
+    ReleaseLock();
+
+    BOOL Reported = 0;
+    PendingFrame Entry;
+    while (TakeMarked(Entry))
+    {
+        switch (Entry.Action)
+        {
+        case PendingFrame::Ask:
+            SendRequest(*Entry.Device, Entry.Address);
+            break;
+        case PendingFrame::Send:
+            Entry.Frame->ToDevice(*Entry.Device, Entry.ResizeTo);
+            FreePending(Entry.Frame);
+            break;
+        default:
+            if (!Reported) {cprintf((char*)"[ARP] Failed to find MAC address of destination.\n");}
+            Reported = 1;
+            FreePending(Entry.Frame);
+            break;
         }
-        if (it == ARPTable.end()) {return nullptr;}
     }
-    return it->MACAddress;
 }
 
 void ARP::Register()
@@ -318,6 +468,7 @@ void ARP::Register()
     time(&ARPTimestamp);
     cprintf((char*)"[ARP] Timestamp = %d\n", ARPTimestamp);
     initlock(&ARPLock, (char*)"ARP");
+    timer_init(&ResolveTimer, OnResolveTimer, nullptr);
     cprintf((char*)"[ARP] DONE.\n");
 }
 
@@ -344,7 +495,10 @@ void ARP::Main(NetworkAdapter* Device, const EthernetFrame& Frame)
                 MACAddr[0], MACAddr[1], MACAddr[2],
                 MACAddr[3], MACAddr[4], MACAddr[5],
                 SenderIP[0], SenderIP[1], SenderIP[2], SenderIP[3]);
+        AcquireLock();
         Tester::ARPingIsReceived = 1;
+        wakeup(&Tester::ARPingIsReceived);
+        ReleaseLock();
     }
 
     // Check and update if exist
@@ -373,10 +527,12 @@ void ARP::Main(NetworkAdapter* Device, const EthernetFrame& Frame)
             ARPTable.push_back(Item);
             ReleaseLock();
         }
+        Resolved(ARPFrame.GetSenderProtocolAddress());
 
         if (ARPFrame.GetOperation() == ARP::Request) // If request, send a reply.
         {
             ARP* Rep = new ARP();
+            if (!Rep) {return;}
             Rep->Prepare(ARP::Reply);
             Rep->SetSenderHardwareAddress(Device->GetMACAddress());
             Rep->SetSenderProtocolAddress(AdapterIP->IPAddress);
@@ -608,12 +764,12 @@ WORD IPv4::VerifyChecksum(BOOL ComputeOnly)const
     return ~InitAddition;
 }
 
-BOOL IPv4::IsValid() const
+BOOL IPv4::IsValid(BOOL Trusted) const
 {
     DWORD DataLength = Mybase::DataSize();
     auto IHL = GetInternetHeaderLength() * sizeof(DWORD);
     auto TotalLen = GetTotalLength();
-    return (DataLength >= 20) && !VerifyChecksum() &&
+    return (DataLength >= 20) && (Trusted || !VerifyChecksum()) &&
         (GetVersion() == 4) && (DataLength >= IHL) &&
         (DataLength >= TotalLen) && (GetTimeToLive());
 }
@@ -651,14 +807,26 @@ decltype(IP::RouteTable)::iterator IPv4::RouteTableMatch(DWORD Target)
     if (MatchTable.size() == 0) {return RouteTable.end();} // No matching routes
     if (MatchTable.size() == 1) {return MatchTable[0];} // Single result
 
-    // If 2 or more results, select longest mask and smallest metric.
-    qsort(MatchTable.begin(), MatchTable.end(),
-        [](decltype(MatchTable)::value_type v1, decltype(MatchTable)::value_type v2)
-    {
-        return (MaskToNum(v1->Genmask) >= MaskToNum(v2->Genmask))
-            && (v1->Metric < v2->Metric);
-    });
-    return *MatchTable.begin();
+    // If 2 or more results, select longest mask and smallest metric. Masks
+    // are counted by their bits, MaskToNum() gives 32 for the empty mask of
+    // a default route, which would then win over 127.0.0.0/8.
+    auto Bits = [](DWORD Mask)
+    {
+        int N = 0;
+        for (; Mask; Mask &= Mask - 1) {++N;}
+        return N;
+    };
+    auto Best = MatchTable[0];
+    for (auto Route : MatchTable)
+    {
+        int Length = Bits(Route->Genmask);
+        int BestLength = Bits(Best->Genmask);
+        if (Length > BestLength || (Length == BestLength && Route->Metric < Best->Metric))
+        {
+            Best = Route;
+        }
+    }
+    return Best;
 }
 
 decltype(IPv4::AdapterIPAddressTable)::iterator IPv4::IPFind(const NetworkAdapter* Adapter)
@@ -732,7 +900,10 @@ DWORD IPv4::GetBroadcastAddress(DWORD Addr, DWORD Mask)
     return Addr | (~Mask);
 }
 
-int IPv4::ToDevice(NetworkAdapter& Device, WORD ResizeTo)
+// Everything ToDevice() does short of handing the frame to the adapter.
+// Returns 1 if the frame is ready for Device.Transmit(), 0 if a copy of
+// it waits for address resolution and a negative value on failure.
+int IPv4::PrepareTransmit(NetworkAdapter& Device, WORD ResizeTo)
 {
     auto it = IPFind(&Device);
     if (it == AdapterIPAddressTable.end())
@@ -741,20 +912,23 @@ int IPv4::ToDevice(NetworkAdapter& Device, WORD ResizeTo)
         return -1;
     }
 
-    BYTE* DstMACAddr = ARP::RequestFrom(Device, GetDestinationAddress());
-    if (!DstMACAddr)
+    // The loopback adapter sends to itself, there is nothing to resolve.
+    BOOL Loopback = LoopbackNetworkAdapter::IsLoopback(&Device);
+    const BYTE* DstMACAddr = Loopback ? Device.GetMACAddress() :
+        ARP::RequestFrom(Device, GetDestinationAddress());
+    if (!DstMACAddr) // Goes out once the address resolves
     {
-        cprintf((char*)"[IPv4] Failed to find MAC address of destination.\n");
-        return -2;
+        return ARP::Defer(Device, *this, ResizeTo) ? 0 : -2;
     }
 
     SetSourceAddress(it->IPAddress);
+    SetSource(Device.GetMACAddress());
     SetDestination(DstMACAddr);
 
     if (!GetIdentification())
     {
         mt19937l* Engine = new mt19937l(time(nullptr));
-        SetIdentification(Engine->Gen() & ~(WORD(0)));
+        SetIdentification(Engine ? Engine->Gen() & ~(WORD(0)) : WORD(time(nullptr)));
         delete Engine;
     }
     else
@@ -769,7 +943,14 @@ int IPv4::ToDevice(NetworkAdapter& Device, WORD ResizeTo)
         Resize((ResizeTo < GetInternetHeaderLength() * sizeof(DWORD)) ?
             GetInternetHeaderLength() * sizeof(DWORD) : ResizeTo);
     }
-    SetHeaderChecksum(VerifyChecksum(1));
+    if (!Loopback) {SetHeaderChecksum(VerifyChecksum(1));}
+    return 1;
+}
+
+int IPv4::ToDevice(NetworkAdapter& Device, WORD ResizeTo)
+{
+    int ReturnValue = PrepareTransmit(Device, ResizeTo);
+    if (ReturnValue <= 0) {return ReturnValue;}
     return Mybase::ToDevice(Device);
 }
 
@@ -816,7 +997,7 @@ void IPv4::Main(NetworkAdapter* Device, const EthernetFrame& Frame)
 {
     const IPv4& IPv4Frame = Frame;
     //IPv4Frame.Print("IP received: \n");
-    if (!IPv4Frame.IsValid())
+    if (!IPv4Frame.IsValid(LoopbackNetworkAdapter::IsLoopback(Device)))
     {
         cprintf((char*)"[IPv4] Invalid IP frame.\n");
         return;
@@ -908,6 +1089,7 @@ namespace ICMPControllers
 {
     BOOL PingEcho::IsTesting = 0;
     BOOL PingEcho::IsReceived = 0;
+    spinlock PingEcho::Lock;
     WORD PingEcho::CurrentID = 0;
     WORD PingEcho::CurrentSN = 0;
 
@@ -967,6 +1149,7 @@ namespace ICMPControllers
 
         PingEcho* Frame = new PingEcho();
         mt19937l* Engine = new mt19937l(time(nullptr));
+        if (!Frame || !Engine) {goto EndTesting;}
 
         // Find IP
         decltype(IPv4::RouteTable)::iterator Route;
@@ -990,7 +1173,6 @@ namespace ICMPControllers
             Frame->Size(), TargetIP[0], TargetIP[1], TargetIP[2], TargetIP[3]);
         for (int i = 0; i < 5; ++i)
         {
-            int Delay = 0;
             CurrentSN = i + 1;
             Frame->SetSequenceNumber(CurrentSN);
 
@@ -999,16 +1181,16 @@ namespace ICMPControllers
             ++PingSent;
 
             // Receive
-            while(!IsReceived && MaxDelay > Delay) // check for multiple receptions
-            {
-                microdelay(10);
-                ++Delay;
-            }
-            if (IsReceived)
+            acquire(&Lock);
+            DWORD Deadline = ticks + Timeout;
+            while (!IsReceived && sleep_until(&IsReceived, &Lock, Deadline) == 0) {}
+            BOOL Received = IsReceived;
+            IsReceived = 0;
+            release(&Lock);
+            if (Received)
             {
                 cprintf((char*)"!");
                 ++PingReceived;
-                IsReceived = 0;
             }
             else
             {
@@ -1213,16 +1395,18 @@ void ICMPv4::Print(const char *Title) const
 
 void ICMPv4::Register()
 {
-    // Do nothing...
+    initlock(&ICMPControllers::PingEcho::Lock, (char*)"ping");
 }
 
 void ICMPv4::Main(NetworkAdapter* Device, const Mybase& Frame)
 {
     ICMP* ICMPFrame = new ICMP(Frame);
+    if (!ICMPFrame) {return;}
     //ICMPFrame->Print("ICMP received: \n");
     if (!ICMPFrame->IsValid())
     {
         cprintf((char*)"[ICMPv4] Invalid ICMP frame.\n");
+        delete ICMPFrame;
         return;
     }
 
@@ -1236,19 +1420,28 @@ void ICMPv4::Main(NetworkAdapter* Device, const Mybase& Frame)
             if ((((PingEcho*)ICMPFrame)->GetIdentifier() == PingEcho::CurrentID) &&
                 (((PingEcho*)ICMPFrame)->GetSequenceNumber() == PingEcho::CurrentSN))
             {
+                acquire(&PingEcho::Lock);
                 PingEcho::IsReceived = 1;
+                wakeup(&PingEcho::IsReceived);
+                release(&PingEcho::Lock);
             }
         }
         break;
 
     case TEchoRequest:
         {
+            // Echo requests are not worth memory the sockets need.
+            if (!NetMemory::Charge(NetMemory::OwnerFrames, NetMemory::PageCharge)) {break;}
             ICMP* ResponseFrame = new ICMP(*ICMPFrame);
-            ResponseFrame->SetType(TEchoReply);
-            ResponseFrame->SetDestinationAddress(ICMPFrame->GetSourceAddress());
-            //ResponseFrame->Print("ICMP response: \n");
-            ResponseFrame->ToDevice(*Device);
-            delete ResponseFrame;
+            if (ResponseFrame)
+            {
+                ResponseFrame->SetType(TEchoReply);
+                ResponseFrame->SetDestinationAddress(ICMPFrame->GetSourceAddress());
+                //ResponseFrame->Print("ICMP response: \n");
+                ResponseFrame->ToDevice(*Device);
+                delete ResponseFrame;
+            }
+            NetMemory::Uncharge(NetMemory::OwnerFrames, NetMemory::PageCharge);
         }
         break;
 
@@ -1279,7 +1472,16 @@ void ICMPv4::Main(NetworkAdapter* Device, const Mybase& Frame)
 
 // ------------------------------- TCP ------------------------------ //
 
-ArrayList<TCB<4>, TCP<4>::TCBTableSize> TCP<4>::TCBTable;
+IndexTable<TCB<4>> TCP<4>::TCBTable;
+ObjectPool<TCB<4>> TCP<4>::TCBPool;
+HashTable<TCB<4>, TCP<4>::ConnectionBuckets> TCP<4>::ConnectionTable;
+HashTable<TCB<4>, TCP<4>::ListenBuckets> TCP<4>::ListenTable;
+Bitmap<TCP<4>::SourcePortMax - TCP<4>::SourcePortMin + 1> TCP<4>::SourcePorts;
+DWORD TCP<4>::SourcePortHint;
+spinlock TCP<4>::TimeWaitLock;
+HashTable<TimeWaitBlock<4>, TCP<4>::ConnectionBuckets> TCP<4>::TimeWaitTable;
+ObjectPool<TimeWaitBlock<4>> TCP<4>::TimeWaitPool;
+DWORD TCP<4>::TimeWaitLimit;
 
 // ------------------------------------------------------------------ //
 
@@ -1287,7 +1489,12 @@ ArrayList<TCB<4>, TCP<4>::TCBTableSize> TCP<4>::TCBTable;
 
 // ------------------------------- UDP ------------------------------ //
 
-ArrayList<UDPController<4>, UDP<4>::UDPTableSize> UDP<4>::UDPTable;
+IndexTable<UDPController<4>> UDP<4>::UDPTable;
+ObjectPool<UDPController<4>> UDP<4>::UDPPool;
+HashTable<UDPController<4>, UDP<4>::PortBuckets> UDP<4>::PortTable;
+UDP<4>* UDP<4>::BatchFrames[UDP<4>::SendBatchSize];
+DWORD UDP<4>::ReceiveBufferDefault = UDP<4>::DefReceiveBufferSize;
+DWORD UDP<4>::ReceiveDrops = 0;
 
 // ------------------------------------------------------------------ //
 
@@ -1475,12 +1682,97 @@ int INet_Ping()
     return 0;
 }
 
+int INet_NetTunable()
+{
+    int Name, Value;
+    if (argint(0, &Name) < 0 || argint(1, &Value) < 0) {return -1;}
+    switch (Name)
+    {
+    case TunableTCPMaxConnections:
+        TCP<4>::AcquireLock();
+        if (Value >= 0) {TCP<4>::TCBTable.SetLimit(Value);}
+        Value = TCP<4>::TCBTable.limit();
+        TCP<4>::ReleaseLock();
+        return Value;
+    case TunableTCPMaxTimeWait:
+        acquire(&TCP<4>::TimeWaitLock);
+        if (Value >= 0) {TCP<4>::TimeWaitLimit = Value;}
+        Value = TCP<4>::TimeWaitLimit;
+        release(&TCP<4>::TimeWaitLock);
+        return Value;
+    case TunableUDPMaxSockets:
+        UDP<4>::AcquireLock();
+        if (Value >= 0) {UDP<4>::UDPTable.SetLimit(Value);}
+        Value = UDP<4>::UDPTable.limit();
+        UDP<4>::ReleaseLock();
+        return Value;
+    case TunableUDPReceiveBuffer:
+        UDP<4>::AcquireLock();
+        if (Value >= 0)
+        {
+            if (Value < UDP<4>::MinReceiveBufferSize) {Value = UDP<4>::MinReceiveBufferSize;}
+            if (Value > UDP<4>::MaxReceiveBufferSize) {Value = UDP<4>::MaxReceiveBufferSize;}
+            UDP<4>::ReceiveBufferDefault = Value;
+        }
+        Value = UDP<4>::ReceiveBufferDefault;
+        UDP<4>::ReleaseLock();
+        return Value;
+    case TunableUDPReceiveDrops:
+        UDP<4>::AcquireLock();
+        if (Value >= 0) {UDP<4>::ReceiveDrops = Value;}
+        Value = UDP<4>::ReceiveDrops;
+        UDP<4>::ReleaseLock();
+        return Value;
+    case TunableMemorySoftLimit:
+        if (Value >= 0) {NetMemory::SetSoftLimit(Value);}
+        return NetMemory::GetSoftLimit();
+    case TunableMemoryHardLimit:
+        if (Value >= 0) {NetMemory::SetHardLimit(Value);}
+        return NetMemory::GetHardLimit();
+    case TunableMemoryTCP:
+        return NetMemory::Usage(NetMemory::OwnerTCP);
+    case TunableMemoryUDP:
+        return NetMemory::Usage(NetMemory::OwnerUDP);
+    case TunableMemoryLocal:
+        return NetMemory::Usage(NetMemory::OwnerLocal);
+    case TunableMemoryFrames:
+        return NetMemory::Usage(NetMemory::OwnerFrames);
+    case TunableMemoryFailures:
+        if (Value >= 0) {NetMemory::SetFailures(Value);}
+        return NetMemory::GetFailures();
+    case TunableMemoryPressure:
+        return NetMemory::Pressure();
+    default:
+        return -1;
+    }
+}
+
 void RegisterProtocols()
 {
+    // Held for good, but counted so the limits see it.
+    NetMemory::ForceCharge(NetMemory::OwnerFrames, sizeof(GlobalEtherFrameBuffer));
     for (int i = 0; ProtocolInvokers[i].Register && ProtocolInvokers[i].InvokeMain; ++i)
     {
         ProtocolInvokers[i].Register();
     }
+
+    // 127.0.0.1/8 on the loopback adapter, after the PCI adapters.
+    NetworkAdapter* Loopback = LoopbackNetworkAdapter::Start();
+    if (Loopback)
+    {
+        IPv4::IPAllocate(Loopback, IP::LocalhostAddress, IP::LocalhostMask);
+        IP::RouteTableItem Route;
+        Route.Destination = IP::Localhost;
+        Route.Gateway = 0;
+        Route.Genmask = IP::LocalhostMask;
+        Route.Flags = IPv4::RouteTableFlags::RTF_UP;
+        Route.Metric = 0;
+        Route.Ref = 0;
+        Route.Use = 0;
+        Route.Iface = Loopback;
+        IP::RouteTableAdd(Route);
+    }
+    LocalSocket::Register();
 }
 
 _END_EXTERN_C
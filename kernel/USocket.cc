@@ -1,5 +1,6 @@
 #include "USocket.hh"
 #include "UProtocols4.tcc"
+#include "ULocalSocket.hh"
 
 _EXTERN_C
 
@@ -9,36 +10,65 @@ int fdalloc(struct file* f);
 void fileclose(file* f);
 int argfd(int n, int* pfd, struct file** pf);
 int argptr(int n, char** pp, int size);
+int checkptr(uintp addr, int size);
+int argiovec(int n, int cnt, struct iovec** iovp);
+int arguintp(int n, uintp* ip);
+void ilock(struct inode* ip);
+void iunlock(struct inode* ip);
+int readi(struct inode* ip, char* dst, uint off, uint n);
+int argstr(int n, char** pp);
+struct inode* socknodecreate(char* path);
+struct inode* socknodelookup(char* path);
 
 file* CreateSocket(int Domain, int Type, int Protocol)
 {
-    if (Domain != Internet || (Type != Stream && Type != Datagram) || Protocol)
+    if ((Domain != Internet && Domain != Localhost) || (Type != Stream && Type != Datagram) || Protocol)
     {
         return nullptr;
     }
 
     file* f = filealloc();
     if (!f) {return nullptr;}
+    f->Socket.Domain = Domain;
     f->Socket.Type = Type;
-    f->Socket.Desc = (Type == Stream) ? TCB<4>::Open() : UDPController<4>::Open();
+    if (Domain == Localhost) {f->Socket.Desc = LocalSocket::Open(Type);}
+    else {f->Socket.Desc = (Type == Stream) ? TCB<4>::Open() : UDPController<4>::Open();}
+    if (f->Socket.Desc < 0)
+    {
+        f->type = file::FD_NONE;
+        fileclose(f);
+        return nullptr;
+    }
     f->type = file::FD_SOCKET;
     f->readable = 1;
     f->writable = 1;
     return f;
 }
 
+// Localhost domain sockets go to LocalSocket, by path instead of address.
+static BOOL IsLocal(const file* f)
+{
+    return f->Socket.Domain == Localhost;
+}
+
 void DestorySocket(file* f)
 {
+    if (IsLocal(f))
+    {
+        LocalSocket::Close(f->Socket.Desc);
+        return;
+    }
     if (f->Socket.Type == Stream) {TCB<4>::Close(f->Socket.Desc);}
     else if (f->Socket.Type == Datagram) {UDPController<4>::Close(f->Socket.Desc);}
 }
 
 int BindSocket(const file* f, DWORD Address, WORD Port)
 {
+    if (IsLocal(f)) {return -1;}
     switch (f->Socket.Type)
     {
     case Stream:
-        return TCB<4>::Bind(f->Socket.Desc, Port);
+        return TCB<4>::Bind(f->Socket.Desc, Address, Port);
     case Datagram:
         return UDPController<4>::Bind(f->Socket.Desc, Address, Port);
         break;
@@ -47,8 +77,55 @@ int BindSocket(const file* f, DWORD Address, WORD Port)
     }
 }
 
+// O_NONBLOCK on the file, or MessageDontWait for the one call.
+static BOOL IsNonBlocking(const file* f, int Flags)
+{
+    return (f->flags & O_NONBLOCK) || (Flags & MessageDontWait);
+}
+
+int SocketConnect(const file* f, DWORD Address, WORD Port)
+{
+    if (IsLocal(f)) {return -1;}
+    switch (f->Socket.Type)
+    {
+    case Stream:
+        return TCB<4>::Connect(f->Socket.Desc, Address, Port, IsNonBlocking(f, 0));
+    default:
+        return -1;
+    }
+}
+
+int SocketPoll(const file* f)
+{
+    if (IsLocal(f)) {return LocalSocket::Poll(f->Socket.Desc);}
+    switch (f->Socket.Type)
+    {
+    case Stream:
+        return TCB<4>::Poll(f->Socket.Desc);
+    case Datagram:
+        return UDPController<4>::Poll(f->Socket.Desc);
+    default:
+        return POLLNVAL;
+    }
+}
+
+pollqueue* SocketPollQueue(const file* f)
+{
+    if (IsLocal(f)) {return LocalSocket::GetPollQueue(f->Socket.Desc);}
+    switch (f->Socket.Type)
+    {
+    case Stream:
+        return TCB<4>::GetPollQueue(f->Socket.Desc);
+    case Datagram:
+        return UDPController<4>::GetPollQueue(f->Socket.Desc);
+    default:
+        return nullptr;
+    }
+}
+
 int SocketStartListen(const file* f, int Backlog)
 {
+    if (IsLocal(f)) {return LocalSocket::Listen(f->Socket.Desc, Backlog);}
     switch (f->Socket.Type)
     {
     case Stream:
@@ -58,31 +135,44 @@ int SocketStartListen(const file* f, int Backlog)
     }
 }
 
-file* SocketAccept(const file* f, DWORD* DestinationAddress, WORD* DestinationPort)
+// The new socket blocks, whatever the listener does.
+int SocketAccept(const file* f, file** Accepted, DWORD* DestinationAddress, WORD* DestinationPort)
 {
-    if (f->Socket.Type != Stream) {return nullptr;}
+    if (f->Socket.Type != Stream) {return -2;}
     file* af = filealloc();
-    if (!af) {return nullptr;}
-    int Accepted = TCB<4>::Accept(f->Socket.Desc, DestinationAddress, DestinationPort);
-    if (Accepted < 0)
+    if (!af) {return -2;}
+    int Index;
+    if (IsLocal(f))
+    {
+        Index = LocalSocket::Accept(f->Socket.Desc, IsNonBlocking(f, 0));
+        *DestinationAddress = 0;
+        *DestinationPort = 0;
+    }
+    else {Index = TCB<4>::Accept(f->Socket.Desc, DestinationAddress, DestinationPort, IsNonBlocking(f, 0));}
+    if (Index < 0)
     {
         fileclose(af);
-        return nullptr;
+        return Index == FWOULDBLOCK ? FWOULDBLOCK : -2;
     }
+    af->Socket.Domain = f->Socket.Domain;
     af->Socket.Type = f->Socket.Type;
-    af->Socket.Desc = Accepted;
+    af->Socket.Desc = Index;
     af->type = file::FD_SOCKET;
     af->readable = 1;
     af->writable = 1;
-    return af;
+    *Accepted = af;
+    return 0;
 }
 
-int SocketRead(const file* f, LPVOID Buffer, int Size)
+int SocketRead(const file* f, LPVOID Buffer, int Size, int Flags)
 {
+    if (IsLocal(f)) {return LocalSocket::Receive(f->Socket.Desc, Buffer, Size, IsNonBlocking(f, Flags));}
     switch (f->Socket.Type)
     {
     case Stream:
-        return TCB<4>::Receive(f->Socket.Desc, Buffer, Size);
+        return TCB<4>::Receive(f->Socket.Desc, Buffer, Size, IsNonBlocking(f, Flags));
+    case Datagram:
+        return UDPController<4>::Receive(f->Socket.Desc, nullptr, nullptr, Buffer, Size, IsNonBlocking(f, Flags));
     default:
         return -1;
     }
@@ -90,21 +180,76 @@ int SocketRead(const file* f, LPVOID Buffer, int Size)
 
 int SocketReceiveFrom(const file* f, DWORD* Address, WORD* Port, LPVOID Buffer, int Size)
 {
+    if (IsLocal(f)) {return -1;}
     switch (f->Socket.Type)
     {
     case Datagram:
-        return UDPController<4>::Receive(f->Socket.Desc, Address, Port, Buffer, Size);
+        return UDPController<4>::Receive(f->Socket.Desc, Address, Port, Buffer, Size, IsNonBlocking(f, 0));
+    default:
+        return -1;
+    }
+}
+
+int SocketWrite(const file* f, LPCVOID Buffer, int Size, int Flags)
+{
+    if (IsLocal(f)) {return LocalSocket::Transmit(f->Socket.Desc, Buffer, Size, IsNonBlocking(f, Flags));}
+    switch (f->Socket.Type)
+    {
+    case Stream:
+        return TCB<4>::Transmit(f->Socket.Desc, Buffer, Size, IsNonBlocking(f, Flags));
+    default:
+        return -1;
+    }
+}
+
+int SocketReadVector(const file* f, const iovec* Vectors, int Count, int Flags)
+{
+    if (IsLocal(f)) {return LocalSocket::ReceiveVector(f->Socket.Desc, Vectors, Count, IsNonBlocking(f, Flags));}
+    switch (f->Socket.Type)
+    {
+    case Stream:
+        return TCB<4>::ReceiveVector(f->Socket.Desc, Vectors, Count, IsNonBlocking(f, Flags));
+    default:
+        return -1;
+    }
+}
+
+int SocketWriteVector(const file* f, const iovec* Vectors, int Count, int Flags)
+{
+    if (IsLocal(f)) {return LocalSocket::TransmitVector(f->Socket.Desc, Vectors, Count, IsNonBlocking(f, Flags));}
+    switch (f->Socket.Type)
+    {
+    case Stream:
+        return TCB<4>::TransmitVector(f->Socket.Desc, Vectors, Count, IsNonBlocking(f, Flags));
     default:
         return -1;
     }
 }
 
-int SocketWrite(const file* f, LPCVOID Buffer, int Size)
+struct FileSource
+{
+    inode* ip;
+    uint Offset;
+};
+
+// Reads through the buffer cache into the send buffer, see TransmitFill().
+static int FillFromFile(LPVOID Context, BYTE* Destination, int Offset, int Size)
+{
+    FileSource* Source = (FileSource*)Context;
+    ilock(Source->ip);
+    int Read = readi(Source->ip, (char*)Destination, Source->Offset + Offset, Size);
+    iunlock(Source->ip);
+    return Read;
+}
+
+int SocketSendFile(const file* f, inode* ip, uint Offset, int Count)
 {
+    if (IsLocal(f)) {return -1;}
+    FileSource Source = {ip, Offset};
     switch (f->Socket.Type)
     {
     case Stream:
-        return TCB<4>::Transmit(f->Socket.Desc, Buffer, Size);
+        return TCB<4>::TransmitFill(f->Socket.Desc, Count, IsNonBlocking(f, 0), FillFromFile, &Source);
     default:
         return -1;
     }
@@ -112,6 +257,7 @@ int SocketWrite(const file* f, LPCVOID Buffer, int Size)
 
 int SocketSendTo(const file* f, DWORD Address, WORD Port, LPVOID Buffer, int Size)
 {
+    if (IsLocal(f)) {return -1;}
     switch (f->Socket.Type)
     {
     case Datagram:
@@ -121,6 +267,98 @@ int SocketSendTo(const file* f, DWORD Address, WORD Port, LPVOID Buffer, int Siz
     }
 }
 
+int SocketSendBatch(const file* f, DatagramMessage* Messages, int Count)
+{
+    if (IsLocal(f)) {return -1;}
+    switch (f->Socket.Type)
+    {
+    case Datagram:
+        return UDPController<4>::TransmitBatch(f->Socket.Desc, Messages, Count);
+    default:
+        return -1;
+    }
+}
+
+int SocketReceiveBatch(const file* f, DatagramMessage* Messages, int Count, int Flags)
+{
+    if (IsLocal(f)) {return -1;}
+    switch (f->Socket.Type)
+    {
+    case Datagram:
+        return UDPController<4>::ReceiveBatch(f->Socket.Desc, Messages, Count, IsNonBlocking(f, Flags));
+    default:
+        return -1;
+    }
+}
+
+int SetSocketOption(const file* f, int Option, int Value)
+{
+    if (IsLocal(f))
+    {
+        if (Option != SocketReceiveBuffer) {return -1;}
+        return LocalSocket::SetReceiveBufferSize(f->Socket.Desc, Value);
+    }
+    switch (Option)
+    {
+    case TCPCongestion:
+        if (f->Socket.Type != Stream) {return -1;}
+        return TCB<4>::SetCongestionControl(f->Socket.Desc, CongestionControl::Find(Value));
+    case SocketReceiveBuffer:
+        if (f->Socket.Type == Datagram) {return UDPController<4>::SetReceiveBufferSize(f->Socket.Desc, Value);}
+        return TCB<4>::SetReceiveBufferSize(f->Socket.Desc, Value);
+    case TCPQuickAck:
+        if (f->Socket.Type != Stream) {return -1;}
+        return TCB<4>::SetOptionFlag(f->Socket.Desc, TCB<4>::OptionQuickAck, Value);
+    case TCPNoDelay:
+        if (f->Socket.Type != Stream) {return -1;}
+        return TCB<4>::SetOptionFlag(f->Socket.Desc, TCB<4>::OptionNoDelay, Value);
+    case TCPCork:
+        if (f->Socket.Type != Stream) {return -1;}
+        return TCB<4>::SetOptionFlag(f->Socket.Desc, TCB<4>::OptionCork, Value);
+    case SocketKeepAlive:
+        if (f->Socket.Type != Stream) {return -1;}
+        return TCB<4>::SetOptionFlag(f->Socket.Desc, TCB<4>::OptionKeepAlive, Value);
+    case SocketReusePort:
+        if (f->Socket.Type == Datagram) {return UDPController<4>::SetReusePort(f->Socket.Desc, Value);}
+        return TCB<4>::SetOptionFlag(f->Socket.Desc, TCB<4>::OptionReusePort, Value);
+    case TCPKeepIdle:
+        if (f->Socket.Type != Stream || Value <= 0) {return -1;}
+        return TCB<4>::SetKeepAlive(f->Socket.Desc, Value, -1, -1);
+    case TCPKeepInterval:
+        if (f->Socket.Type != Stream || Value <= 0) {return -1;}
+        return TCB<4>::SetKeepAlive(f->Socket.Desc, -1, Value, -1);
+    case TCPKeepCount:
+        if (f->Socket.Type != Stream || Value <= 0) {return -1;}
+        return TCB<4>::SetKeepAlive(f->Socket.Desc, -1, -1, Value);
+    default:
+        return -1;
+    }
+}
+
+int GetSocketOption(const file* f, int Option)
+{
+    if (IsLocal(f))
+    {
+        if (Option == SocketMemory) {return LocalSocket::GetMemory(f->Socket.Desc);}
+        if (Option != SocketReceiveBuffer) {return -1;}
+        return LocalSocket::GetReceiveBufferSize(f->Socket.Desc);
+    }
+    switch (Option)
+    {
+    case SocketReceiveBuffer:
+        if (f->Socket.Type == Datagram) {return UDPController<4>::GetReceiveBufferSize(f->Socket.Desc);}
+        return TCB<4>::GetReceiveBufferSize(f->Socket.Desc);
+    case SocketReceiveDrops:
+        if (f->Socket.Type != Datagram) {return -1;}
+        return UDPController<4>::GetReceiveDrops(f->Socket.Desc);
+    case SocketMemory:
+        if (f->Socket.Type == Datagram) {return UDPController<4>::GetMemory(f->Socket.Desc);}
+        return TCB<4>::GetMemory(f->Socket.Desc);
+    default:
+        return -1;
+    }
+}
+
 // System calls
 
 int SOC_CreateSocket()
@@ -155,6 +393,52 @@ int SOC_BindSocket()
     return BindSocket(f, Address, Port);
 }
 
+int SOC_SocketConnect()
+{
+    file* f;
+    int Address;
+    int Port;
+    if (argfd(0, 0, &f) < 0 || argint(1, &Address) < 0 || argint(2, &Port) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketConnect(f, Address, Port);
+}
+
+// bindlocal(): creates the socket node at Path, which must not exist yet,
+// and binds a Localhost domain socket to it.
+int SOC_BindLocalSocket()
+{
+    file* f;
+    char* Path;
+    if (argfd(0, 0, &f) < 0 || argstr(1, &Path) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET || !IsLocal(f)) {return -2;}
+    if (LocalSocket::IsBound(f->Socket.Desc)) {return -3;}
+    inode* Node = socknodecreate(Path);
+    if (!Node) {return -3;}
+    return LocalSocket::Bind(f->Socket.Desc, Node);
+}
+
+// connectlocal(): connects a Localhost domain socket to the one bound to
+// the socket node at Path.
+int SOC_ConnectLocalSocket()
+{
+    file* f;
+    char* Path;
+    if (argfd(0, 0, &f) < 0 || argstr(1, &Path) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET || !IsLocal(f)) {return -2;}
+    inode* Node = socknodelookup(Path);
+    if (!Node) {return -4;}
+    return LocalSocket::Connect(f->Socket.Desc, Node, IsNonBlocking(f, 0));
+}
+
 int SOC_SocketStartListen()
 {
     file* f;
@@ -180,8 +464,8 @@ int SOC_SocketAccept()
         return -1;
     }
     if (f->type != file::FD_SOCKET) {return -2;}
-    af = SocketAccept(f, IP, Port);
-    if (!af) {return -2;}
+    int ReturnValue = SocketAccept(f, &af, IP, Port);
+    if (ReturnValue < 0) {return ReturnValue;}
     afd = fdalloc(af);
     if (afd < 0)
     {
@@ -197,13 +481,13 @@ int SOC_SocketRead()
     void* Buffer;
     int Size;
     if (argfd(0, 0, &f) < 0 ||
-        argptr(1, (char**)(&Buffer), sizeof(BYTE)) < 0 ||
-        argint(2, &Size) < 0)
+        argint(2, &Size) < 0 || Size < 0 ||
+        argptr(1, (char**)(&Buffer), Size) < 0)
     {
         return -1;
     }
     if (f->type != file::FD_SOCKET) {return -2;}
-    return SocketRead(f, Buffer, Size);
+    return SocketRead(f, Buffer, Size, 0);
 }
 
 int SOC_SocketReceiveFrom()
@@ -216,8 +500,8 @@ int SOC_SocketReceiveFrom()
     if (argfd(0, 0, &f) < 0 ||
         argptr(1, (char**)(&Addr), sizeof(DWORD)) < 0 ||
         argptr(2, (char**)(&Port), sizeof(WORD)) < 0 ||
-        argptr(3, (char**)(&Buffer), sizeof(BYTE)) < 0 ||
-        argint(4, &Size) < 0)
+        argint(4, &Size) < 0 || Size < 0 ||
+        argptr(3, (char**)(&Buffer), Size) < 0)
     {
         return -1;
     }
@@ -231,13 +515,47 @@ int SOC_SocketWrite()
     void* Buffer;
     int Size;
     if (argfd(0, 0, &f) < 0 ||
-        argptr(1, (char**)(&Buffer), sizeof(BYTE)) < 0 ||
-        argint(2, &Size) < 0)
+        argint(2, &Size) < 0 || Size < 0 ||
+        argptr(1, (char**)(&Buffer), Size) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketWrite(f, Buffer, Size, 0);
+}
+
+int SOC_SocketSend()
+{
+    file* f;
+    void* Buffer;
+    int Size;
+    int Flags;
+    if (argfd(0, 0, &f) < 0 ||
+        argint(2, &Size) < 0 || Size < 0 ||
+        argptr(1, (char**)(&Buffer), Size) < 0 ||
+        argint(3, &Flags) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketWrite(f, Buffer, Size, Flags);
+}
+
+int SOC_SocketReceive()
+{
+    file* f;
+    void* Buffer;
+    int Size;
+    int Flags;
+    if (argfd(0, 0, &f) < 0 ||
+        argint(2, &Size) < 0 || Size < 0 ||
+        argptr(1, (char**)(&Buffer), Size) < 0 ||
+        argint(3, &Flags) < 0)
     {
         return -1;
     }
     if (f->type != file::FD_SOCKET) {return -2;}
-    return SocketWrite(f, Buffer, Size);
+    return SocketRead(f, Buffer, Size, Flags);
 }
 
 int SOC_SocketSendTo()
@@ -250,8 +568,8 @@ int SOC_SocketSendTo()
     if (argfd(0, 0, &f) < 0 ||
         argint(1, &Address) < 0 ||
         argint(2, &Port) < 0 ||
-        argptr(3, (char**)(&Buffer), sizeof(BYTE)) < 0 ||
-        argint(4, &Size) < 0)
+        argint(4, &Size) < 0 || Size < 0 ||
+        argptr(3, (char**)(&Buffer), Size) < 0)
     {
         return -1;
     }
@@ -259,4 +577,127 @@ int SOC_SocketSendTo()
     return SocketSendTo(f, Address, Port, Buffer, Size);
 }
 
+// sendfile(): Count bytes of a file to a stream socket. Offset points to
+// where to start and is advanced, without it the file offset is used.
+int SOC_SocketSendFile()
+{
+    file* f;
+    file* Source;
+    uintp OffsetAddress;
+    int Count;
+    if (argfd(0, 0, &f) < 0 || argfd(1, 0, &Source) < 0 ||
+        arguintp(2, &OffsetAddress) < 0 || argint(3, &Count) < 0 || Count < 0 ||
+        (OffsetAddress && checkptr(OffsetAddress, sizeof(int)) < 0))
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET || Source->type != file::FD_INODE || !Source->readable) {return -2;}
+    int* Offset = (int*)OffsetAddress;
+    int Sent = SocketSendFile(f, Source->ip, Offset ? *Offset : Source->off, Count);
+    if (Sent > 0)
+    {
+        if (Offset) {*Offset += Sent;}
+        else {Source->off += Sent;}
+    }
+    return Sent;
+}
+
+int SOC_SocketSendVector()
+{
+    file* f;
+    iovec* Vectors;
+    int Count;
+    int Flags;
+    if (argfd(0, 0, &f) < 0 || argint(2, &Count) < 0 || argint(3, &Flags) < 0 ||
+        argiovec(1, Count, &Vectors) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketWriteVector(f, Vectors, Count, Flags);
+}
+
+int SOC_SocketReceiveVector()
+{
+    file* f;
+    iovec* Vectors;
+    int Count;
+    int Flags;
+    if (argfd(0, 0, &f) < 0 || argint(2, &Count) < 0 || argint(3, &Flags) < 0 ||
+        argiovec(1, Count, &Vectors) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketReadVector(f, Vectors, Count, Flags);
+}
+
+// The message array and every buffer in it must belong to the caller.
+static int ArgumentMessages(int n, int Count, DatagramMessage** Messages)
+{
+    if (Count <= 0) {return -1;}
+    if (Count > UDP<4>::MaxMessageBatch) {Count = UDP<4>::MaxMessageBatch;}
+    if (argptr(n, (char**)Messages, Count * sizeof(DatagramMessage)) < 0) {return -1;}
+    for (int i = 0; i < Count; ++i)
+    {
+        const DatagramMessage& Message = (*Messages)[i];
+        if (Message.Size < 0 || checkptr((uintp)Message.Buffer, Message.Size) < 0) {return -1;}
+    }
+    return Count;
+}
+
+int SOC_SocketSendBatch()
+{
+    file* f;
+    DatagramMessage* Messages;
+    int Count;
+    if (argfd(0, 0, &f) < 0 || argint(2, &Count) < 0 ||
+        (Count = ArgumentMessages(1, Count, &Messages)) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketSendBatch(f, Messages, Count);
+}
+
+int SOC_SocketReceiveBatch()
+{
+    file* f;
+    DatagramMessage* Messages;
+    int Count;
+    int Flags;
+    if (argfd(0, 0, &f) < 0 || argint(2, &Count) < 0 || argint(3, &Flags) < 0 ||
+        (Count = ArgumentMessages(1, Count, &Messages)) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SocketReceiveBatch(f, Messages, Count, Flags);
+}
+
+int SOC_GetSocketOption()
+{
+    file* f;
+    int Option;
+    if (argfd(0, 0, &f) < 0 || argint(1, &Option) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return GetSocketOption(f, Option);
+}
+
+int SOC_SetSocketOption()
+{
+    file* f;
+    int Option;
+    int Value;
+    if (argfd(0, 0, &f) < 0 || argint(1, &Option) < 0 || argint(2, &Value) < 0)
+    {
+        return -1;
+    }
+    if (f->type != file::FD_SOCKET) {return -2;}
+    return SetSocketOption(f, Option, Value);
+}
+
 _END_EXTERN_C
@@ -0,0 +1,448 @@
+// Readiness notification: poll() and epoll.
+//
+// Pollable objects (pipes, TCBs and UDP controllers) keep a pollqueue and
+// call pollnotify() wherever their state may have changed. poll() puts an
+// entry on the queue of every descriptor for the length of the call and
+// sleeps until one of them fires. An epoll instance keeps one entry per
+// watched descriptor for as long as it is registered, and the entry's
+// callback appends the item to the instance's ready list, so epoll_wait()
+// only looks at descriptors that changed, however many are watched.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "file.h"
+#include "epoll.h"
+#include "eventpoll.h"
+#include "timerwheel.h"
+#include "kernel/string.h"
+
+#define MS_TO_TICKS(ms) (((uint)(ms) + 9) / 10) // 100 Hz, see timer.c
+#define EP_BATCH        64                // Most events one epoll_wait() returns
+
+// Entry of poll(), one per descriptor.
+struct pollwait {
+	struct pollentry entry;
+	struct pollwaiter* waiter;
+};
+
+struct pollwaiter {
+	struct spinlock lock;
+	int triggered; // An entry fired since the last scan
+};
+
+#define POLL_PER_PAGE (PGSIZE / sizeof(struct pollwait))
+#define POLL_PAGES    ((NOFILE + POLL_PER_PAGE - 1) / POLL_PER_PAGE)
+
+// Watched descriptor of an epoll instance.
+struct epitem {
+	struct pollentry entry;  // On the target's queue, must come first
+	struct eventpoll* ep;
+	struct file* file;       // Not held, see eventpoll_release()
+	int fd;
+	uint events;             // Requested, 0 once EPOLLONESHOT fired
+	uint64 data;
+	int ready;               // On ep's ready list
+	struct epitem* rdnext;
+	struct epitem** rdpprev;
+	struct epitem* next;     // Free list, or the batch of epollwait()
+};
+
+struct eventpoll {
+	struct spinlock lock;    // Ready list
+	struct epitem* rdhead;
+	struct epitem** rdtail;
+	struct epitem* byfd[NOFILE];
+};
+
+// eptable.lock guards the free list and every instance's byfd, and keeps
+// the files of all items open while it is held.
+// Lock order: ftable, eptable, target object, pollqueue, instance.
+static struct {
+	struct spinlock lock;
+	struct epitem item[NEPITEM];
+	struct epitem* free;
+} eptable;
+
+void eventpollinit(void){
+	initlock(&eptable.lock, "eventpoll");
+	for (int i = NEPITEM - 1; i >= 0; i--) {
+		eptable.item[i].next = eptable.free;
+		eptable.free = &eptable.item[i];
+	}
+}
+
+void pollqueueinit(struct pollqueue* q){
+	initlock(&q->lock, "pollqueue");
+	q->head = 0;
+}
+
+void pollqueueadd(struct pollqueue* q, struct pollentry* e, void (*func)(struct pollentry*)){
+	e->func = func;
+	e->queue = q;
+	acquire(&q->lock);
+	e->next = q->head;
+	if (e->next)
+		e->next->pprev = &e->next;
+	q->head = e;
+	e->pprev = &q->head;
+	release(&q->lock);
+}
+
+// Once this returns the entry's callback is not running either.
+void pollqueueremove(struct pollentry* e){
+	struct pollqueue* q = e->queue;
+
+	if (q == 0)
+		return;
+	acquire(&q->lock);
+	*e->pprev = e->next;
+	if (e->next)
+		e->next->pprev = e->pprev;
+	e->next = 0;
+	e->pprev = 0;
+	release(&q->lock);
+	e->queue = 0;
+}
+
+// Callbacks run with the queue locked and must not remove entries.
+void pollnotify(struct pollqueue* q){
+	acquire(&q->lock);
+	for (struct pollentry* e = q->head; e; e = e->next)
+		e->func(e);
+	release(&q->lock);
+}
+
+static void pollwake(struct pollentry* e){
+	struct pollwaiter* w = ((struct pollwait*)e)->waiter;
+
+	acquire(&w->lock);
+	w->triggered = 1;
+	wakeup(w);
+	release(&w->lock);
+}
+
+static struct file* pollfile(int fd){
+	if (fd < 0 || fd >= NOFILE)
+		return 0;
+	return proc->ofile[fd];
+}
+
+// poll(): wait up to timeout milliseconds, forever if it is negative, for
+// one of the n descriptors of fds to have an event. POLLERR and POLLHUP
+// are reported even if not asked for. Returns how many descriptors have
+// revents set, 0 if the time ran out, -1 on error.
+int pollfds(struct pollfd* fds, int n, int timeout){
+	struct pollwaiter w;
+	struct pollwait* pages[POLL_PAGES];
+	int npages = (n + POLL_PER_PAGE - 1) / POLL_PER_PAGE;
+	uint deadline = ticks + MS_TO_TICKS(timeout);
+	int ready, expired = 0;
+
+	if (n < 0 || n > NOFILE)
+		return -1;
+	for (int i = 0; i < npages; i++) {
+		if ((pages[i] = (struct pollwait*)kalloc()) == 0) {
+			while (i--)
+				kfree((char*)pages[i]);
+			return -1;
+		}
+	}
+	initlock(&w.lock, "poll");
+	w.triggered = 0;
+
+	// Queued before the first scan, so no change after it is missed.
+	for (int i = 0; i < n; i++) {
+		struct pollwait* pw = &pages[i / POLL_PER_PAGE][i % POLL_PER_PAGE];
+		struct file* f = pollfile(fds[i].fd);
+		struct pollqueue* q = f ? filepollqueue(f) : 0;
+
+		pw->entry.queue = 0;
+		pw->waiter = &w;
+		if (q)
+			pollqueueadd(q, &pw->entry, pollwake);
+	}
+
+	for (;;) {
+		ready = 0;
+		for (int i = 0; i < n; i++) {
+			struct file* f;
+
+			fds[i].revents = 0;
+			if (fds[i].fd < 0)
+				continue;
+			if ((f = pollfile(fds[i].fd)) == 0)
+				fds[i].revents = POLLNVAL;
+			else
+				fds[i].revents = filepoll(f) & (fds[i].events | POLLERR | POLLHUP);
+			if (fds[i].revents)
+				ready++;
+		}
+		if (ready || timeout == 0 || expired)
+			break;
+		if (proc->killed) {
+			ready = -1;
+			break;
+		}
+		acquire(&w.lock);
+		if (!w.triggered) {
+			if (timeout < 0)
+				sleep(&w, &w.lock);
+			else
+				expired = sleep_until(&w, &w.lock, deadline) < 0;
+		}
+		w.triggered = 0;
+		release(&w.lock);
+	}
+
+	for (int i = 0; i < n; i++)
+		pollqueueremove(&pages[i / POLL_PER_PAGE][i % POLL_PER_PAGE].entry);
+	for (int i = 0; i < npages; i++)
+		kfree((char*)pages[i]);
+	return ready;
+}
+
+// Ready list, the caller holds ep->lock.
+static void rdadd(struct eventpoll* ep, struct epitem* it){
+	it->ready = 1;
+	it->rdnext = 0;
+	it->rdpprev = ep->rdtail;
+	*ep->rdtail = it;
+	ep->rdtail = &it->rdnext;
+}
+
+static void rddel(struct eventpoll* ep, struct epitem* it){
+	*it->rdpprev = it->rdnext;
+	if (it->rdnext)
+		it->rdnext->rdpprev = it->rdpprev;
+	else
+		ep->rdtail = it->rdpprev;
+	it->ready = 0;
+}
+
+// The target changed, let epoll_wait() look at it.
+static void epcallback(struct pollentry* e){
+	struct epitem* it = (struct epitem*)e;
+	struct eventpoll* ep = it->ep;
+
+	acquire(&ep->lock);
+	if (!it->ready && it->events) {
+		rdadd(ep, it);
+		wakeup(ep);
+	}
+	release(&ep->lock);
+}
+
+// Caller holds eptable.lock.
+static void epremove(struct epitem* it){
+	struct eventpoll* ep = it->ep;
+
+	pollqueueremove(&it->entry);
+	acquire(&ep->lock);
+	if (it->ready)
+		rddel(ep, it);
+	release(&ep->lock);
+	if (ep->byfd[it->fd] == it)
+		ep->byfd[it->fd] = 0;
+	it->next = eptable.free;
+	eptable.free = it;
+}
+
+struct file* epollcreate(void){
+	struct file* f;
+	struct eventpoll* ep;
+
+	if ((f = filealloc()) == 0)
+		return 0;
+	if ((ep = (struct eventpoll*)kalloc()) == 0) {
+		fileclose(f);
+		return 0;
+	}
+	memset(ep, 0, sizeof(*ep));
+	initlock(&ep->lock, "epoll");
+	ep->rdtail = &ep->rdhead;
+	f->type = FD_EPOLL;
+	f->readable = 0;
+	f->writable = 0;
+	f->ep = ep;
+	return f;
+}
+
+// epoll_ctl() on f, open as fd. Only pipes and sockets can be watched.
+// Registering the item queues it, so a target that is ready already is
+// reported by the next epoll_wait().
+int epollctl(struct file* epf, int op, int fd, struct file* f, struct epoll_event* ev){
+	struct eventpoll* ep = epf->ep;
+	struct pollqueue* q = filepollqueue(f);
+	struct epitem* it;
+	int r = 0;
+
+	if (q == 0)
+		return -2;
+	acquire(&eptable.lock);
+	// The descriptor was closed and reused while a dup kept the old
+	// file open, that registration can never be named again.
+	it = ep->byfd[fd];
+	if (it && it->file != f) {
+		epremove(it);
+		it = 0;
+	}
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (it) {
+			r = -3;
+			break;
+		}
+		if ((it = eptable.free) == 0) {
+			r = -4;
+			break;
+		}
+		eptable.free = it->next;
+		it->ep = ep;
+		it->file = f;
+		it->fd = fd;
+		it->events = ev->events;
+		it->data = ev->data.u64;
+		it->ready = 0;
+		ep->byfd[fd] = it;
+		pollqueueadd(q, &it->entry, epcallback);
+		epcallback(&it->entry);
+		break;
+	case EPOLL_CTL_MOD:
+		if (it == 0) {
+			r = -5;
+			break;
+		}
+		acquire(&ep->lock);
+		it->events = ev->events;
+		it->data = ev->data.u64;
+		release(&ep->lock);
+		epcallback(&it->entry);
+		break;
+	case EPOLL_CTL_DEL:
+		if (it == 0) {
+			r = -5;
+			break;
+		}
+		epremove(it);
+		break;
+	default:
+		r = -1;
+		break;
+	}
+	release(&eptable.lock);
+	return r;
+}
+
+// epoll_wait(): up to max events (at most EP_BATCH) from the ready list,
+// waiting up to timeout milliseconds, forever if negative, for the first.
+// Items are polled again before they are reported. Level-triggered ones
+// that were reported go back on the list, so the next call looks at them
+// again and drops those that are no longer ready. The batch is chained
+// through the items' free list links, they are in use and eptable.lock
+// is held, so the stack only holds its head.
+int epollwait(struct file* epf, struct epoll_event* events, int max, int timeout){
+	struct eventpoll* ep = epf->ep;
+	struct epitem *batch, *it, **link;
+	uint deadline = ticks + MS_TO_TICKS(timeout);
+	int count = 0, expired = 0;
+
+	if (max <= 0)
+		return -1;
+	if (max > EP_BATCH)
+		max = EP_BATCH;
+	for (;;) {
+		int n = 0;
+
+		acquire(&eptable.lock);
+		acquire(&ep->lock);
+		link = &batch;
+		while (n < max && ep->rdhead) {
+			it = ep->rdhead;
+			rddel(ep, it);
+			*link = it;
+			link = &it->next;
+			n++;
+		}
+		*link = 0;
+		release(&ep->lock);
+
+		// A callback during the scan queues the item again, as it is off
+		// the list now. Items not reported leave the batch.
+		link = &batch;
+		while ((it = *link) != 0) {
+			uint mask = filepoll(it->file) & (it->events | POLLERR | POLLHUP);
+
+			if (mask == 0 || it->events == 0) {
+				*link = it->next;
+				continue;
+			}
+			events[count].events = mask;
+			events[count].data.u64 = it->data;
+			count++;
+			link = &it->next;
+		}
+		acquire(&ep->lock);
+		for (it = batch; it; it = it->next) {
+			if (it->events & EPOLLONESHOT)
+				it->events = 0;
+			else if (!(it->events & EPOLLET) && !it->ready)
+				rdadd(ep, it);
+		}
+		release(&ep->lock);
+		release(&eptable.lock);
+
+		if (count || timeout == 0 || expired)
+			break;
+		if (proc->killed)
+			return -1;
+		acquire(&ep->lock);
+		if (ep->rdhead == 0) {
+			if (timeout < 0)
+				sleep(ep, &ep->lock);
+			else
+				expired = sleep_until(ep, &ep->lock, deadline) < 0;
+		}
+		release(&ep->lock);
+	}
+	return count;
+}
+
+// The epoll file itself is closed.
+void epollclose(struct eventpoll* ep){
+	acquire(&eptable.lock);
+	for (int fd = 0; fd < NOFILE; fd++) {
+		if (ep->byfd[fd])
+			epremove(ep->byfd[fd]);
+	}
+	release(&eptable.lock);
+	kfree((char*)ep);
+}
+
+// f is being closed, drop it from every instance that watches it before
+// its object goes away.
+void eventpoll_release(struct file* f){
+	struct pollqueue* q = filepollqueue(f);
+
+	if (q == 0)
+		return;
+	acquire(&eptable.lock);
+	for (;;) {
+		struct pollentry* e;
+
+		acquire(&q->lock);
+		for (e = q->head; e; e = e->next) {
+			if (e->func == epcallback && ((struct epitem*)e)->file == f)
+				break;
+		}
+		release(&q->lock);
+		if (e == 0)
+			break;
+		epremove((struct epitem*)e);
+	}
+	release(&eptable.lock);
+}
@@ -8,6 +8,7 @@
 #include "vfs.h"
 #include "file.h"
 #include "spinlock.h"
+#include "eventpoll.h"
 
 #include "USocket.hh"
 
@@ -30,6 +31,7 @@ filealloc(void){
 	for (f = ftable.file; f < ftable.file + NFILE; f++) {
 		if (f->ref == 0) {
 			f->ref = 1;
+			f->flags = 0;
 			release(&ftable.lock);
 			return f;
 		}
@@ -59,6 +61,8 @@ void fileclose(struct file* f){
 		release(&ftable.lock);
 		return;
 	}
+	// Before f can be reused, epoll_wait() may still look at it.
+	eventpoll_release(f);
 	ff = *f;
 	f->ref = 0;
 	f->type = FD_NONE;
@@ -75,6 +79,28 @@ void fileclose(struct file* f){
     {
         DestorySocket(&ff);
     }
+	else if (ff.type == FD_EPOLL)
+		epollclose(ff.ep);
+}
+
+// Readiness of f as poll() events.
+int filepoll(struct file* f){
+	if (f->type == FD_PIPE)
+		return pipepoll(f->pipe, f->writable);
+	if (f->type == FD_INODE)
+		return (f->readable ? POLLIN : 0) | (f->writable ? POLLOUT : 0);
+	if (f->type == FD_SOCKET)
+		return SocketPoll(f);
+	return 0;
+}
+
+// Where changes of f are announced, 0 if it never changes.
+struct pollqueue* filepollqueue(struct file* f){
+	if (f->type == FD_PIPE)
+		return pipepollqueue(f->pipe);
+	if (f->type == FD_SOCKET)
+		return SocketPollQueue(f);
+	return 0;
 }
 
 // Get metadata about file f.
@@ -104,7 +130,7 @@ int fileread(struct file* f, char* addr, int n){
 	}
     if (f->type == FD_SOCKET)
     {
-        return SocketRead(f, addr, n);
+        return SocketRead(f, addr, n, 0);
     }
 	panic("fileread");
 }
@@ -162,7 +188,46 @@ int filewrite(struct file* f, char* addr, int n){
 	}
     if (f->type == FD_SOCKET)
     {
-        SocketWrite(f, addr, n);
+        return SocketWrite(f, addr, n, 0);
     }
 	panic("filewrite");
 }
+
+// Read from file f into the iovcnt buffers of iov. A socket scatters its
+// data in one go, other files are read a buffer at a time until one
+// comes back short.
+int filereadv(struct file* f, struct iovec* iov, int iovcnt){
+	int i, r, n = 0;
+
+	if (f->readable == 0)
+		return -1;
+	if (f->type == FD_SOCKET)
+		return SocketReadVector(f, iov, iovcnt, 0);
+	for (i = 0; i < iovcnt; i++) {
+		if ((r = fileread(f, iov[i].iov_base, iov[i].iov_len)) < 0)
+			return n ? n : r;
+		n += r;
+		if (r < iov[i].iov_len)
+			break;
+	}
+	return n;
+}
+
+// Write the iovcnt buffers of iov to file f, gathered into one send for
+// a socket.
+int filewritev(struct file* f, struct iovec* iov, int iovcnt){
+	int i, r, n = 0;
+
+	if (f->writable == 0)
+		return -1;
+	if (f->type == FD_SOCKET)
+		return SocketWriteVector(f, iov, iovcnt, 0);
+	for (i = 0; i < iovcnt; i++) {
+		if ((r = filewrite(f, iov[i].iov_base, iov[i].iov_len)) < 0)
+			return n ? n : r;
+		n += r;
+		if (r < iov[i].iov_len)
+			break;
+	}
+	return n;
+}
@@ -8,6 +8,9 @@
 #include "acpi.h"
 #include "pci.h"
 #include "buf.h"
+#include "spinlock.h"
+#include "timerwheel.h"
+#include "eventpoll.h"
 #include "kernel/string.h"
 
 #include "CXXInit.h"
@@ -36,6 +39,7 @@ int main(void){
 	kinit1(P2V(KALLOC_START), P2V(KALLOC_START + 4 * 1024 * 1024)); // phys page allocator
 	kvmalloc(); // kernel page table
 	trapinit();
+	timerwheelinit();
 	if (acpiinit()) // try to use acpi for machine info
 		mpinit(); // otherwise use bios MP tables
 	if (!ismp)
@@ -56,6 +60,7 @@ int main(void){
 	pciinit(); // initialize PCI bus (AHCI also)
 	binit();   // buffer cache
 	fileinit(); // file table
+	eventpollinit(); // epoll items
 	ideinit(); // init IDE disks
 
 	cprintf("Root dev: disk(%d, %d)\n", GETDEVTYPE(ROOT_DEV), GETDEVNUM(ROOT_DEV));
@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "x86.h"
 #include "fcntl.h"
+#include "eventpoll.h"
 
 #define PIPESIZE 512
 #define LOCK_WAIT_TICKS 100
@@ -21,6 +22,7 @@ struct pipe {
 	uint nwrite; // number of bytes written
 	int readopen; // read fd is still open
 	int writeopen; // write fd is still open
+	struct pollqueue pq; // poll() and epoll waiters
 };
 
 int pipealloc(struct file** f0, struct file** f1){
@@ -37,6 +39,7 @@ int pipealloc(struct file** f0, struct file** f1){
 	p->nwrite = 0;
 	p->nread = 0;
 	initlock(&p->lock, "pipe");
+	pollqueueinit(&p->pq);
 	(*f0)->type = FD_PIPE;
 	(*f0)->readable = 1;
 	(*f0)->writable = 0;
@@ -66,6 +69,7 @@ void pipeclose(struct pipe* p, int writable){
 		p->readopen = 0;
 		wakeup(&p->nwrite);
 	}
+	pollnotify(&p->pq);
 	if (p->readopen == 0 && p->writeopen == 0) {
 		release(&p->lock);
 		kfree((char*)p);
@@ -92,12 +96,14 @@ int pipewrite(struct pipe* p, char* addr, int n){
 		}
 		if(loops >= MAX_WRITE_WAIT) {
 			wakeup(&p->nread);
+			pollnotify(&p->pq);
 			release(&p->lock);
 			return FNOT_READY;
 		}
 		p->data[p->nwrite++ % PIPESIZE] = addr[i];
 	}
 	wakeup(&p->nread); // pipewrite-wakeup1
+	pollnotify(&p->pq);
 	release(&p->lock);
 	return n;
 }
@@ -128,6 +134,31 @@ int piperead(struct pipe* p, char* addr, int n){
 		addr[i] = p->data[p->nread++ % PIPESIZE];
 	}
 	wakeup(&p->nwrite); // piperead-wakeup
+	pollnotify(&p->pq);
 	release(&p->lock);
 	return i;
 }
+
+// poll() events of the read or the write end.
+int pipepoll(struct pipe* p, int writable){
+	int events = 0;
+
+	acquire(&p->lock);
+	if (writable) {
+		if (p->readopen == 0)
+			events |= POLLERR;
+		else if (p->nwrite != p->nread + PIPESIZE)
+			events |= POLLOUT;
+	} else {
+		if (p->nread != p->nwrite)
+			events |= POLLIN;
+		if (p->writeopen == 0)
+			events |= POLLHUP;
+	}
+	release(&p->lock);
+	return events;
+}
+
+struct pollqueue* pipepollqueue(struct pipe* p){
+	return &p->pq;
+}
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "timerwheel.h"
 #include "kernel/string.h"
 #include "vfs.h"
 #include "file.h"
@@ -478,6 +479,48 @@ void sleep(void* chan, struct spinlock* lk){
 	}
 }
 
+// Timer callback of sleep_until().
+static void sleep_timeout(void* arg){
+	struct proc* p = arg;
+
+	acquire(&ptable.lock);
+	if (p->state == SLEEPING)
+		p->state = RUNNABLE;
+	release(&ptable.lock);
+}
+
+// Like sleep(), but also wakes up once ticks reaches deadline.
+// Returns 0 if woken before the deadline and -1 once it has passed,
+// callers still recheck their condition as with sleep().
+int sleep_until(void* chan, struct spinlock* lk, uint deadline){
+	struct timer t;
+
+	if (proc == 0)
+		panic("sleep_until");
+
+	if (lk == 0)
+		panic("sleep_until without lk");
+
+	timer_init(&t, sleep_timeout, proc);
+	timer_add(&t, deadline);
+	acquire(&ptable.lock);
+	release(lk);
+
+	// The timer only fires with ticks at the deadline, so checking
+	// under ptable.lock cannot miss it.
+	if ((int)(ticks - deadline) < 0) {
+		proc->chan = chan;
+		proc->state = SLEEPING;
+		sched();
+		proc->chan = 0;
+	}
+
+	release(&ptable.lock);
+	timer_cancel(&t);
+	acquire(lk);
+	return (int)(ticks - deadline) < 0 ? 0 : -1;
+}
+
 
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
@@ -31,6 +31,13 @@ int fetchuintp(uintp addr, uintp* ip){
 	return 0;
 }
 
+// Check that size bytes at addr belong to the current process.
+int checkptr(uintp addr, int size){
+	if (size < 0 || addr >= proc->sz || addr + size > proc->sz)
+		return -1;
+	return 0;
+}
+
 // Fetch the nul-terminated string at addr from the current process.
 // Doesn't actually copy the string - just sets *pp to point at it.
 // Returns length of string, not including nul.
@@ -140,6 +147,13 @@ extern int sys_nprocs(void);
 extern int sys_cpuhalt(void);
 extern int sys_getpriority(void);
 extern int sys_setpriority(void);
+extern int sys_kpoll(void);
+extern int sys_epoll_create(void);
+extern int sys_epoll_ctl(void);
+extern int sys_epoll_wait(void);
+extern int sys_fcntl(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
 
 static int (*syscalls[])(void) =
 {
@@ -192,6 +206,7 @@ static int (*syscalls[])(void) =
     [SYS_RTPrint]       = INet_RTPrint,
     [SYS_RTDelete]      = INet_RTDelete,
     [SYS_Ping]          = INet_Ping,
+    [SYS_NetTunable]    = INet_NetTunable,
 
     [SYS_socket]        = SOC_CreateSocket,
     [SYS_bind]          = SOC_BindSocket,
@@ -200,7 +215,27 @@ static int (*syscalls[])(void) =
     [SYS_socksend]      = SOC_SocketWrite,
     [SYS_sockrecv]      = SOC_SocketRead,
     [SYS_sockrecvfrom]  = SOC_SocketReceiveFrom,
-    [SYS_socksendto]    = SOC_SocketSendTo
+    [SYS_socksendto]    = SOC_SocketSendTo,
+    [SYS_setsockopt]    = SOC_SetSocketOption,
+    [SYS_connect]       = SOC_SocketConnect,
+
+    [SYS_kpoll]         = sys_kpoll,
+    [SYS_epoll_create]  = sys_epoll_create,
+    [SYS_epoll_ctl]     = sys_epoll_ctl,
+    [SYS_epoll_wait]    = sys_epoll_wait,
+    [SYS_fcntl]         = sys_fcntl,
+    [SYS_send]          = SOC_SocketSend,
+    [SYS_recv]          = SOC_SocketReceive,
+    [SYS_sendmmsg]      = SOC_SocketSendBatch,
+    [SYS_recvmmsg]      = SOC_SocketReceiveBatch,
+    [SYS_readv]         = sys_readv,
+    [SYS_writev]        = sys_writev,
+    [SYS_sendmsg]       = SOC_SocketSendVector,
+    [SYS_recvmsg]       = SOC_SocketReceiveVector,
+    [SYS_sendfile]      = SOC_SocketSendFile,
+    [SYS_getsockopt]    = SOC_GetSocketOption,
+    [SYS_bindlocal]     = SOC_BindLocalSocket,
+    [SYS_connectlocal]  = SOC_ConnectLocalSocket
 };
 
 void syscall(void){
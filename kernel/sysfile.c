@@ -13,6 +13,9 @@
 #include "fs/fs1.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spinlock.h"
+#include "epoll.h"
+#include "eventpoll.h"
 #include "kernel/string.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
@@ -63,11 +66,37 @@ int sys_read(void){
 	int n;
 	char* p;
 
-	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 || argptr(1, &p, n) < 0)
 		return -1;
 	return fileread(f, p, n);
 }
 
+// Fetch the nth argument as an array of cnt iovecs. Every buffer must lie
+// within the process, and together they may not exceed what an int holds.
+int argiovec(int n, int cnt, struct iovec** iovp){
+	uintp total = 0;
+
+	if (cnt <= 0 || cnt > IOV_MAX || argptr(n, (void*)iovp, cnt * sizeof(struct iovec)) < 0)
+		return -1;
+	for (int i = 0; i < cnt; i++) {
+		struct iovec* v = &(*iovp)[i];
+		if (v->iov_len > 0x7FFFFFFF || checkptr((uintp)v->iov_base, v->iov_len) < 0)
+			return -1;
+		total += v->iov_len;
+	}
+	return total > 0x7FFFFFFF ? -1 : 0;
+}
+
+int sys_readv(void){
+	struct file* f;
+	struct iovec* iov;
+	int cnt;
+
+	if (argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiovec(1, cnt, &iov) < 0)
+		return -1;
+	return filereadv(f, iov, cnt);
+}
+
 int sys_seek(void){
 	struct file* fd;
 	int offset;
@@ -83,11 +112,21 @@ int sys_write(void){
 	int n;
 	char* p;
 
-	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 || argptr(1, &p, n) < 0)
 		return -1;
 	return filewrite(f, p, n);
 }
 
+int sys_writev(void){
+	struct file* f;
+	struct iovec* iov;
+	int cnt;
+
+	if (argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiovec(1, cnt, &iov) < 0)
+		return -1;
+	return filewritev(f, iov, cnt);
+}
+
 int sys_close(void){
 	int fd;
 	struct file* f;
@@ -269,6 +308,42 @@ static struct inode* create(char* path, short type, short major, short minor){
 	return ip;
 }
 
+// Socket node for a Localhost domain socket bound to path, see
+// ULocalSocket.cc. Returned unlocked and referenced, 0 if path exists.
+struct inode* socknodecreate(char* path){
+	struct inode* ip;
+
+	begin_op();
+	if ((ip = create(path, T_DEV, LOCALSOCK, 0)) != 0)
+		iunlock(ip);
+	end_op();
+	return ip;
+}
+
+// Socket node at path, referenced, 0 if there is none.
+struct inode* socknodelookup(char* path){
+	struct inode* ip;
+
+	begin_op();
+	if ((ip = namei(path)) != 0) {
+		ilock(ip);
+		if (ip->type != T_DEV || ip->major != LOCALSOCK) {
+			iunlockput(ip);
+			ip = 0;
+		} else {
+			iunlock(ip);
+		}
+	}
+	end_op();
+	return ip;
+}
+
+void socknodeput(struct inode* ip){
+	begin_op();
+	iput(ip);
+	end_op();
+}
+
 int sys_open(void){
 	char* path;
 	int fd, omode;
@@ -314,6 +389,7 @@ int sys_open(void){
 	f->off = 0;
 	f->readable = !(omode & O_WRONLY);
 	f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+	f->flags = omode & O_NONBLOCK;
 	return fd;
 }
 
@@ -437,3 +513,76 @@ int sys_pipe(void){
 	fd[1] = fd1;
 	return 0;
 }
+
+int sys_kpoll(void){
+	struct pollfd* fds;
+	int n, timeout;
+
+	if (argint(1, &n) < 0 || argint(2, &timeout) < 0 || n < 0 || n > NOFILE ||
+	    argptr(0, (void*)&fds, n * sizeof(fds[0])) < 0)
+		return -1;
+	return pollfds(fds, n, timeout);
+}
+
+int sys_epoll_create(void){
+	struct file* f;
+	int size, fd;
+
+	if (argint(0, &size) < 0 || size <= 0)
+		return -1;
+	if ((f = epollcreate()) == 0)
+		return -1;
+	if ((fd = fdalloc(f)) < 0) {
+		fileclose(f);
+		return -1;
+	}
+	return fd;
+}
+
+int sys_epoll_ctl(void){
+	struct file* epf, * f;
+	struct epoll_event* ev = 0;
+	int op, fd;
+
+	if (argfd(0, 0, &epf) < 0 || argint(1, &op) < 0 || argfd(2, &fd, &f) < 0)
+		return -1;
+	if (op != EPOLL_CTL_DEL && argptr(3, (void*)&ev, sizeof(*ev)) < 0)
+		return -1;
+	if (epf->type != FD_EPOLL || f == epf)
+		return -2;
+	return epollctl(epf, op, fd, f, ev);
+}
+
+int sys_epoll_wait(void){
+	struct file* epf;
+	struct epoll_event* events;
+	int max, timeout;
+
+	if (argfd(0, 0, &epf) < 0 || argint(2, &max) < 0 || argint(3, &timeout) < 0 ||
+	    max <= 0)
+		return -1;
+	if (max > NEPITEM)
+		max = NEPITEM;
+	if (argptr(1, (void*)&events, max * sizeof(events[0])) < 0)
+		return -1;
+	if (epf->type != FD_EPOLL)
+		return -2;
+	return epollwait(epf, events, max, timeout);
+}
+
+// Only O_NONBLOCK can be changed, and only sockets look at it so far.
+int sys_fcntl(void){
+	struct file* f;
+	int cmd, arg;
+
+	if (argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+		return -1;
+	switch (cmd) {
+	case F_GETFL:
+		return f->flags;
+	case F_SETFL:
+		f->flags = arg & O_NONBLOCK;
+		return 0;
+	}
+	return -1;
+}
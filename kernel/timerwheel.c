@@ -0,0 +1,197 @@
+// Hierarchical timing wheel.
+//
+// Every CPU has its own wheel and runs it from its local APIC timer
+// interrupt, see trap(). A timer goes on the wheel of the CPU that adds
+// it. Level 0 has one slot per tick for the next 64 ticks, every further
+// level covers 64 times the range of the one below in slots 64 times as
+// wide. Whenever the low slot index wraps, the due slot of the next level
+// is cascaded down, so adding and cancelling a timer is O(1) and a tick
+// only touches the timers that expire or move down in it. Callbacks run
+// in interrupt context without the wheel's lock held.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "timerwheel.h"
+
+#define TW_BITS   6
+#define TW_SIZE   (1 << TW_BITS)
+#define TW_MASK   (TW_SIZE - 1)
+#define TW_LEVELS 4
+// Furthest a timer can be placed, later ones are clamped and re-placed
+// as they cascade (about 46 hours at 100 Hz).
+#define TW_MAX    ((1u << (TW_BITS * TW_LEVELS)) - 1)
+
+struct timerbase {
+	struct spinlock lock;
+	uint clk;               // Next tick to run
+	struct timer* running;  // Callback being called, see timer_cancel()
+	struct timer* vec[TW_LEVELS][TW_SIZE];
+};
+
+static struct timerbase bases[NCPU];
+
+void timerwheelinit(void){
+	for (int i = 0; i < NCPU; i++) {
+		initlock(&bases[i].lock, "timerwheel");
+		bases[i].clk = ticks;
+	}
+}
+
+void timer_init(struct timer* t, void (*func)(void*), void* arg){
+	t->next = 0;
+	t->pprev = 0;
+	t->base = 0;
+	t->expires = 0;
+	t->func = func;
+	t->arg = arg;
+}
+
+// Caller holds base->lock.
+static void enqueue(struct timerbase* base, struct timer* t){
+	uint delta = t->expires - base->clk;
+	uint at = t->expires;
+	struct timer** slot;
+
+	if ((int)delta < 0) {
+		// Already due, run with the current tick.
+		slot = &base->vec[0][base->clk & TW_MASK];
+	} else {
+		if (delta > TW_MAX)
+			at = base->clk + TW_MAX;
+		int level = 0;
+		while (level < TW_LEVELS - 1 &&
+		       (at - base->clk) >= (1u << (TW_BITS * (level + 1))))
+			level++;
+		slot = &base->vec[level][(at >> (TW_BITS * level)) & TW_MASK];
+	}
+	t->next = *slot;
+	if (t->next)
+		t->next->pprev = &t->next;
+	*slot = t;
+	t->pprev = slot;
+	t->base = base;
+}
+
+// Caller holds t->base->lock.
+static void dequeue(struct timer* t){
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->next = 0;
+	t->pprev = 0;
+}
+
+// Lock the wheel t is on. The base can change under us while t moves
+// to another CPU, so check it again once locked.
+static struct timerbase* lock_base(struct timer* t){
+	for (;;) {
+		struct timerbase* base = t->base;
+		if (!base)
+			return 0;
+		acquire(&base->lock);
+		if (t->base == base)
+			return base;
+		release(&base->lock);
+	}
+}
+
+// Take t off its wheel if it is pending. Returns 1 if it was. Unlike
+// timer_cancel() this does not wait for a running callback, so it may be
+// called with a lock held that the callback takes.
+int timer_detach(struct timer* t){
+	struct timerbase* base = lock_base(t);
+	int pending = 0;
+	if (base) {
+		if (t->pprev) {
+			dequeue(t);
+			pending = 1;
+		}
+		release(&base->lock);
+	}
+	return pending;
+}
+
+// Call t->func(t->arg) once ticks reaches expires. A pending timer is
+// moved, returns 1 if t was pending. May be called from the callback
+// itself to rearm it.
+int timer_add(struct timer* t, uint expires){
+	int pending = timer_detach(t);
+	pushcli();
+	struct timerbase* base = &bases[cpu->id];
+	acquire(&base->lock);
+	t->expires = expires;
+	enqueue(base, t);
+	release(&base->lock);
+	popcli();
+	return pending;
+}
+
+// Returns 1 if t was pending. Once this returns the callback is not
+// running either, so t may be freed. Must not be called from t's own
+// callback.
+int timer_cancel(struct timer* t){
+	int pending = timer_detach(t);
+	struct timerbase* base;
+	while ((base = lock_base(t)) != 0) {
+		int busy = base->running == t;
+		release(&base->lock);
+		if (!busy)
+			break;
+		amd64_pause();
+	}
+	return pending;
+}
+
+int timer_pending(struct timer* t){
+	return t->pprev != 0;
+}
+
+// Move the timers of one slot of level down to the levels below.
+static void cascade(struct timerbase* base, int level, int index){
+	struct timer* t = base->vec[level][index];
+	base->vec[level][index] = 0;
+	while (t) {
+		struct timer* next = t->next;
+		t->pprev = 0;
+		enqueue(base, t);
+		t = next;
+	}
+}
+
+// Run this CPU's wheel up to the current tick, called on every timer
+// interrupt.
+void timer_tick(void){
+	struct timerbase* base = &bases[cpu->id];
+	acquire(&base->lock);
+	while ((int)(ticks - base->clk) >= 0) {
+		int index = base->clk & TW_MASK;
+		int upper = index;
+		for (int level = 1; level < TW_LEVELS && !upper; level++) {
+			upper = (base->clk >> (TW_BITS * level)) & TW_MASK;
+			cascade(base, level, upper);
+		}
+		// Take the whole slot first, a callback that rearms its timer
+		// a full turn ahead must not land in the list being run.
+		struct timer* due = base->vec[0][index];
+		base->vec[0][index] = 0;
+		if (due)
+			due->pprev = &due;
+		base->clk++;
+		while (due) {
+			struct timer* t = due;
+			dequeue(t);
+			base->running = t;
+			release(&base->lock);
+			t->func(t->arg);
+			acquire(&base->lock);
+			base->running = 0;
+		}
+	}
+	release(&base->lock);
+}
@@ -8,6 +8,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "irq.h"
+#include "timerwheel.h"
 
 #include "UNetworkAdapter.hh"
 
@@ -35,6 +36,7 @@ void trap(struct trapframe* tf){
 			exit();
 		proc->tf = tf;
 		syscall();
+		LoopbackInterrupt();
 		if (proc->killed)
 			exit();
 		return;
@@ -53,7 +55,9 @@ void trap(struct trapframe* tf){
 			}
 	    #endif
 			release(&tickslock);
+			LoopbackInterrupt();
 		}
+		timer_tick();
 		lapiceoi();
 		break;
 	case T_IRQ0 + IRQ_IDE1:
@@ -107,6 +107,32 @@ void route(int argc, char *argv[])
     else {RTPrint();}
 }
 
+void netconf(int argc, char *argv[])
+{
+    static const struct {const char* Name; int Tunable;} Tunables[] =
+    {
+        {"tcp_max_connections", TunableTCPMaxConnections},
+        {"udp_max_sockets", TunableUDPMaxSockets},
+        {"tcp_max_tw_buckets", TunableTCPMaxTimeWait},
+        {"udp_rmem_default", TunableUDPReceiveBuffer},
+        {"udp_rcvbuf_errors", TunableUDPReceiveDrops},
+        {"net_mem_soft", TunableMemorySoftLimit},
+        {"net_mem_hard", TunableMemoryHardLimit},
+        {"tcp_mem", TunableMemoryTCP},
+        {"udp_mem", TunableMemoryUDP},
+        {"local_mem", TunableMemoryLocal},
+        {"frame_mem", TunableMemoryFrames},
+        {"net_mem_errors", TunableMemoryFailures},
+        {"net_mem_pressure", TunableMemoryPressure},
+    };
+    for (int i = 0; i < sizeof(Tunables) / sizeof(Tunables[0]); ++i)
+    {
+        if (argc > 2 && strncmp(argv[2], Tunables[i].Name, -1)) {continue;}
+        int Value = argc > 3 ? atoi(argv[3]) : -1;
+        printf("%s %d\n", Tunables[i].Name, NetTunable(Tunables[i].Tunable, Value));
+    }
+}
+
 int main(int argc, char *argv[])
 {
     if (argc == 1)
@@ -136,5 +162,9 @@ where  OBJECT := { address | addrlabel | fou | help | ila | ioam | l2tp | link |
     {
         route(argc, argv);
     }
+    else if (!strncmp(argv[1], "netconf", -1))
+    {
+        netconf(argc, argv);
+    }
     return procexit();
 }
@@ -1,10 +1,39 @@
 #include "types.h"
 #include "syscalls.h"
+#include "fcntl.h"
 #include "inet.h"
 #include "Socket.h"
+#include "epoll.h"
 #include "unix/stdio.h"
+#include "unix/stdlib.h"
+#include "unix/stdint.h"
 #include "string.h"
 
+unsigned StringToIPHex(const char* Str, _Bool* OK)
+{
+    char* StartPoint = (char*)Str, *EndPoint;
+    union{uint32_t i; uint8_t b[4];} Result;
+    long Temp = 0;
+    Result.i = 0;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        Temp = ustrtol(StartPoint, &EndPoint, 10);
+        if ((Temp < 0 || Temp > 255) ||
+            (StartPoint == EndPoint) ||
+            ((i == 3 && *EndPoint != '\0') || (i != 3 && *EndPoint != '.')))
+        {
+            if (OK) {*OK = 0;}
+            return -1;
+        }
+        Result.b[i] = Temp;
+        StartPoint = EndPoint + 1;
+    }
+
+    if (OK) {*OK = 1;}
+    return Result.i;
+}
+
 void TCPServer(unsigned short Port)
 {
     printf("TCP Server starting...\n");
@@ -66,6 +95,124 @@ void TCPServer(unsigned short Port)
     close(SocketFD);
 }
 
+// Serves every client from one process, readiness comes from epoll.
+void TCPMultiServer(unsigned short Port)
+{
+    printf("TCP Server starting...\n");
+    int SocketFD = socket(Internet, Stream, 0);
+    if (SocketFD < 0)
+    {
+        printf("TCP Server start failed\n");
+        return;
+    }
+    int EventPollFD = epoll_create(1);
+    if (EventPollFD < 0)
+    {
+        printf("epoll_create failed\n");
+        goto finished;
+    }
+
+    printf("Binding port: %d\n", Port);
+    if (bind(SocketFD, 0, Port) < 0)
+    {
+        printf("Failed to bind port.\n");
+        goto finished;
+    }
+    listen(SocketFD, 120);
+    // A readiness report can go stale before accept() gets to it.
+    fcntl(SocketFD, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event Event;
+    Event.events = EPOLLIN;
+    Event.data.fd = SocketFD;
+    epoll_ctl(EventPollFD, EPOLL_CTL_ADD, SocketFD, &Event);
+
+    printf("Waiting for connections...\n");
+    struct epoll_event Events[16];
+    char Buffer[2000];
+    while (1)
+    {
+        int Count = epoll_wait(EventPollFD, Events, 16, -1);
+        if (Count < 0) {break;}
+        for (int i = 0; i < Count; ++i)
+        {
+            int FD = Events[i].data.fd;
+            if (FD == SocketFD)
+            {
+                unsigned int DIPAddress;
+                unsigned short DPort;
+                int DestinationFD = accept(SocketFD, &DIPAddress, &DPort);
+                if (DestinationFD < 0) {continue;}
+                Event.events = EPOLLIN;
+                Event.data.fd = DestinationFD;
+                if (epoll_ctl(EventPollFD, EPOLL_CTL_ADD, DestinationFD, &Event) < 0)
+                {
+                    close(DestinationFD);
+                    continue;
+                }
+                printf("[%d] %d.%d.%d.%d:%d connected.\n", DestinationFD,
+                    (DIPAddress) & 0xFF,
+                    (DIPAddress >> 8) & 0xFF,
+                    (DIPAddress >> 16) & 0xFF,
+                    (DIPAddress >> 24) & 0xFF, DPort);
+                continue;
+            }
+            int ReturnValue = recv(FD, Buffer, sizeof(Buffer) - 1, MessageDontWait);
+            if (ReturnValue == FWOULDBLOCK) {continue;}
+            if (ReturnValue <= 0)
+            {
+                printf("[%d] disconnected\n", FD);
+                close(FD);
+                continue;
+            }
+            Buffer[ReturnValue] = 0;
+            printf("[%d] Received %d bytes data: %s", FD, ReturnValue, Buffer);
+        }
+    }
+
+    finished:
+    if (EventPollFD >= 0) {close(EventPollFD);}
+    close(SocketFD);
+}
+
+void TCPClient(unsigned int Address, unsigned short Port)
+{
+    printf("TCP Client starting...\n");
+    int SocketFD = socket(Internet, Stream, 0);
+    if (SocketFD < 0)
+    {
+        printf("TCP Client start failed\n");
+        return;
+    }
+
+    printf("Connecting to %d.%d.%d.%d:%d...\n",
+        (Address) & 0xFF,
+        (Address >> 8) & 0xFF,
+        (Address >> 16) & 0xFF,
+        (Address >> 24) & 0xFF, Port);
+    if (connect(SocketFD, Address, Port) < 0)
+    {
+        printf("Failed to connect.\n");
+        goto finished;
+    }
+    printf("Connected.\n");
+
+    char Buffer[2000];
+    while (1)
+    {
+        int Size = read(0, Buffer, sizeof(Buffer));
+        if (Size <= 0 || (Size == 3 && !strncmp(Buffer, "q!\n", 3))) {break;}
+        if (socksend(SocketFD, Buffer, Size) < 0)
+        {
+            printf("Connection closed.\n");
+            break;
+        }
+    }
+
+    finished:
+    close(SocketFD);
+}
+
 void UDPServer(unsigned short Port)
 {
     printf("UDP Server starting...\n");
@@ -118,7 +265,13 @@ void UDPServer(unsigned short Port)
 int main(int argc, char *argv[])
 {
     if (argc == 1) {return 0x0D000721;}
-    if (argc == 2)
+    if (argc == 4 && !strncmp(argv[1], "-c", -1))
+    {
+        _Bool OK = 1;
+        unsigned int Address = StringToIPHex(argv[2], &OK);
+        if (OK) {TCPClient(Address, atoi(argv[3]));}
+    }
+    else if (argc == 2)
     {
         TCPServer(atoi(argv[1]));
     }
@@ -128,6 +281,10 @@ int main(int argc, char *argv[])
         {
             UDPServer(atoi(argv[1]));
         }
+        else if (!strncmp(argv[2], "-m", -1))
+        {
+            TCPMultiServer(atoi(argv[1]));
+        }
     }
     return procexit();
 }